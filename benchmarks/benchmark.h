@@ -0,0 +1,58 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// A benchmark is a name and a function that measures something and reports it on a stream
+struct Benchmark {
+    const char *name;
+    void (*run)(std::ostream &out);
+};
+
+// Runs body repeatedly for at least minSeconds and returns the average seconds per run
+template <typename Body>
+double secondsPerRun(Body body, double minSeconds = 0.25)
+{
+    using clock = std::chrono::steady_clock;
+
+    // Warm up caches and branch predictors
+    body();
+
+    long runs = 0;
+    clock::time_point start = clock::now();
+    double elapsed = 0;
+    do {
+        body();
+        ++runs;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return elapsed / runs;
+}
+
+// Prints "name: <units per second> <unitName>/s"
+inline void reportRate(std::ostream &out, const std::string &name, double units, double seconds, const std::string &unitName)
+{
+    out << std::left << std::setw(48) << name << " "
+        << std::right << std::setw(12) << std::fixed << std::setprecision(1) << units / seconds / 1e6
+        << " M" << unitName << "/s" << std::endl;
+}
+
+// Prints "name: <nanoseconds per unit> ns/<unitName>"
+inline void reportCost(std::ostream &out, const std::string &name, double units, double seconds, const std::string &unitName)
+{
+    out << std::left << std::setw(48) << name << " "
+        << std::right << std::setw(12) << std::fixed << std::setprecision(2) << seconds / units * 1e9
+        << " ns/" << unitName << std::endl;
+}
+
+// Keeps the compiler from optimizing away a computed value
+template <typename T>
+inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+#endif
@@ -0,0 +1,422 @@
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+#include "batch.h"
+#include "bytecode.h"
+#include "closure.h"
+#include "flatExpression.h"
+#include "jit.h"
+#include "parser.h"
+#include "simplify.h"
+#include "virtualMachine.h"
+
+// One long expression mixing all the node types
+std::string makeEvaluationBenchmarkExpression()
+{
+    std::string expression = "x";
+    for (int term = 0; term < 20000; ++term) {
+        expression += term % 2 ? " + (x * 1.5 - y / 3)" : " - sin(x * y) * 2";
+    }
+    return expression;
+}
+
+// The number of nodes of a tree, counting shared nodes each time they are used
+double countTreeNodes(NodePtr root)
+{
+    double count = 0;
+    std::vector<NodePtr> pending {root};
+    while (!pending.empty()) {
+        NodePtr node = pending.back();
+        pending.pop_back();
+        ++count;
+        for (std::size_t i = 0; i < node->childCount(); ++i) {
+            pending.push_back(node->child(i));
+        }
+    }
+    return count;
+}
+
+void benchmarkTreeVersusFlat(std::ostream &out)
+{
+    std::istringstream input{makeEvaluationBenchmarkExpression()};
+    std::ostream nullStream(nullptr);
+    Parser parser(input, nullStream);
+    NodePtr tree = parser.getNextExpressionNode();
+    FlatExpression flat = FlatExpression::fromNode(tree);
+    // Rates are per node of the written expression; the flat one holds each shared node once
+    double nodes = countTreeNodes(tree);
+
+    userFunctionsMap functions;
+
+    variablesMap variables {{intern("x"), 0.7}, {intern("y"), 1.3}};
+    EvaluationContext context(functions, variables);
+    SymbolId x = intern("x");
+
+    double seconds = secondsPerRun([&]() { doNotOptimize(tree->eval(context)); });
+    reportRate(out, "evaluation/eval tree", nodes, seconds, "nodes");
+    seconds = secondsPerRun([&]() { doNotOptimize(flat.eval(context)); });
+    reportRate(out, "evaluation/eval flat", nodes, seconds, "nodes");
+
+    seconds = secondsPerRun([&]() {
+        NodeArena arena;
+        doNotOptimize(tree->derivative(x, arena));
+    });
+    reportRate(out, "evaluation/derivative tree", nodes, seconds, "nodes");
+    seconds = secondsPerRun([&]() { doNotOptimize(flat.derivative(x)); });
+    reportRate(out, "evaluation/derivative flat", nodes, seconds, "nodes");
+
+    seconds = secondsPerRun([&]() { doNotOptimize(tree->toString(ToStringType::TOP_LEVEL)); });
+    reportRate(out, "evaluation/toString tree", nodes, seconds, "nodes");
+    seconds = secondsPerRun([&]() { doNotOptimize(flat.toString()); });
+    reportRate(out, "evaluation/toString flat", nodes, seconds, "nodes");
+}
+
+// Right nested operations, as deep as the wide expression is long
+std::string makeDeepBenchmarkExpression()
+{
+    std::string expression;
+    for (int level = 0; level < 20000; ++level) {
+        expression += level % 2 ? "x * (" : "1.5 - (";
+    }
+    expression += "y";
+    expression.append(20000, ')');
+    return expression;
+}
+
+// Sums of calls to f x = x * x + 1 and g y = f(y) / x
+std::string makeCallsBenchmarkExpression()
+{
+    std::string expression = "g(x)";
+    for (int term = 0; term < 5000; ++term) {
+        expression += term % 2 ? " + g(y)" : " - f(x * 2)";
+    }
+    return expression;
+}
+
+void benchmarkTreeVersusBytecode(std::ostream &out)
+{
+    std::istringstream fInput{"x * x + 1"}, gInput{"f(y) / x"};
+    std::ostream nullStream(nullptr);
+    Parser fParser(fInput, nullStream), gParser(gInput, nullStream);
+    UserFunctionPtr f(new UserFunction{intern("f"), intern("x"), fParser.getNextExpressionNode()});
+    UserFunctionPtr g(new UserFunction{intern("g"), intern("y"), gParser.getNextExpressionNode()});
+    userFunctionsMap functions {{f->name, f}, {g->name, g}};
+    variablesMap variables {{intern("x"), 0.7}, {intern("y"), 1.3}};
+
+    struct Shape {
+        const char *name;
+        std::string expression;
+    };
+    const Shape shapes[] = {
+        {"wide", makeEvaluationBenchmarkExpression()},
+        {"deep", makeDeepBenchmarkExpression()},
+        {"calls", makeCallsBenchmarkExpression()}
+    };
+    for (const Shape &shape : shapes) {
+        std::istringstream input{shape.expression};
+        Parser parser(input, nullStream);
+        NodePtr tree = parser.getNextExpressionNode();
+        Bytecode code = Bytecode::compile(tree, functions);
+        double nodes = countTreeNodes(tree);
+
+        EvaluationContext context(functions, variables);
+        VirtualMachine machine;
+        std::string name = std::string("evaluation/") + shape.name;
+        double seconds = secondsPerRun([&]() { doNotOptimize(tree->eval(context)); });
+        reportRate(out, name + " tree", nodes, seconds, "nodes");
+        seconds = secondsPerRun([&]() { doNotOptimize(machine.run(code, context)); });
+        reportRate(out, name + " bytecode", nodes, seconds, "nodes");
+    }
+}
+
+void benchmarkDispatch(std::ostream &out)
+{
+    // Expressions without user function calls, so that every instruction is run once per run;
+    // the derivative is where the superinstructions are most frequent
+    std::istringstream wideInput{makeEvaluationBenchmarkExpression()};
+    std::istringstream deepInput{makeDeepBenchmarkExpression()};
+    std::ostream nullStream(nullptr);
+    Parser wideParser(wideInput, nullStream), deepParser(deepInput, nullStream);
+    NodePtr wide = wideParser.getNextExpressionNode();
+    NodeArena arena;
+
+    struct Shape {
+        const char *name;
+        NodePtr tree;
+    };
+    const Shape shapes[] = {
+        {"wide", wide},
+        {"deep", deepParser.getNextExpressionNode()},
+        {"derivative", wide->derivative(intern("x"), arena)}
+    };
+
+    userFunctionsMap functions;
+    variablesMap variables {{intern("x"), 0.7}, {intern("y"), 1.3}};
+    EvaluationContext context(functions, variables);
+    for (const Shape &shape : shapes) {
+        Bytecode code = Bytecode::compile(shape.tree, functions);
+        for (Dispatch dispatch : {Dispatch::SWITCH, Dispatch::THREADED}) {
+            std::string name = std::string("evaluation/dispatch ") + shape.name
+                + (dispatch == Dispatch::SWITCH ? " switch" : " threaded");
+            VirtualMachine machine;
+            if (!machine.setDispatch(dispatch)) {
+                out << name << ": not supported" << std::endl;
+                continue;
+            }
+            double seconds = secondsPerRun([&]() { doNotOptimize(machine.run(code, context)); });
+            reportCost(out, name, code.instructions().size(), seconds, "instruction");
+        }
+    }
+}
+
+// Evaluates a user function and its derivative over many parameter values, as plotting
+// or root finding would: with the tree walker, the bytecode machine, closures and native
+// code, and what compiling to closures and native code costs
+void benchmarkFunctions(std::ostream &out)
+{
+    // Builtins have no derivatives (sin' is unknown), so the derived function is rational
+    std::istringstream functionInput{"(x * x * x - 3 * x + 1) / (x * x + 1) + sin(x) * exp(x / 4) - log(x * x + 2) * y"};
+    std::istringstream derivedInput{"(x * x * x - 3 * x + 1) / (x * x + 1) - x * y / (x + 4)"};
+    std::ostream nullStream(nullptr);
+    Parser functionParser(functionInput, nullStream), derivedParser(derivedInput, nullStream);
+    NodeArena arena;
+
+    struct Shape {
+        const char *name;
+        UserFunction function;
+    };
+    const Shape shapes[] = {
+        {"user function", UserFunction {intern("h"), intern("x"), functionParser.getNextExpressionNode()}},
+        {"user derivative", UserFunction {intern("h"), intern("x"), derivedParser.getNextExpressionNode()->derivative(intern("x"), arena)}}
+    };
+
+    userFunctionsMap functions;
+    variablesMap variables {{intern("y"), 1.3}};
+    const int points = 10000;
+    for (const Shape &shape : shapes) {
+        const UserFunction &function = shape.function;
+        Bytecode code = Bytecode::compile(function, functions);
+        ClosureFunction closures = ClosureFunction::compile(code);
+        JitFunction native = JitFunction::compile(code);
+        EvaluationContext context(functions, variables);
+        VirtualMachine machine;
+        std::string name = std::string("evaluation/") + shape.name;
+
+        double seconds = secondsPerRun([&]() {
+            for (int i = 0; i < points; ++i) {
+                double x = i * 0.001;
+                doNotOptimize(context.withParameter(function.argumentName, x, [&]() { return function.bodyNode->eval(context); }));
+            }
+        });
+        reportRate(out, name + " tree", points, seconds, "calls");
+
+        seconds = secondsPerRun([&]() {
+            for (int i = 0; i < points; ++i) {
+                double x = i * 0.001;
+                doNotOptimize(context.withParameter(function.argumentName, x, [&]() { return machine.run(code, context, x); }));
+            }
+        });
+        reportRate(out, name + " bytecode", points, seconds, "calls");
+
+        seconds = secondsPerRun([&]() {
+            for (int i = 0; i < points; ++i) {
+                double x = i * 0.001;
+                doNotOptimize(context.withParameter(function.argumentName, x, [&]() { return closures(x, machine, context); }));
+            }
+        });
+        reportRate(out, name + " closures", points, seconds, "calls");
+
+        seconds = secondsPerRun([&]() { doNotOptimize(ClosureFunction::compile(code).size()); });
+        reportCost(out, name + " closure compilation", 1, seconds, "compilation");
+
+        if (!native.valid()) {
+            out << name << " native: not supported" << std::endl;
+            continue;
+        }
+        seconds = secondsPerRun([&]() {
+            for (int i = 0; i < points; ++i) {
+                double x = i * 0.001;
+                doNotOptimize(context.withParameter(function.argumentName, x, [&]() { return native(x, machine, context); }));
+            }
+        });
+        reportRate(out, name + " native", points, seconds, "calls");
+
+        seconds = secondsPerRun([&]() { doNotOptimize(JitFunction::compile(code).codeSize()); });
+        reportCost(out, name + " native compilation", 1, seconds, "compilation");
+    }
+}
+
+// Evaluates a user function and its derivative at many points: one point at a time with
+// the bytecode machine, and in batches with each supported implementation
+void benchmarkBatch(std::ostream &out)
+{
+    std::istringstream input{"(x * x * x - 3 * x + 1) / (x * x + 1) - x * y / (x + 4)"};
+    std::ostream nullStream(nullptr);
+    Parser parser(input, nullStream);
+    NodeArena arena;
+    UserFunction function {intern("h"), intern("x"), parser.getNextExpressionNode()};
+    UserFunction derivative {intern("h"), intern("x"), function.derivative(arena)};
+
+    struct Shape {
+        const char *name;
+        const UserFunction *function;
+        bool derive;
+    };
+    const Shape shapes[] = {
+        {"function", &function, false},
+        {"derivative", &function, true}
+    };
+
+    userFunctionsMap functions;
+    variablesMap variables {{intern("y"), 1.3}};
+    const std::size_t points = 100000;
+    std::vector<double> xs(points), values(points);
+    for (std::size_t i = 0; i < points; ++i) {
+        xs[i] = static_cast<double>(i) * 0.001;
+    }
+
+    BatchImplementation saved = currentBatchImplementation();
+    for (const Shape &shape : shapes) {
+        const UserFunction &evaluated = shape.derive ? derivative : function;
+        Bytecode code = Bytecode::compile(evaluated, functions);
+        EvaluationContext context(functions, variables);
+        VirtualMachine machine;
+        std::string name = std::string("evaluation/batch ") + shape.name;
+
+        double seconds = secondsPerRun([&]() {
+            for (std::size_t i = 0; i < points; ++i) {
+                double x = xs[i];
+                values[i] = context.withParameter(evaluated.argumentName, x, [&]() { return machine.run(code, context, x); });
+            }
+            doNotOptimize(values.front());
+        });
+        reportRate(out, name + " pointwise bytecode", points, seconds, "points");
+
+        for (BatchImplementation implementation : {BatchImplementation::SCALAR, BatchImplementation::SSE2, BatchImplementation::AVX2, BatchImplementation::AVX512}) {
+            if (!setBatchImplementation(implementation)) {
+                out << name << " " << batchImplementationName(implementation) << ": not supported" << std::endl;
+                continue;
+            }
+            seconds = secondsPerRun([&]() {
+                if (shape.derive) {
+                    evalDerivativeBatch(*shape.function, context, xs.data(), values.data(), points);
+                } else {
+                    evalBatch(*shape.function, context, xs.data(), values.data(), points);
+                }
+                doNotOptimize(values.front());
+            });
+            reportRate(out, name + " " + batchImplementationName(implementation), points, seconds, "points");
+        }
+    }
+    setBatchImplementation(saved);
+}
+
+// Evaluates the derivative of q(k + 1) = q(k) / (q(k) + 1) at growing depths, in each tier.
+// Its tree is exponential in the depth, but each shared subtree is computed once, so that
+// the cost grows linearly.
+void benchmarkShared(std::ostream &out)
+{
+    userFunctionsMap functions;
+    variablesMap variables;
+    EvaluationContext context(functions, variables);
+    VirtualMachine machine;
+    const double x = 0.5;
+    for (int depth : {8, 16, 32, 64}) {
+        NodeArena arena;
+        NodePtr quotient = arena.make<VariableNode>("x");
+        for (int level = 0; level < depth; ++level) {
+            quotient = arena.make<DivisionNode>(quotient, arena.make<AdditionNode>(quotient, arena.make<NumberNode>(1)));
+        }
+        UserFunction function {intern("h"), intern("x"), quotient->derivative(intern("x"), arena)};
+        Bytecode code = Bytecode::compile(function, functions);
+        ClosureFunction closures = ClosureFunction::compile(code);
+        JitFunction native = JitFunction::compile(code);
+        std::string name = "evaluation/shared depth " + std::to_string(depth);
+
+        double seconds = secondsPerRun([&]() {
+            doNotOptimize(context.withParameter(function.argumentName, x, [&]() { return function.bodyNode->eval(context); }));
+        });
+        reportCost(out, name + " tree", 1, seconds, "evaluation");
+        seconds = secondsPerRun([&]() { doNotOptimize(machine.run(code, context, x)); });
+        reportCost(out, name + " bytecode", 1, seconds, "evaluation");
+        if (closures.valid()) {
+            seconds = secondsPerRun([&]() { doNotOptimize(closures(x, machine, context)); });
+            reportCost(out, name + " closures", 1, seconds, "evaluation");
+        }
+        if (native.valid()) {
+            seconds = secondsPerRun([&]() { doNotOptimize(native(x, machine, context)); });
+            reportCost(out, name + " native", 1, seconds, "evaluation");
+        }
+    }
+}
+
+// Evaluates expressions before and after simplification: one with constant subtrees,
+// simplified as at the top level, and a derivative, simplified as by UserFunction. Rates
+// are per node of the expression before simplification.
+void benchmarkSimplify(std::ostream &out)
+{
+    std::string expression = "x";
+    for (int term = 0; term < 5000; ++term) {
+        expression += term % 2 ? " + x * (2 * pi * 3) * 1" : " - y * sin(pi / 4) / (e - 1)";
+    }
+    std::istringstream constantsInput{expression};
+    std::istringstream derivedInput{makeEvaluationBenchmarkExpression()};
+    std::ostream nullStream(nullptr);
+    Parser constantsParser(constantsInput, nullStream);
+    Parser derivedParser(derivedInput, nullStream);
+    NodeArena arena;
+    NodePtr constants = constantsParser.getNextExpressionNode();
+    NodePtr derivative = derivedParser.getNextExpressionNode()->derivative(intern("x"), arena);
+
+    userFunctionsMap functions;
+    variablesMap globals {{intern("e"), M_E}, {intern("pi"), M_PI}};
+    struct Shape {
+        const char *name;
+        NodePtr node;
+        Simplifier simplifier;
+    };
+    Shape shapes[] = {
+        {"constants", constants, Simplifier(Simplification::EXACT, &functions, &globals)},
+        {"derivative", derivative, Simplifier(Simplification::ALGEBRAIC, nullptr)}
+    };
+
+    variablesMap variables {{intern("x"), 0.7}, {intern("y"), 1.3}};
+    EvaluationContext context(functions, variables);
+    VirtualMachine machine;
+    for (Shape &shape : shapes) {
+        std::string name = std::string("simplify/") + shape.name;
+        NodePtr simple = shape.simplifier.simplify(shape.node, arena);
+        double nodes = static_cast<double>(shape.simplifier.nodesBefore());
+        out << std::left << std::setw(48) << (name + " nodes") << " "
+            << shape.simplifier.nodesBefore() << " -> " << shape.simplifier.nodesAfter() << std::endl;
+
+        double seconds = secondsPerRun([&]() {
+            NodeArena scratch;
+            doNotOptimize(shape.simplifier.simplify(shape.node, scratch));
+        });
+        reportRate(out, name + " simplification", nodes, seconds, "nodes");
+
+        for (bool simplified : {false, true}) {
+            NodePtr evaluated = simplified ? simple : shape.node;
+            std::string version = simplified ? " simplified" : " as written";
+            seconds = secondsPerRun([&]() { doNotOptimize(evaluated->eval(context)); });
+            reportRate(out, name + version + " tree", nodes, seconds, "nodes");
+            Bytecode code = Bytecode::compile(evaluated, functions);
+            seconds = secondsPerRun([&]() { doNotOptimize(machine.run(code, context)); });
+            reportRate(out, name + version + " bytecode", nodes, seconds, "nodes");
+        }
+    }
+}
+
+const Benchmark benchmarkEvaluation[] = {
+    {"evaluation/tree vs flat", benchmarkTreeVersusFlat},
+    {"evaluation/tree vs bytecode", benchmarkTreeVersusBytecode},
+    {"evaluation/dispatch", benchmarkDispatch},
+    {"evaluation/functions", benchmarkFunctions},
+    {"evaluation/batch", benchmarkBatch},
+    {"evaluation/shared", benchmarkShared},
+    {"simplify", benchmarkSimplify}
+};
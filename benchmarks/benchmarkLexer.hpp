@@ -0,0 +1,127 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+#include "benchmark.h"
+
+#include "lexer.h"
+#include "scan.h"
+#include "tokenStream.h"
+
+// Statements with long digit runs, long identifiers and heavy indentation
+std::string makeLexerBenchmarkInput()
+{
+    std::string line =
+            "                coefficientOfTheSeventeenthTermOfTheExpansion = "
+            "3.14159265358979323846264338327950288419716939937510582097494459 * "
+            "                  anotherQuiteLongIdentifierName + 271828182845904523536028747135266249775724709369995\n";
+    std::string input;
+    while (input.size() < (8 << 20)) {
+        input += line;
+    }
+    return input;
+}
+
+void lexWhole(const std::string &input)
+{
+    Lexer lexer(input.data(), input.data() + input.size());
+    while (lexer.hasNextToken()) {
+        Token token = lexer.nextToken();
+        doNotOptimize(token);
+    }
+}
+
+void benchmarkLexerThroughput(std::ostream &out)
+{
+    std::string input = makeLexerBenchmarkInput();
+
+    ScanImplementation saved = currentScanImplementation();
+    for (ScanImplementation implementation : {ScanImplementation::SCALAR, ScanImplementation::SSE2, ScanImplementation::AVX2}) {
+        if (!setScanImplementation(implementation)) {
+            out << "lexer/" << scanImplementationName(implementation) << ": not supported" << std::endl;
+            continue;
+        }
+        double seconds = secondsPerRun([&input]() { lexWhole(input); });
+        reportRate(out, "lexer/" + scanImplementationName(implementation), input.size(), seconds, "B");
+    }
+    setScanImplementation(saved);
+}
+
+void benchmarkTokenizeAll(std::ostream &out)
+{
+    std::string input = makeLexerBenchmarkInput();
+    double seconds = secondsPerRun([&input]() {
+        Lexer lexer(input.data(), input.data() + input.size());
+        TokenStream tokens;
+        lexer.tokenizeAll(tokens);
+        doNotOptimize(tokens);
+    });
+    reportRate(out, "lexer/tokenizeAll", input.size(), seconds, "B");
+}
+
+// Reading the same input from a file descriptor in chunks, as the binary does with stdin
+void benchmarkChunkedInput(std::ostream &out)
+{
+    std::string input = makeLexerBenchmarkInput();
+    FILE *file = std::tmpfile();
+    std::fwrite(input.data(), 1, input.size(), file);
+    std::fflush(file);
+
+    double seconds = secondsPerRun([&input]() { lexWhole(input); });
+    reportRate(out, "lexer/buffer", input.size(), seconds, "B");
+
+    seconds = secondsPerRun([file]() {
+        lseek(fileno(file), 0, SEEK_SET);
+        Lexer lexer(fileno(file));
+        while (lexer.hasNextToken()) {
+            Token token = lexer.nextToken();
+            doNotOptimize(token);
+        }
+    });
+    reportRate(out, "lexer/chunked", input.size(), seconds, "B");
+    std::fclose(file);
+}
+
+// Tabulated coefficients: almost only numbers
+std::string makeNumbersBenchmarkInput()
+{
+    std::string input;
+    unsigned seed = 12345;
+    while (input.size() < (8 << 20)) {
+        seed = seed * 1103515245 + 12345;
+        input += std::to_string(seed % 1000) + "." + std::to_string(seed) + "e-" + std::to_string(seed % 20) + " + ";
+    }
+    input += "0";
+    return input;
+}
+
+void benchmarkNumberConversion(std::ostream &out)
+{
+    std::string input = makeNumbersBenchmarkInput();
+    double seconds = secondsPerRun([&input]() { lexWhole(input); });
+    reportRate(out, "lexer/numbers", input.size(), seconds, "B");
+
+    // What the parser used to do: copy each literal to a string and call atof
+    seconds = secondsPerRun([&input]() {
+        const char *p = input.data();
+        const char *end = p + input.size();
+        while (p < end) {
+            const char *literalEnd = p;
+            while (literalEnd < end && *literalEnd != ' ') {
+                ++literalEnd;
+            }
+            double value = std::atof(std::string(p, literalEnd).c_str());
+            doNotOptimize(value);
+            p = literalEnd + 3;
+        }
+    });
+    reportRate(out, "lexer/numbers (string copy + atof)", input.size(), seconds, "B");
+}
+
+const Benchmark benchmarkLexer[] = {
+    {"lexer", benchmarkLexerThroughput},
+    {"lexer/tokenizeAll", benchmarkTokenizeAll},
+    {"lexer/chunked", benchmarkChunkedInput},
+    {"lexer/numbers", benchmarkNumberConversion}
+};
@@ -0,0 +1,39 @@
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+#include "benchmark.h"
+
+#include "benchmarkLexer.hpp"
+#include "benchmarkParser.hpp"
+#include "benchmarkEvaluation.hpp"
+#include "benchmarkMath.hpp"
+
+template <std::size_t N>
+void addBenchmarks(Benchmark const (&toAdd)[N], std::vector<Benchmark> &benchmarks)
+{
+    std::copy(toAdd, toAdd + N, std::back_inserter(benchmarks));
+}
+
+// Runs all the benchmarks, or only those whose name starts with one of the arguments
+int main(int argc, char* argv[])
+{
+    std::vector<Benchmark> benchmarks;
+    addBenchmarks(benchmarkLexer, benchmarks);
+    addBenchmarks(benchmarkParser, benchmarks);
+    addBenchmarks(benchmarkEvaluation, benchmarks);
+    addBenchmarks(benchmarkMath, benchmarks);
+
+    for (const Benchmark &benchmark : benchmarks) {
+        bool selected = argc <= 1;
+        for (int i = 1; i < argc; ++i) {
+            selected = selected || std::strncmp(benchmark.name, argv[i], std::strlen(argv[i])) == 0;
+        }
+        if (selected) {
+            benchmark.run(std::cout);
+        }
+    }
+
+    return 0;
+}
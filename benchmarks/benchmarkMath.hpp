@@ -0,0 +1,45 @@
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+#include "vectorMath.h"
+
+// Runs each builtin over arrays of arguments in its usual range, with libm and each
+// supported vectorized implementation
+void benchmarkMathThroughput(std::ostream &out)
+{
+    struct Function {
+        const char *name;
+        arrayFunction VectorMath::*function;
+        double low;
+        double high;
+    };
+    const Function functions[] = {
+        {"exp", &VectorMath::exp, -20, 20},
+        {"log", &VectorMath::log, 1e-3, 1e3},
+        {"sin", &VectorMath::sin, -10, 10},
+        {"cos", &VectorMath::cos, -10, 10},
+        {"tan", &VectorMath::tan, -10, 10}
+    };
+
+    const std::size_t elements = 4096;
+    std::vector<double> arguments(elements), values(elements);
+    for (const Function &function : functions) {
+        for (std::size_t i = 0; i < elements; ++i) {
+            arguments[i] = function.low + (function.high - function.low) * static_cast<double>(i) / elements;
+        }
+        for (const VectorMath *math : supportedVectorMath()) {
+            double seconds = secondsPerRun([&]() {
+                values = arguments;
+                (math->*function.function)(values.data(), elements);
+                doNotOptimize(values.front());
+            });
+            reportRate(out, std::string("math/") + function.name + " " + math->name, elements, seconds, "elements");
+        }
+    }
+}
+
+const Benchmark benchmarkMath[] = {
+    {"math/throughput", benchmarkMathThroughput}
+};
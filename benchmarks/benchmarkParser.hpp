@@ -0,0 +1,142 @@
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+#include "parser.h"
+
+// One-line programs, one in ten of them bad: a parse error, a lexer error or an unknown name
+std::vector<std::string> makeErrorRateBenchmarkInput()
+{
+    const char *good[] = {
+        "x = 1.5 * (3 + 2) / 7",
+        "sin(pi / 4) * cos(pi / 4) + exp(1) - e",
+        "def f x = x * x + 2 * x + 1",
+        "log(10) * 2 + 3 * (4 - 1)",
+    };
+    const char *bad[] = {
+        "1.5 * (3 + 2",
+        "2 % 3 + 1",
+        "zz * 2 + 1",
+    };
+
+    std::vector<std::string> lines;
+    for (int i = 0; i < 10000; ++i) {
+        lines.push_back(i % 10 == 9 ? bad[(i / 10) % 3] : good[i % 4]);
+    }
+    return lines;
+}
+
+void benchmarkErrorRate(std::ostream &out)
+{
+    std::vector<std::string> lines = makeErrorRateBenchmarkInput();
+    std::ostream nullStream(nullptr);
+
+    double seconds = secondsPerRun([&lines, &nullStream]() {
+        for (const std::string &line : lines) {
+            Parser parser(line.data(), line.data() + line.size(), nullStream);
+            Status status = parser.run();
+            doNotOptimize(status);
+        }
+    });
+    reportRate(out, "parser/errors 10% (status)", lines.size(), seconds, "lines");
+
+    seconds = secondsPerRun([&lines, &nullStream]() {
+        for (const std::string &line : lines) {
+            Parser parser(line.data(), line.data() + line.size(), nullStream);
+            try {
+                parser.parseProgram();
+            } catch (const std::exception &e) {
+                doNotOptimize(e);
+            }
+        }
+    });
+    reportRate(out, "parser/errors 10% (exceptions)", lines.size(), seconds, "lines");
+}
+
+// Function definitions with long flat sums and products, so that parsing is not
+// drowned out by evaluation
+std::string makeFlatExpressionBenchmarkInput(const char *operators)
+{
+    std::string input;
+    for (int line = 0; line < 200; ++line) {
+        input += "def f x = x";
+        for (int term = 0; term < 1000; ++term) {
+            input += ' ';
+            input += operators[term % 2];
+            input += term % 3 == 0 ? " x" : " 2.5";
+        }
+        input += '\n';
+    }
+    return input;
+}
+
+void benchmarkFlatExpressions(std::ostream &out)
+{
+    std::ostream nullStream(nullptr);
+    for (const char *operators : {"+-", "*/"}) {
+        std::string input = makeFlatExpressionBenchmarkInput(operators);
+        double seconds = secondsPerRun([&input, &nullStream]() {
+            Parser parser(input.data(), input.data() + input.size(), nullStream);
+            Status status = parser.run();
+            doNotOptimize(status);
+        });
+        reportRate(out, std::string("parser/flat ") + operators, input.size(), seconds, "B");
+    }
+}
+
+// Many small expression statements, whose nodes are thrown away right after evaluation
+void benchmarkStatements(std::ostream &out)
+{
+    std::string input = "x = 0.5\n";
+    while (input.size() < (4 << 20)) {
+        input += "x = (1 + 2) * 3 - sin(x) / 5\nx * 2 + cos(x * pi)\n";
+    }
+    std::ostream nullStream(nullptr);
+    double seconds = secondsPerRun([&input, &nullStream]() {
+        Parser parser(input.data(), input.data() + input.size(), nullStream);
+        Status status = parser.run();
+        doNotOptimize(status);
+    });
+    reportRate(out, "parser/statements", input.size(), seconds, "B");
+}
+
+// Defines many variables and functions, then makes calls which use a few of them
+std::string makeDefinedNamesBenchmarkInput(int names)
+{
+    std::string input;
+    for (int name = 0; name < names; ++name) {
+        std::string suffix = std::to_string(name);
+        input += "v" + suffix + " = " + suffix + "\n";
+        input += "def f" + suffix + " x = x * v" + suffix + " + 1\n";
+    }
+    for (int call = 0; call < 20000; ++call) {
+        std::string suffix = std::to_string(call % names);
+        input += "f" + suffix + "(v0) + f" + suffix + "(2)\n";
+    }
+    return input;
+}
+
+void benchmarkDefinedNames(std::ostream &out)
+{
+    // The cost of a statement should not depend on how many names are defined
+    std::ostream nullStream(nullptr);
+    for (int names : {10, 10000}) {
+        std::string input = makeDefinedNamesBenchmarkInput(names);
+        double seconds = secondsPerRun([&input, &nullStream]() {
+            Parser parser(input.data(), input.data() + input.size(), nullStream);
+            Status status = parser.run();
+            doNotOptimize(status);
+        });
+        std::string name = "parser/" + std::to_string(names) + " names defined";
+        reportRate(out, name, 2 * names + 20000, seconds, "lines");
+    }
+}
+
+const Benchmark benchmarkParser[] = {
+    {"parser/statements", benchmarkStatements},
+    {"parser/flat", benchmarkFlatExpressions},
+    {"parser/errors", benchmarkErrorRate},
+    {"parser/defined names", benchmarkDefinedNames}
+};
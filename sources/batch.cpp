@@ -0,0 +1,413 @@
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "batch.h"
+#include "bytecode.h"
+#include "nodeArena.h"
+#include "vectorMath.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_HAS_X86 1
+#endif
+
+namespace {
+
+// Points run together through each instruction: enough to amortize its dispatch,
+// few enough for the columns of the operand stack to stay in the L1 and L2 caches
+const std::size_t CHUNK = 256;
+
+struct Add {
+    static double apply(double left, double right) { return left + right; }
+#ifdef BATCH_HAS_X86
+    __attribute__((target("sse2"))) static __m128d sse2(__m128d left, __m128d right) { return _mm_add_pd(left, right); }
+    __attribute__((target("avx2"))) static __m256d avx2(__m256d left, __m256d right) { return _mm256_add_pd(left, right); }
+    __attribute__((target("avx512f"))) static __m512d avx512(__m512d left, __m512d right) { return _mm512_add_pd(left, right); }
+#endif
+};
+
+struct Subtract {
+    static double apply(double left, double right) { return left - right; }
+#ifdef BATCH_HAS_X86
+    __attribute__((target("sse2"))) static __m128d sse2(__m128d left, __m128d right) { return _mm_sub_pd(left, right); }
+    __attribute__((target("avx2"))) static __m256d avx2(__m256d left, __m256d right) { return _mm256_sub_pd(left, right); }
+    __attribute__((target("avx512f"))) static __m512d avx512(__m512d left, __m512d right) { return _mm512_sub_pd(left, right); }
+#endif
+};
+
+struct Multiply {
+    static double apply(double left, double right) { return left * right; }
+#ifdef BATCH_HAS_X86
+    __attribute__((target("sse2"))) static __m128d sse2(__m128d left, __m128d right) { return _mm_mul_pd(left, right); }
+    __attribute__((target("avx2"))) static __m256d avx2(__m256d left, __m256d right) { return _mm256_mul_pd(left, right); }
+    __attribute__((target("avx512f"))) static __m512d avx512(__m512d left, __m512d right) { return _mm512_mul_pd(left, right); }
+#endif
+};
+
+struct Divide {
+    static double apply(double left, double right) { return left / right; }
+#ifdef BATCH_HAS_X86
+    __attribute__((target("sse2"))) static __m128d sse2(__m128d left, __m128d right) { return _mm_div_pd(left, right); }
+    __attribute__((target("avx2"))) static __m256d avx2(__m256d left, __m256d right) { return _mm256_div_pd(left, right); }
+    __attribute__((target("avx512f"))) static __m512d avx512(__m512d left, __m512d right) { return _mm512_div_pd(left, right); }
+#endif
+};
+
+// Each kernel replaces left[i] with left[i] op right[i] for i < n
+using binaryKernel = void (*)(double *left, const double *right, std::size_t n);
+
+template <typename Operation>
+void binaryScalar(double *left, const double *right, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        left[i] = Operation::apply(left[i], right[i]);
+    }
+}
+
+#ifdef BATCH_HAS_X86
+
+template <typename Operation>
+__attribute__((target("sse2")))
+void binarySse2(double *left, const double *right, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(left + i, Operation::sse2(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+    }
+    binaryScalar<Operation>(left + i, right + i, n - i);
+}
+
+template <typename Operation>
+__attribute__((target("avx2")))
+void binaryAvx2(double *left, const double *right, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(left + i, Operation::avx2(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+    }
+    binaryScalar<Operation>(left + i, right + i, n - i);
+}
+
+template <typename Operation>
+__attribute__((target("avx512f")))
+void binaryAvx512(double *left, const double *right, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm512_storeu_pd(left + i, Operation::avx512(_mm512_loadu_pd(left + i), _mm512_loadu_pd(right + i)));
+    }
+    binaryScalar<Operation>(left + i, right + i, n - i);
+}
+
+#endif
+
+// The builtins are run over a column with math, and with libm for the scalar implementation
+struct BatchKernels {
+    binaryKernel add;
+    binaryKernel subtract;
+    binaryKernel multiply;
+    binaryKernel divide;
+    const VectorMath &math;
+};
+
+const BatchKernels scalarKernels = {
+    binaryScalar<Add>, binaryScalar<Subtract>, binaryScalar<Multiply>, binaryScalar<Divide>, scalarVectorMath
+};
+
+#ifdef BATCH_HAS_X86
+const BatchKernels sse2Kernels = {
+    binarySse2<Add>, binarySse2<Subtract>, binarySse2<Multiply>, binarySse2<Divide>, sse2VectorMath
+};
+
+const BatchKernels avx2Kernels = {
+    binaryAvx2<Add>, binaryAvx2<Subtract>, binaryAvx2<Multiply>, binaryAvx2<Divide>, avx2VectorMath
+};
+
+const BatchKernels avx512Kernels = {
+    binaryAvx512<Add>, binaryAvx512<Subtract>, binaryAvx512<Multiply>, binaryAvx512<Divide>, avx512VectorMath
+};
+#endif
+
+bool isSupported(BatchImplementation implementation)
+{
+#ifdef BATCH_HAS_X86
+    // Needed because this also runs from a static initializer
+    __builtin_cpu_init();
+#endif
+    switch (implementation) {
+        case BatchImplementation::SCALAR:
+            return true;
+#ifdef BATCH_HAS_X86
+        case BatchImplementation::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case BatchImplementation::AVX2:
+            return __builtin_cpu_supports("avx2");
+        case BatchImplementation::AVX512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+const BatchKernels &kernelsFor(BatchImplementation implementation)
+{
+    switch (implementation) {
+#ifdef BATCH_HAS_X86
+        case BatchImplementation::SSE2:
+            return sse2Kernels;
+        case BatchImplementation::AVX2:
+            return avx2Kernels;
+        case BatchImplementation::AVX512:
+            return avx512Kernels;
+#endif
+        default:
+            return scalarKernels;
+    }
+}
+
+BatchImplementation currentImplementation = bestBatchImplementation();
+const BatchKernels *currentKernels = &kernelsFor(currentImplementation);
+
+// The parameters of the calls in progress, a column of values each, as the scope chain
+// of EvaluationContext holds one value each
+struct BatchFrame {
+    SymbolId name;
+    const double *values;
+    const BatchFrame *parent;
+};
+
+class BatchRunner
+{
+public:
+    BatchRunner(EvaluationContext &context, const BatchKernels &kernels)
+        : context_(context), kernels_(kernels), depth_(0) {}
+
+    void run(const UserFunction &function, const double *xs, double *out, std::size_t n) {
+        // Not kept with the callees: the function may be a derivative, named as the one it derives
+        Bytecode code = Bytecode::compile(function, context_.userFunctions());
+        for (std::size_t start = 0; start < n; start += CHUNK) {
+            std::size_t count = std::min(CHUNK, n - start);
+            BatchFrame frame {function.argumentName, xs + start, nullptr};
+            execute(code, &frame, count, out + start);
+        }
+    }
+
+private:
+    EvaluationContext &context_;
+    const BatchKernels &kernels_;
+    // The user functions called, compiled once per batch
+    std::unordered_map<SymbolId, Bytecode> compiled_;
+    // The operand stacks, one per level of nested calls, reused by all the chunks and calls
+    // at that level. A deque, so that a callee adding a level leaves those of its callers,
+    // which its frames point into, in place.
+    std::deque<std::vector<double>> stacks_;
+    std::size_t depth_;
+
+    const Bytecode &compiled(const UserFunction &function) {
+        auto found = compiled_.find(function.name);
+        if (found == compiled_.end()) {
+            found = compiled_.emplace(function.name, Bytecode::compile(function, context_.userFunctions())).first;
+        }
+        return found->second;
+    }
+
+    // Runs the code on the count points of the parameter, the column of the innermost frame
+    void execute(const Bytecode &code, const BatchFrame *frames, std::size_t count, double *out) {
+        // The operand stack, one column per slot, plus one for the right operand of
+        // superinstructions, then one per temporary
+        if (stacks_.size() == depth_) {
+            stacks_.emplace_back();
+        }
+        std::vector<double> &stack = stacks_[depth_];
+        std::size_t size = (code.maxDepth() + 1 + code.temporaries()) * CHUNK;
+        if (stack.size() < size) {
+            stack.resize(size);
+        }
+        ++depth_;
+        double *scratch = stack.data() + code.maxDepth() * CHUNK;
+        double *temporaries = scratch + CHUNK;
+        double *top = stack.data();
+        const double *parameter = frames->values;
+
+        for (const Instruction &instruction : code.instructions()) {
+            std::uint32_t operand = instruction.operand;
+            switch (instruction.opcode) {
+                case Opcode::CONSTANT:
+                    std::fill(top, top + count, code.constant(operand));
+                    top += CHUNK;
+                    break;
+                case Opcode::PARAMETER:
+                    std::copy(parameter, parameter + count, top);
+                    top += CHUNK;
+                    break;
+                case Opcode::VARIABLE:
+                    loadVariable(operand, frames, top, count);
+                    top += CHUNK;
+                    break;
+                case Opcode::ADD:
+                    top -= CHUNK;
+                    kernels_.add(top - CHUNK, top, count);
+                    break;
+                case Opcode::SUBTRACT:
+                    top -= CHUNK;
+                    kernels_.subtract(top - CHUNK, top, count);
+                    break;
+                case Opcode::MULTIPLY:
+                    top -= CHUNK;
+                    kernels_.multiply(top - CHUNK, top, count);
+                    break;
+                case Opcode::DIVIDE:
+                    top -= CHUNK;
+                    kernels_.divide(top - CHUNK, top, count);
+                    break;
+                case Opcode::CALL_BUILTIN:
+                    callBuiltin(code.builtin(operand), top - CHUNK, count);
+                    break;
+                case Opcode::CALL_USER:
+                    callUser(operand, frames, top - CHUNK, scratch, count);
+                    break;
+                case Opcode::CALL_UNKNOWN: {
+                    double *column = top - CHUNK;
+                    for (std::size_t i = 0; i < count; ++i) {
+                        column[i] = context_.callFunction(operand, column[i]);
+                    }
+                    break;
+                }
+                case Opcode::RETURN:
+                    std::copy(top - CHUNK, top - CHUNK + count, out);
+                    --depth_;
+                    return;
+                case Opcode::MULTIPLY_VARIABLE:
+                    loadVariable(operand, frames, scratch, count);
+                    kernels_.multiply(top - CHUNK, scratch, count);
+                    break;
+                case Opcode::MULTIPLY_PARAMETER:
+                    kernels_.multiply(top - CHUNK, parameter, count);
+                    break;
+                case Opcode::ADD_CONSTANT:
+                    std::fill(scratch, scratch + count, code.constant(operand));
+                    kernels_.add(top - CHUNK, scratch, count);
+                    break;
+                case Opcode::MULTIPLY_CALL_BUILTIN:
+                    top -= CHUNK;
+                    callBuiltin(code.builtin(operand), top, count);
+                    kernels_.multiply(top - CHUNK, top, count);
+                    break;
+                case Opcode::STORE:
+                    std::copy(top - CHUNK, top - CHUNK + count, temporaries + operand * CHUNK);
+                    break;
+                case Opcode::LOAD:
+                    std::copy(temporaries + operand * CHUNK, temporaries + operand * CHUNK + count, top);
+                    top += CHUNK;
+                    break;
+            }
+        }
+    }
+
+    // A parameter of a call in progress has a value per point; anything else, one for all
+    void loadVariable(SymbolId name, const BatchFrame *frames, double *column, std::size_t count) {
+        for (const BatchFrame *frame = frames; frame != nullptr; frame = frame->parent) {
+            if (frame->name == name) {
+                std::copy(frame->values, frame->values + count, column);
+                return;
+            }
+        }
+        std::fill(column, column + count, context_.getVariableValue(name));
+    }
+
+    void callBuiltin(builtinFunction function, double *column, std::size_t count) {
+        arrayFunction mapped = mathFor(function);
+        if (mapped != nullptr) {
+            mapped(column, count);
+            return;
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            column[i] = function(column[i]);
+        }
+    }
+
+    // The function of the math kernels for a builtin, if any
+    arrayFunction mathFor(builtinFunction function) const {
+        static const builtinFunction builtins[] = {
+            findBuiltinFunction(intern("exp")), findBuiltinFunction(intern("log")), findBuiltinFunction(intern("sin")),
+            findBuiltinFunction(intern("cos")), findBuiltinFunction(intern("tan"))
+        };
+        const VectorMath &math = kernels_.math;
+        const arrayFunction mapped[] = {math.exp, math.log, math.sin, math.cos, math.tan};
+        for (std::size_t i = 0; i < 5; ++i) {
+            if (builtins[i] == function) {
+                return mapped[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // The callee reads its argument column while it runs, so its values go to result first
+    void callUser(SymbolId name, const BatchFrame *frames, double *column, double *result, std::size_t count) {
+        // Functions are never undefined, so one known when compiling still is
+        const UserFunction &function = **context_.userFunctions().find(name);
+        BatchFrame frame {function.argumentName, column, frames};
+        execute(compiled(function), &frame, count, result);
+        std::copy(result, result + count, column);
+    }
+};
+
+}
+
+void evalBatch(const UserFunction &function, EvaluationContext &context, const double *xs, double *out, std::size_t n)
+{
+    BatchRunner runner(context, *currentKernels);
+    runner.run(function, xs, out, n);
+}
+
+void evalDerivativeBatch(const UserFunction &function, EvaluationContext &context, const double *xs, double *out, std::size_t n)
+{
+    // Compiling copies what it needs, so the derivative nodes are not kept
+    NodeArena arena;
+    UserFunction derivative {function.name, function.argumentName, function.derivative(arena)};
+    evalBatch(derivative, context, xs, out, n);
+}
+
+BatchImplementation bestBatchImplementation()
+{
+    if (isSupported(BatchImplementation::AVX512)) {
+        return BatchImplementation::AVX512;
+    } else if (isSupported(BatchImplementation::AVX2)) {
+        return BatchImplementation::AVX2;
+    } else if (isSupported(BatchImplementation::SSE2)) {
+        return BatchImplementation::SSE2;
+    }
+    return BatchImplementation::SCALAR;
+}
+
+BatchImplementation currentBatchImplementation()
+{
+    return currentImplementation;
+}
+
+bool setBatchImplementation(BatchImplementation implementation)
+{
+    if (!isSupported(implementation)) {
+        return false;
+    }
+    currentImplementation = implementation;
+    currentKernels = &kernelsFor(implementation);
+    return true;
+}
+
+std::string batchImplementationName(BatchImplementation implementation)
+{
+    switch (implementation) {
+        case BatchImplementation::SSE2:
+            return "sse2";
+        case BatchImplementation::AVX2:
+            return "avx2";
+        case BatchImplementation::AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstddef>
+#include <string>
+
+#include "evaluation.h"
+
+// Evaluation of a user function over whole arrays of points. The body is compiled once,
+// then run one instruction at a time over chunks of points, so that each instruction is
+// dispatched once per chunk rather than once per point. Arithmetic runs over SIMD lanes
+// with SSE2, AVX2 or AVX-512, chosen once at startup from what the CPU supports, with a
+// scalar loop for the points left over, and builtins with the kernels of vectorMath.h.
+// The errors are those of evaluating the function at each point in turn, and so are the
+// values, but for the few ULPs by which the builtins may differ from libm's. The scalar
+// implementation uses libm, and gives exactly the values of the tree walker.
+
+enum class BatchImplementation {
+    SCALAR,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+// Evaluates the function at each of the n points xs, into out
+void evalBatch(const UserFunction &function, EvaluationContext &context, const double *xs, double *out, std::size_t n);
+
+// Evaluates the derivative of the function at each of the n points xs, into out
+void evalDerivativeBatch(const UserFunction &function, EvaluationContext &context, const double *xs, double *out, std::size_t n);
+
+// The best implementation the CPU supports, and the one currently in use
+BatchImplementation bestBatchImplementation();
+BatchImplementation currentBatchImplementation();
+
+// Forces an implementation, e.g. to compare them in benchmarks and tests.
+// Returns false, changing nothing, if the CPU does not support it.
+bool setBatchImplementation(BatchImplementation implementation);
+
+std::string batchImplementationName(BatchImplementation implementation);
+
+#endif
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include "bytecode.h"
+#include "node.h"
+
+// The number of times each node with children is used in the tree: once per parent
+// reaching it in the DAG, each reached once
+static std::unordered_map<const Node *, std::size_t> countUses(const Node *root)
+{
+    std::unordered_map<const Node *, std::size_t> uses;
+    std::vector<const Node *> pending {root};
+    while (!pending.empty()) {
+        const Node *node = pending.back();
+        pending.pop_back();
+        for (std::size_t i = 0; i < node->childCount(); ++i) {
+            const Node *child = node->child(i);
+            if (child->childCount() > 0 && ++uses[child] == 1) {
+                pending.push_back(child);
+            }
+        }
+    }
+    return uses;
+}
+
+static void compileTree(const Node *root, BytecodeCompiler &compiler)
+{
+    // Post-order walk: a node is compiled once all its children are. A node used more
+    // than once is stored to a temporary the first time, and loaded from it after:
+    // the walk reaches its first use, and compiles it all, before any other.
+    struct Frame {
+        const Node *node;
+        std::size_t nextChild;
+    };
+
+    std::unordered_map<const Node *, std::size_t> uses = countUses(root);
+    std::unordered_map<const Node *, std::uint32_t> temporaries;
+    std::vector<Frame> frames {{root, 0}};
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+        if (frame.nextChild < frame.node->childCount()) {
+            const Node *child = frame.node->child(frame.nextChild);
+            ++frame.nextChild;
+            auto stored = temporaries.find(child);
+            if (stored != temporaries.end()) {
+                compiler.addLoad(stored->second);
+            } else {
+                frames.push_back(Frame {child, 0});
+            }
+            continue;
+        }
+
+        const Node *node = frame.node;
+        frames.pop_back();
+        node->compileWith(compiler);
+        auto used = uses.find(node);
+        if (used != uses.end() && used->second > 1) {
+            temporaries.emplace(node, compiler.addStore());
+        }
+    }
+}
+
+Bytecode Bytecode::compile(const Node *root, const userFunctionsMap &functions)
+{
+    Bytecode code;
+    BytecodeCompiler compiler(code, functions, nullptr);
+    compileTree(root, compiler);
+    compiler.addReturn();
+    return code;
+}
+
+Bytecode Bytecode::compile(const UserFunction &function, const userFunctionsMap &functions)
+{
+    Bytecode code;
+    BytecodeCompiler compiler(code, functions, &function.argumentName);
+    compileTree(function.bodyNode, compiler);
+    compiler.addReturn();
+    return code;
+}
+
+void BytecodeCompiler::add(Opcode opcode, std::uint32_t operand, int depthChange)
+{
+    code_.instructions_.push_back(Instruction {opcode, operand});
+    depth_ += depthChange;
+    code_.maxDepth_ = std::max(code_.maxDepth_, depth_);
+    code_.functionsDefined_ = functions_.size();
+}
+
+void BytecodeCompiler::addNumber(double number)
+{
+    add(Opcode::CONSTANT, static_cast<std::uint32_t>(code_.constants_.size()), 1);
+    code_.constants_.push_back(number);
+}
+
+void BytecodeCompiler::addVariable(SymbolId variable)
+{
+    if (parameter_ != nullptr && variable == *parameter_) {
+        add(Opcode::PARAMETER, 0, 1);
+    } else {
+        add(Opcode::VARIABLE, variable, 1);
+    }
+}
+
+void BytecodeCompiler::addCall(SymbolId function)
+{
+    // Same order as EvaluationContext::callFunction: user functions hide builtins
+    if (functions_.find(function) != nullptr) {
+        add(Opcode::CALL_USER, function, 0);
+        return;
+    }
+
+    builtinFunction builtin = findBuiltinFunction(function);
+    if (builtin != nullptr) {
+        add(Opcode::CALL_BUILTIN, static_cast<std::uint32_t>(code_.builtins_.size()), 0);
+        code_.builtins_.push_back(builtin);
+    } else {
+        add(Opcode::CALL_UNKNOWN, function, 0);
+    }
+}
+
+void BytecodeCompiler::addBinary(FlatOpcode opcode)
+{
+    // The last instruction is the whole right operand when it is a leaf or a builtin
+    // call; it then becomes the operand of a superinstruction
+    Instruction *last = code_.instructions_.empty() ? nullptr : &code_.instructions_.back();
+    if (last != nullptr && opcode == FlatOpcode::MULTIPLY) {
+        Opcode fused = last->opcode == Opcode::VARIABLE ? Opcode::MULTIPLY_VARIABLE
+                     : last->opcode == Opcode::PARAMETER ? Opcode::MULTIPLY_PARAMETER
+                     : last->opcode == Opcode::CALL_BUILTIN ? Opcode::MULTIPLY_CALL_BUILTIN
+                     : Opcode::MULTIPLY;
+        if (fused != Opcode::MULTIPLY) {
+            last->opcode = fused;
+            --depth_;
+            return;
+        }
+    }
+    if (last != nullptr && opcode == FlatOpcode::ADD && last->opcode == Opcode::CONSTANT) {
+        last->opcode = Opcode::ADD_CONSTANT;
+        --depth_;
+        return;
+    }
+
+    static const Opcode opcodes[] = {Opcode::ADD, Opcode::SUBTRACT, Opcode::MULTIPLY, Opcode::DIVIDE};
+    add(opcodes[static_cast<int>(opcode) - static_cast<int>(FlatOpcode::ADD)], 0, -1);
+}
+
+std::uint32_t BytecodeCompiler::addStore()
+{
+    std::uint32_t temporary = static_cast<std::uint32_t>(code_.temporaries_++);
+    add(Opcode::STORE, temporary, 0);
+    return temporary;
+}
+
+void BytecodeCompiler::addLoad(std::uint32_t temporary)
+{
+    add(Opcode::LOAD, temporary, 1);
+}
+
+void BytecodeCompiler::addReturn()
+{
+    add(Opcode::RETURN, 0, 0);
+}
@@ -0,0 +1,108 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "evaluation.h"
+#include "flatExpression.h"
+
+enum class Opcode : std::uint8_t
+{
+    CONSTANT,       // push constants[operand]
+    PARAMETER,      // push the parameter of the function being run
+    VARIABLE,       // push the variable whose symbol is operand
+    ADD,            // pop the right operand, then replace the left one with the result
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    CALL_BUILTIN,   // replace the top with builtins[operand] of it
+    CALL_USER,      // replace the top with the user function whose symbol is operand, of it
+    CALL_UNKNOWN,   // a call to a function not defined when compiling: fails when run
+    RETURN,         // the value is the top, the last instruction of any code
+
+    // Superinstructions, for the pairs most frequent in derivatives: an operation
+    // whose right operand is the instruction just before it
+    MULTIPLY_VARIABLE,      // VARIABLE then MULTIPLY
+    MULTIPLY_PARAMETER,     // PARAMETER then MULTIPLY
+    ADD_CONSTANT,           // CONSTANT then ADD
+    MULTIPLY_CALL_BUILTIN,  // CALL_BUILTIN then MULTIPLY
+
+    // Temporaries, for the value of a subtree used more than once
+    STORE,          // copy the top to temporaries[operand]
+    LOAD            // push temporaries[operand]
+};
+
+struct Instruction {
+    Opcode opcode;
+    std::uint32_t operand;
+};
+
+class BytecodeCompiler;
+
+// An expression compiled for the stack machine of VirtualMachine. Names are resolved
+// when compiling: the parameter of a function body to its own instruction, and each
+// call to a builtin or a user function, against the functions defined at that time.
+// Frequent pairs of instructions are fused into one as they are added. A subtree used
+// more than once, a node shared in the tree (see NodeArena), is computed once into
+// a temporary, so that the code grows with the nodes of the DAG rather than of the tree.
+class Bytecode
+{
+public:
+    static Bytecode compile(const Node *root, const userFunctionsMap &functions);
+    static Bytecode compile(const UserFunction &function, const userFunctionsMap &functions);
+
+    inline const std::vector<Instruction> &instructions() const { return instructions_; }
+    inline double constant(std::uint32_t index) const { return constants_[index]; }
+    inline builtinFunction builtin(std::uint32_t index) const { return builtins_[index]; }
+
+    // The most values on the stack at once while running
+    inline std::size_t maxDepth() const { return maxDepth_; }
+
+    // The number of temporaries, each holding one value while running
+    inline std::size_t temporaries() const { return temporaries_; }
+
+    // The number of user functions defined when compiling: defining more may change
+    // the meaning of a call, while redefining one does not
+    inline std::size_t functionsDefined() const { return functionsDefined_; }
+
+private:
+    friend class BytecodeCompiler;
+
+    std::vector<Instruction> instructions_;
+    std::vector<double> constants_;
+    std::vector<builtinFunction> builtins_;
+    std::size_t maxDepth_ = 0;
+    std::size_t temporaries_ = 0;
+    std::size_t functionsDefined_ = 0;
+};
+
+// Appends the instructions of the nodes, each after those of its children (see Node::compileWith)
+class BytecodeCompiler
+{
+public:
+    BytecodeCompiler(Bytecode &code, const userFunctionsMap &functions, const SymbolId *parameter)
+        : code_(code), functions_(functions), parameter_(parameter), depth_(0) {}
+
+    void addNumber(double number);
+    void addVariable(SymbolId variable);
+    void addCall(SymbolId function);
+    void addBinary(FlatOpcode opcode);
+
+    // Copies the value on top to a new temporary, and returns it
+    std::uint32_t addStore();
+    void addLoad(std::uint32_t temporary);
+
+    // Ends the code
+    void addReturn();
+
+private:
+    Bytecode &code_;
+    const userFunctionsMap &functions_;
+    const SymbolId *parameter_;
+    std::size_t depth_;
+
+    void add(Opcode opcode, std::uint32_t operand, int depthChange);
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef CHAR_CLASS_H
+#define CHAR_CLASS_H
+
+#include <cstdint>
+
+// Character classes used by the lexer. They are looked up in a 256-entry table computed
+// at compile time, so lexing never goes through the C locale as <cctype> does.
+enum CharClass : std::uint8_t
+{
+    CHAR_SPACE = 1,
+    CHAR_EOL = 2,
+    CHAR_DIGIT = 4,
+    CHAR_LETTER = 8,
+    CHAR_IDENTIFIER_PART = CHAR_DIGIT | CHAR_LETTER
+};
+
+constexpr std::uint8_t classifyChar(unsigned c)
+{
+    return (c == ' ' || c == '\t' || c == '\v' || c == '\f') ? CHAR_SPACE
+        : (c == '\n' || c == '\r') ? CHAR_EOL
+        : (c >= '0' && c <= '9') ? CHAR_DIGIT
+        : ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) ? CHAR_LETTER
+        : 0;
+}
+
+#define CHAR_CLASS_4(c) classifyChar(c), classifyChar(c + 1), classifyChar(c + 2), classifyChar(c + 3)
+#define CHAR_CLASS_16(c) CHAR_CLASS_4(c), CHAR_CLASS_4(c + 4), CHAR_CLASS_4(c + 8), CHAR_CLASS_4(c + 12)
+#define CHAR_CLASS_64(c) CHAR_CLASS_16(c), CHAR_CLASS_16(c + 16), CHAR_CLASS_16(c + 32), CHAR_CLASS_16(c + 48)
+
+constexpr std::uint8_t charClasses[256] = {
+    CHAR_CLASS_64(0), CHAR_CLASS_64(64), CHAR_CLASS_64(128), CHAR_CLASS_64(192)
+};
+
+#undef CHAR_CLASS_64
+#undef CHAR_CLASS_16
+#undef CHAR_CLASS_4
+
+inline bool hasCharClass(char candidate, std::uint8_t charClass)
+{
+    return (charClasses[static_cast<unsigned char>(candidate)] & charClass) != 0;
+}
+
+inline bool isSpace(char candidate) { return hasCharClass(candidate, CHAR_SPACE); }
+inline bool isEol(char candidate) { return hasCharClass(candidate, CHAR_EOL); }
+inline bool isDigit(char candidate) { return hasCharClass(candidate, CHAR_DIGIT); }
+inline bool isIdentifierStart(char candidate) { return hasCharClass(candidate, CHAR_LETTER); }
+inline bool isIdentifierPart(char candidate) { return hasCharClass(candidate, CHAR_IDENTIFIER_PART); }
+
+#endif
@@ -0,0 +1,58 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "chunkedInput.h"
+#include "exceptions.h"
+
+ChunkedInput::ChunkedInput(int fd, std::size_t chunkSize)
+    : fd_(fd), chunkSize_(chunkSize), buffer_(chunkSize), filled_(0), linesEnd_(0), eof_(false)
+{
+}
+
+bool ChunkedInput::next()
+{
+    // Release the lines already handed out, keeping the partial line after them
+    std::size_t pending = filled_ - linesEnd_;
+    std::memmove(buffer_.data(), buffer_.data() + linesEnd_, pending);
+    filled_ = pending;
+    linesEnd_ = 0;
+
+    // The buffer only grows past a chunk for a longer line: give the memory back after it
+    if (buffer_.size() > chunkSize_ && pending < chunkSize_) {
+        buffer_.resize(chunkSize_);
+        buffer_.shrink_to_fit();
+    }
+
+    while (!eof_) {
+        if (filled_ == buffer_.size()) {
+            buffer_.resize(buffer_.size() * 2);
+        }
+
+        ssize_t bytesRead = read(fd_, buffer_.data() + filled_, buffer_.size() - filled_);
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw FileException(std::string("Cannot read input: ") + std::strerror(errno));
+        }
+        if (bytesRead == 0) {
+            eof_ = true;
+            break;
+        }
+
+        // Hand out everything up to the last newline that has been read
+        std::size_t readBegin = filled_;
+        filled_ += static_cast<std::size_t>(bytesRead);
+        for (std::size_t i = filled_; i > readBegin; --i) {
+            if (buffer_[i - 1] == '\n') {
+                linesEnd_ = i;
+                return true;
+            }
+        }
+    }
+
+    // At the end of the input the last line does not need a newline
+    linesEnd_ = filled_;
+    return filled_ > 0;
+}
@@ -0,0 +1,36 @@
+#ifndef CHUNKED_INPUT_H
+#define CHUNKED_INPUT_H
+
+#include <vector>
+
+// Reads a file descriptor in large blocks and hands them out as runs of complete lines.
+// A line that straddles two blocks is carried over to the next run, and the lines
+// already handed out are released, so memory stays bounded by the block size (or by
+// the longest line) however long the input is.
+class ChunkedInput
+{
+public:
+    static const std::size_t DEFAULT_CHUNK_SIZE = 1 << 16;
+
+    explicit ChunkedInput(int fd, std::size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+    // Releases the current run of lines and reads the next one.
+    // Returns false at the end of the input.
+    bool next();
+
+    inline const char *begin() const { return buffer_.data(); }
+    inline const char *end() const { return buffer_.data() + linesEnd_; }
+    inline bool atEof() const { return eof_; }
+    inline std::size_t capacity() const { return buffer_.size(); }
+
+private:
+    int fd_;
+    std::size_t chunkSize_;
+    std::vector<char> buffer_;
+    // Bytes in the buffer, and how many of them form complete lines
+    std::size_t filled_;
+    std::size_t linesEnd_;
+    bool eof_;
+};
+
+#endif
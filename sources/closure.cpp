@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "closure.h"
+#include "virtualMachine.h"
+
+namespace {
+
+// The shapes of an operand, each read its own way
+enum Shape {
+    CONSTANT,
+    PARAMETER,
+    SUBTREE
+};
+
+struct Constant {
+    static double left(const Closure &closure, ClosureFrame &frame) { return closure.leftConstant; }
+    static double right(const Closure &closure, ClosureFrame &frame) { return closure.rightConstant; }
+};
+
+struct Parameter {
+    static double left(const Closure &closure, ClosureFrame &frame) { return frame.parameter; }
+    static double right(const Closure &closure, ClosureFrame &frame) { return frame.parameter; }
+};
+
+struct Subtree {
+    static double left(const Closure &closure, ClosureFrame &frame) { return closure.left->run(*closure.left, frame); }
+    static double right(const Closure &closure, ClosureFrame &frame) { return closure.right->run(*closure.right, frame); }
+};
+
+struct Add { static double apply(double left, double right) { return left + right; } };
+struct Subtract { static double apply(double left, double right) { return left - right; } };
+struct Multiply { static double apply(double left, double right) { return left * right; } };
+struct Divide { static double apply(double left, double right) { return left / right; } };
+
+template <typename Operation, typename Left, typename Right>
+double runBinary(const Closure &closure, ClosureFrame &frame)
+{
+    // Left first, as in the tree walker, so that the same error is kept
+    double left = Left::left(closure, frame);
+    return Operation::apply(left, Right::right(closure, frame));
+}
+
+template <typename Operation>
+Closure::Run binaryRun(Shape left, Shape right)
+{
+    static const Closure::Run runs[3][3] = {
+        {runBinary<Operation, Constant, Constant>, runBinary<Operation, Constant, Parameter>, runBinary<Operation, Constant, Subtree>},
+        {runBinary<Operation, Parameter, Constant>, runBinary<Operation, Parameter, Parameter>, runBinary<Operation, Parameter, Subtree>},
+        {runBinary<Operation, Subtree, Constant>, runBinary<Operation, Subtree, Parameter>, runBinary<Operation, Subtree, Subtree>}
+    };
+    return runs[left][right];
+}
+
+// Calls have their argument on the left
+template <typename Argument>
+double runBuiltin(const Closure &closure, ClosureFrame &frame)
+{
+    return closure.builtin(Argument::left(closure, frame));
+}
+
+template <typename Argument>
+double runUser(const Closure &closure, ClosureFrame &frame)
+{
+    return frame.machine->callUserFunction(closure.name, Argument::left(closure, frame), *frame.context);
+}
+
+template <typename Argument>
+double runUnknown(const Closure &closure, ClosureFrame &frame)
+{
+    return frame.context->callFunction(closure.name, Argument::left(closure, frame));
+}
+
+double runConstant(const Closure &closure, ClosureFrame &frame)
+{
+    return closure.leftConstant;
+}
+
+double runParameter(const Closure &closure, ClosureFrame &frame)
+{
+    return frame.parameter;
+}
+
+double runVariable(const Closure &closure, ClosureFrame &frame)
+{
+    return frame.context->getVariableValue(closure.name);
+}
+
+double runStore(const Closure &closure, ClosureFrame &frame)
+{
+    double value = closure.left->run(*closure.left, frame);
+    frame.temporaries[closure.name] = value;
+    return value;
+}
+
+double runLoad(const Closure &closure, ClosureFrame &frame)
+{
+    return frame.temporaries[closure.name];
+}
+
+// height is that of the closure tree: running it recurses as deep
+struct Operand {
+    Shape shape;
+    double constant;
+    const Closure *closure;
+    std::size_t height;
+};
+
+class ClosureCompiler
+{
+public:
+    explicit ClosureCompiler(std::deque<Closure> &closures) : closures_(closures) {}
+
+    const Closure *compile(const Bytecode &code) {
+        for (const Instruction &instruction : code.instructions()) {
+            std::uint32_t operand = instruction.operand;
+            switch (instruction.opcode) {
+                case Opcode::CONSTANT:
+                    operands_.push_back(Operand {CONSTANT, code.constant(operand), nullptr, 0});
+                    break;
+                case Opcode::PARAMETER:
+                    operands_.push_back(Operand {PARAMETER, 0, nullptr, 0});
+                    break;
+                case Opcode::VARIABLE:
+                    operands_.push_back(variable(operand));
+                    break;
+                case Opcode::ADD:
+                    binary(binaryRun<Add>, pop());
+                    break;
+                case Opcode::SUBTRACT:
+                    binary(binaryRun<Subtract>, pop());
+                    break;
+                case Opcode::MULTIPLY:
+                    binary(binaryRun<Multiply>, pop());
+                    break;
+                case Opcode::DIVIDE:
+                    binary(binaryRun<Divide>, pop());
+                    break;
+                case Opcode::CALL_BUILTIN:
+                    operands_.push_back(call(runBuiltin<Constant>, runBuiltin<Parameter>, runBuiltin<Subtree>, 0, code.builtin(operand)));
+                    break;
+                case Opcode::CALL_USER:
+                    operands_.push_back(call(runUser<Constant>, runUser<Parameter>, runUser<Subtree>, operand, nullptr));
+                    break;
+                case Opcode::CALL_UNKNOWN:
+                    operands_.push_back(call(runUnknown<Constant>, runUnknown<Parameter>, runUnknown<Subtree>, operand, nullptr));
+                    break;
+                case Opcode::RETURN: {
+                    Operand result = pop();
+                    return result.height <= ClosureFunction::MAX_HEIGHT ? asClosure(result) : nullptr;
+                }
+                case Opcode::MULTIPLY_VARIABLE:
+                    binary(binaryRun<Multiply>, variable(operand));
+                    break;
+                case Opcode::MULTIPLY_PARAMETER:
+                    binary(binaryRun<Multiply>, Operand {PARAMETER, 0, nullptr, 0});
+                    break;
+                case Opcode::ADD_CONSTANT:
+                    binary(binaryRun<Add>, Operand {CONSTANT, code.constant(operand), nullptr, 0});
+                    break;
+                case Opcode::MULTIPLY_CALL_BUILTIN: {
+                    Operand right = call(runBuiltin<Constant>, runBuiltin<Parameter>, runBuiltin<Subtree>, 0, code.builtin(operand));
+                    binary(binaryRun<Multiply>, right);
+                    break;
+                }
+                case Opcode::STORE: {
+                    // Closures run in the order of the instructions, so each load comes after its store
+                    Operand value = pop();
+                    Closure &closure = add(runStore);
+                    closure.left = asClosure(value);
+                    closure.name = operand;
+                    operands_.push_back(subtree(closure, 1 + std::max<std::size_t>(value.height, 1)));
+                    break;
+                }
+                case Opcode::LOAD: {
+                    Closure &closure = add(runLoad);
+                    closure.name = operand;
+                    operands_.push_back(subtree(closure, 1));
+                    break;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    std::deque<Closure> &closures_;
+    std::vector<Operand> operands_;
+
+    Operand pop() {
+        Operand operand = operands_.back();
+        operands_.pop_back();
+        return operand;
+    }
+
+    Closure &add(Closure::Run run) {
+        closures_.push_back(Closure {run, nullptr, nullptr, 0, 0, 0, nullptr});
+        return closures_.back();
+    }
+
+    static Operand subtree(const Closure &closure, std::size_t height) {
+        return Operand {SUBTREE, 0, &closure, height};
+    }
+
+    const Closure *asClosure(const Operand &operand) {
+        if (operand.shape == SUBTREE) {
+            return operand.closure;
+        }
+        if (operand.shape == PARAMETER) {
+            return &add(runParameter);
+        }
+        Closure &closure = add(runConstant);
+        closure.leftConstant = operand.constant;
+        return &closure;
+    }
+
+    Operand variable(std::uint32_t name) {
+        Closure &closure = add(runVariable);
+        closure.name = name;
+        return subtree(closure, 1);
+    }
+
+    // Replaces the top operand, the left one, with the operation on it and right
+    void binary(Closure::Run (*runFor)(Shape, Shape), const Operand &right) {
+        Operand left = pop();
+        Closure &closure = add(runFor(left.shape, right.shape));
+        closure.left = left.closure;
+        closure.leftConstant = left.constant;
+        closure.right = right.closure;
+        closure.rightConstant = right.constant;
+        operands_.push_back(subtree(closure, 1 + std::max(left.height, right.height)));
+    }
+
+    // Pops the argument and returns the call on it
+    Operand call(Closure::Run onConstant, Closure::Run onParameter, Closure::Run onSubtree,
+                 std::uint32_t name, builtinFunction builtin) {
+        Operand argument = pop();
+        Closure::Run runs[] = {onConstant, onParameter, onSubtree};
+        Closure &closure = add(runs[argument.shape]);
+        closure.left = argument.closure;
+        closure.leftConstant = argument.constant;
+        closure.name = name;
+        closure.builtin = builtin;
+        return subtree(closure, 1 + argument.height);
+    }
+};
+
+}
+
+ClosureFunction ClosureFunction::compile(const Bytecode &code)
+{
+    ClosureFunction function;
+    ClosureCompiler compiler(function.closures_);
+    function.root_ = compiler.compile(code);
+    function.temporaries_ = code.temporaries();
+    return function;
+}
+
+double ClosureFunction::runWithManyTemporaries(double parameter, VirtualMachine &machine, EvaluationContext &context) const
+{
+    std::unique_ptr<double[]> temporaries(new double[temporaries_]);
+    ClosureFrame frame {parameter, temporaries.get(), &machine, &context};
+    return root_->run(*root_, frame);
+}
@@ -0,0 +1,77 @@
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include <cstdint>
+#include <deque>
+
+#include "bytecode.h"
+#include "evaluation.h"
+
+class VirtualMachine;
+
+// What a closure runs with: the parameter, the temporaries, and where names are looked up
+struct ClosureFrame {
+    double parameter;
+    double *temporaries;
+    VirtualMachine *machine;
+    EvaluationContext *context;
+};
+
+// One node of a closure tree. Its function is chosen when compiling, from its operation
+// and the shape of each operand: a constant and the parameter are read from the closure
+// and the frame, only a subtree is a call. name is also the index of a temporary.
+struct Closure {
+    using Run = double (*)(const Closure &closure, ClosureFrame &frame);
+
+    Run run;
+    const Closure *left;
+    const Closure *right;
+    double leftConstant;
+    double rightConstant;
+    std::uint32_t name;
+    builtinFunction builtin;
+};
+
+// A function body compiled to a tree of closures: a middle tier between the bytecode
+// machine and native code, cheap to build and with no dispatch on opcodes when run.
+// It is compiled from the bytecode, whose names are already resolved.
+class ClosureFunction
+{
+public:
+    // Closures run their subtrees recursively, so deeper trees are not compiled
+    static const std::size_t MAX_HEIGHT = 1000;
+
+    // Temporaries are on the stack of the caller up to this many
+    static const std::size_t LOCAL_TEMPORARIES = 32;
+
+    // Returns an invalid function if the tree would be too deep
+    static ClosureFunction compile(const Bytecode &code);
+
+    ClosureFunction() : root_(nullptr), temporaries_(0) {}
+    ClosureFunction(ClosureFunction &&other) = default;
+    ClosureFunction &operator =(ClosureFunction &&other) = default;
+
+    inline bool valid() const { return root_ != nullptr; }
+    inline std::size_t size() const { return closures_.size(); }
+
+    // Runs the function; the parameter must already be bound in the context, for the
+    // functions it calls (see EvaluationContext::withParameter)
+    inline double operator ()(double parameter, VirtualMachine &machine, EvaluationContext &context) const {
+        if (temporaries_ > LOCAL_TEMPORARIES) {
+            return runWithManyTemporaries(parameter, machine, context);
+        }
+        double temporaries[LOCAL_TEMPORARIES];
+        ClosureFrame frame {parameter, temporaries, &machine, &context};
+        return root_->run(*root_, frame);
+    }
+
+private:
+    // A deque, so that closures do not move as more are added
+    std::deque<Closure> closures_;
+    const Closure *root_;
+    std::size_t temporaries_;
+
+    double runWithManyTemporaries(double parameter, VirtualMachine &machine, EvaluationContext &context) const;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include <cstdio>
+
+#include "errorReport.h"
+
+const char *errorCodeName(ErrorCode code)
+{
+    switch (code) {
+        case ErrorCode::OK: return "OK";
+        case ErrorCode::INVALID_INPUT: return "INVALID_INPUT";
+        case ErrorCode::UNKNOWN_FUNCTION: return "UNKNOWN_FUNCTION";
+        case ErrorCode::UNKNOWN_VARIABLE: return "UNKNOWN_VARIABLE";
+    }
+    return "UNKNOWN";
+}
+
+// Messages quote the source, so they may hold any byte: escape quotes,
+// backslashes and control characters
+static void writeJsonString(std::ostream &ostream, const std::string &text)
+{
+    ostream << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            ostream << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+            ostream << escaped;
+        } else {
+            ostream << c;
+        }
+    }
+    ostream << '"';
+}
+
+void writeErrorReport(std::ostream &ostream, const std::vector<StatementError> &errors)
+{
+    for (const StatementError &error : errors) {
+        ostream << "{\"line\":" << error.line
+                << ",\"column\":" << error.column
+                << ",\"offset\":" << error.status.offset()
+                << ",\"code\":\"" << errorCodeName(error.status.code()) << "\""
+                << ",\"message\":";
+        writeJsonString(ostream, error.status.message());
+        ostream << "}\n";
+    }
+    ostream.flush();
+}
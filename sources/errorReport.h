@@ -0,0 +1,24 @@
+#ifndef ERROR_REPORT_H
+#define ERROR_REPORT_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "status.h"
+
+// An error found while running a program in batch mode, with the place of the
+// statement it was found in. Lines and columns count from 1; columns are in bytes.
+struct StatementError {
+    Status status;
+    std::size_t line;
+    std::size_t column;
+};
+
+const char *errorCodeName(ErrorCode code);
+
+// Writes one JSON object per error and per line, e.g.
+// {"line":3,"column":5,"offset":27,"code":"INVALID_INPUT","message":"Invalid operator type: %"}
+void writeErrorReport(std::ostream &ostream, const std::vector<StatementError> &errors);
+
+#endif
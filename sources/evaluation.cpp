@@ -2,49 +2,72 @@
 #include "node.h"
 
 static builtinFunctionMap builtinFunctions {
-        {"exp", std::exp},
-        {"log", std::log},
-        {"sin", std::sin},
-        {"cos", std::cos},
-        {"tan", std::tan}
+        {intern("exp"), std::exp},
+        {intern("log"), std::log},
+        {intern("sin"), std::sin},
+        {intern("cos"), std::cos},
+        {intern("tan"), std::tan}
 };
 
-double EvaluationContext::getVariableValue(std::string variableName) const {
-    auto it = variables_.find(variableName);
-    if (it == variables_.end()) {
-        throw UnknownVariableName(variableName);
+builtinFunction findBuiltinFunction(SymbolId name)
+{
+    const builtinFunction *builtin = builtinFunctions.find(name);
+    return builtin != nullptr ? *builtin : nullptr;
+}
+
+double EvaluationContext::getVariableValue(SymbolId variableName) {
+    // Parameters of the calls in progress first, innermost first, then the globals
+    for (const ScopeFrame *frame = frame_; frame != nullptr; frame = frame->parent) {
+        if (frame->name == variableName) {
+            return frame->value;
+        }
+    }
+
+    const double *value = variables_.find(variableName);
+    if (value == nullptr) {
+        return fail(ErrorCode::UNKNOWN_VARIABLE, variableName);
     }
-    return it->second;
+    return *value;
 }
 
-double EvaluationContext::callFunction(std::string functionName, double argumentValue) const
+double EvaluationContext::callFunction(SymbolId functionName, double argumentValue)
 {
     // Is it an user defined function? If so, call it.
-    auto it = userFunctions_.find(functionName);
-    if (it != userFunctions_.end()) {
-        return callUserDefinedFunction(it->second, argumentValue);
+    const UserFunctionPtr *userFunction = userFunctions_.find(functionName);
+    if (userFunction != nullptr) {
+        return callUserDefinedFunction(**userFunction, argumentValue);
     }
 
     // Is it a builtin function? If so, call it.
-    auto bit = builtinFunctions.find(functionName);
-    if (bit != builtinFunctions.end()) {
-        return bit->second(argumentValue);
+    const builtinFunction *builtin = builtinFunctions.find(functionName);
+    if (builtin != nullptr) {
+        return (*builtin)(argumentValue);
     }
 
-    throw UnknownFunctionName(functionName);
+    return fail(ErrorCode::UNKNOWN_FUNCTION, functionName);
 }
 
-double EvaluationContext::callUserDefinedFunction(UserFunctionPtr userFunction, double argumentValue) const
+double EvaluationContext::callUserDefinedFunction(const UserFunction &userFunction, double argumentValue)
 {
-    // Create an inner evaluation context where the variable "argumentName" is set to "argumentValue"
-    // and evaluate the function's expression node
-    variablesMap innerScopeVariables = variables_;
-    innerScopeVariables[userFunction->argumentName] = argumentValue;
-    EvaluationContext innerScope(userFunctions_, innerScopeVariables);
-    return userFunction->bodyNode->eval(innerScope);
+    // Bind "argumentName" to "argumentValue" and evaluate the function's expression node
+    // in this same context: errors in the body are errors of the call
+    return withParameter(userFunction.argumentName, argumentValue, [&]() {
+        return userFunction.bodyNode->eval(*this);
+    });
+}
+
+double EvaluationContext::fail(ErrorCode code, SymbolId name)
+{
+    // Only the first error is kept: the following ones are usually caused by it
+    if (status_.ok()) {
+        status_ = Status(code, symbolName(name));
+    }
+    return std::nan("");
 }
 
-NodePtr UserFunction::derivative() const
+NodePtr UserFunction::derivative(NodeArena &arena) const
 {
-    return bodyNode->derivative(argumentName);
+    // The rules of derivation leave many products by 0 and 1, and sums with 0
+    NodePtr derivative = bodyNode->derivative(argumentName, arena);
+    return Simplifier(Simplification::ALGEBRAIC, nullptr).simplify(derivative, arena);
 }
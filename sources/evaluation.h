@@ -2,45 +2,83 @@
 #define EVALUATION_H
 
 #include <string>
-#include <map>
 #include <memory>
 #include <cmath>
 
+#include "status.h"
+#include "symbols.h"
+
 // Forward declarations
 class Node;
-using NodePtr = std::shared_ptr<Node>;
+class NodeArena;
+using NodePtr = Node *;
 
 // A builtinFunction is a pointer to a function taking a double and returning a double
 using builtinFunction = double(*)(double);
-using builtinFunctionMap = std::map<std::string, builtinFunction>;
+using builtinFunctionMap = SymbolMap<builtinFunction>;
+
+// Returns nullptr if there is no builtin function with that name
+builtinFunction findBuiltinFunction(SymbolId name);
 
 // An user-defined function has three things: its name, its arguments and the node representing the body
 struct UserFunction {
-    std::string name;
-    std::string argumentName;
+    SymbolId name;
+    SymbolId argumentName;
     NodePtr bodyNode;
 
-    NodePtr derivative() const;
+    NodePtr derivative(NodeArena &arena) const;
 };
 using UserFunctionPtr = std::shared_ptr<UserFunction>;
 
-using userFunctionsMap = std::map<std::string, UserFunctionPtr>;
-using variablesMap = std::map<std::string, double>;
+using userFunctionsMap = SymbolMap<UserFunctionPtr>;
+using variablesMap = SymbolMap<double>;
+
+// The binding of a function parameter during a call. Frames live on the stack of the
+// call and are chained to that of the caller, whose names the body also sees.
+struct ScopeFrame {
+    SymbolId name;
+    double value;
+    const ScopeFrame *parent;
+};
 
+// Unknown names do not throw: they evaluate to NaN and the first of them is kept in status()
+//
+// The context refers to the functions and global variables rather than copying them, so
+// they must outlive it; a call only pushes a frame for its parameter.
 class EvaluationContext {
 public:
 
-    EvaluationContext(userFunctionsMap userFunctions, variablesMap variables)
-        : userFunctions_(userFunctions), variables_(variables) {}
+    EvaluationContext(const userFunctionsMap &userFunctions, const variablesMap &variables)
+        : userFunctions_(userFunctions), variables_(variables), frame_(nullptr) {}
+
+    // Temporaries would not outlive the context
+    EvaluationContext(userFunctionsMap &&userFunctions, const variablesMap &variables) = delete;
+    EvaluationContext(const userFunctionsMap &userFunctions, variablesMap &&variables) = delete;
+
+    double getVariableValue(SymbolId variableName);
+    double callFunction(SymbolId functionName, double argument);
+
+    inline const Status &status() const { return status_; }
+    inline const userFunctionsMap &userFunctions() const { return userFunctions_; }
 
-    double getVariableValue(std::string variableName) const;
-    double callFunction(std::string functionName, double argument) const;
+    // Evaluates body with name bound to value, above the parameters of the calls in progress
+    template <typename Body>
+    double withParameter(SymbolId name, double value, Body body) {
+        ScopeFrame frame {name, value, frame_};
+        frame_ = &frame;
+        double result = body();
+        frame_ = frame.parent;
+        return result;
+    }
 
 private:
-    userFunctionsMap userFunctions_;
-    variablesMap variables_;
+    const userFunctionsMap &userFunctions_;
+    const variablesMap &variables_;
+    const ScopeFrame *frame_;
+    Status status_;
 
-    double callUserDefinedFunction(UserFunctionPtr userFunction, double argumentValue) const;
+    double callUserDefinedFunction(const UserFunction &userFunction, double argumentValue);
+    double fail(ErrorCode code, SymbolId name);
 };
 
 #endif
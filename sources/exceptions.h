@@ -4,6 +4,8 @@
 #include <stdexcept>
 #include <string>
 
+#include "status.h"
+
 class InvalidInputException : public std::runtime_error
 {
 public:
@@ -25,4 +27,26 @@ public:
     }
 };
 
+class FileException : public std::runtime_error
+{
+public:
+    FileException(const std::string reason) : runtime_error(reason) {
+    }
+};
+
+// Compatibility with the throwing API: turns a failed status into the matching exception
+inline void throwIfFailed(const Status &status)
+{
+    switch (status.code()) {
+        case ErrorCode::OK:
+            return;
+        case ErrorCode::UNKNOWN_FUNCTION:
+            throw UnknownFunctionName(status.detail());
+        case ErrorCode::UNKNOWN_VARIABLE:
+            throw UnknownVariableName(status.detail());
+        default:
+            throw InvalidInputException(status.detail());
+    }
+}
+
 #endif
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+
+#include "flatExpression.h"
+#include "node.h"
+
+FlatExpression::Index FlatExpression::addNumber(double number)
+{
+    FlatNode node;
+    node.opcode = FlatOpcode::NUMBER;
+    node.number = number;
+    nodes_.push_back(node);
+    return root();
+}
+
+FlatExpression::Index FlatExpression::addVariable(SymbolId variable)
+{
+    FlatNode node;
+    node.opcode = FlatOpcode::VARIABLE;
+    node.variable = variable;
+    nodes_.push_back(node);
+    return root();
+}
+
+FlatExpression::Index FlatExpression::addCall(SymbolId function, Index argument)
+{
+    FlatNode node;
+    node.opcode = FlatOpcode::CALL;
+    node.call.argument = argument;
+    node.call.function = function;
+    nodes_.push_back(node);
+    return root();
+}
+
+FlatExpression::Index FlatExpression::addBinary(FlatOpcode opcode, Index left, Index right)
+{
+    FlatNode node;
+    node.opcode = opcode;
+    node.binary.left = left;
+    node.binary.right = right;
+    nodes_.push_back(node);
+    return root();
+}
+
+FlatExpression FlatExpression::fromNode(const Node *root)
+{
+    // Post-order walk: a node is appended once all its children are. A node shared
+    // in the tree (see NodeArena) is appended once, and its index reused.
+    struct Frame {
+        const Node *node;
+        std::size_t nextChild;
+    };
+
+    FlatExpression flat;
+    std::vector<Frame> frames {{root, 0}};
+    std::vector<Index> indices;
+    std::unordered_map<const Node *, Index> flattened;
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+        if (frame.nextChild < frame.node->childCount()) {
+            const Node *child = frame.node->child(frame.nextChild);
+            ++frame.nextChild;
+            auto found = flattened.find(child);
+            if (found != flattened.end()) {
+                indices.push_back(found->second);
+            } else {
+                frames.push_back(Frame {child, 0});
+            }
+            continue;
+        }
+
+        const Node *node = frame.node;
+        frames.pop_back();
+        std::size_t count = node->childCount();
+        Index childIndices[Node::MAX_CHILDREN];
+        std::copy(indices.end() - count, indices.end(), childIndices);
+        indices.resize(indices.size() - count);
+        indices.push_back(node->flattenWith(flat, childIndices));
+        flattened.emplace(node, indices.back());
+    }
+    return flat;
+}
+
+NodePtr FlatExpression::toNode(NodeArena &arena) const
+{
+    // Operands come first, so their nodes always exist already; shared operands become shared nodes
+    std::vector<NodePtr> built(nodes_.size());
+    for (std::size_t i = 0; i < nodes_.size(); ++i) {
+        const FlatNode &node = nodes_[i];
+        switch (node.opcode) {
+            case FlatOpcode::NUMBER:
+                built[i] = arena.make<NumberNode>(node.number);
+                break;
+            case FlatOpcode::VARIABLE:
+                built[i] = arena.make<VariableNode>(node.variable);
+                break;
+            case FlatOpcode::CALL:
+                built[i] = arena.make<FunctionCallNode>(node.call.function, built[node.call.argument]);
+                break;
+            case FlatOpcode::ADD:
+                built[i] = arena.make<AdditionNode>(built[node.binary.left], built[node.binary.right]);
+                break;
+            case FlatOpcode::SUBTRACT:
+                built[i] = arena.make<SubtractionNode>(built[node.binary.left], built[node.binary.right]);
+                break;
+            case FlatOpcode::MULTIPLY:
+                built[i] = arena.make<MultiplicationNode>(built[node.binary.left], built[node.binary.right]);
+                break;
+            case FlatOpcode::DIVIDE:
+                built[i] = arena.make<DivisionNode>(built[node.binary.left], built[node.binary.right]);
+                break;
+        }
+    }
+    return built.back();
+}
+
+std::string FlatExpression::toString() const
+{
+    // Same text as Node::toString: each frame writes its parts in turn, stepping into
+    // an operand between two parts. The root is at the top level, all the others are not.
+    struct Frame {
+        Index index;
+        unsigned part;
+    };
+
+    std::ostringstream oss;
+    std::vector<Frame> frames {{root(), 0}};
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+        const FlatNode &node = nodes_[frame.index];
+        bool parenthesis = frames.size() > 1;
+        unsigned part = frame.part++;
+
+        Index next;
+        switch (node.opcode) {
+            case FlatOpcode::NUMBER:
+                oss << node.number;
+                frames.pop_back();
+                continue;
+            case FlatOpcode::VARIABLE:
+                oss << symbolName(node.variable);
+                frames.pop_back();
+                continue;
+            case FlatOpcode::CALL:
+                if (part == 1) {
+                    oss << (parenthesis ? ")" : "");
+                    frames.pop_back();
+                    continue;
+                }
+                oss << (parenthesis ? "(" : "") << symbolName(node.call.function) << ' ';
+                next = node.call.argument;
+                break;
+            default:
+                if (part == 2) {
+                    oss << (parenthesis ? ")" : "");
+                    frames.pop_back();
+                    continue;
+                }
+                if (part == 0) {
+                    oss << (parenthesis ? "(" : "");
+                    next = node.binary.left;
+                } else {
+                    static const char symbols[] = {'+', '-', '*', '/'};
+                    oss << ' ' << symbols[static_cast<int>(node.opcode) - static_cast<int>(FlatOpcode::ADD)] << ' ';
+                    next = node.binary.right;
+                }
+                break;
+        }
+        frames.push_back(Frame {next, 0});
+    }
+    return oss.str();
+}
+
+double FlatExpression::eval(EvaluationContext &context) const
+{
+    // Operands come first, so one scan computes every value from values already computed.
+    // The scratch is reused across calls, and indexed rather than pointed into, since a
+    // user function called from here may run another scan above this one.
+    static thread_local std::vector<double> values;
+    std::size_t base = values.size();
+    values.resize(base + nodes_.size());
+
+    for (std::size_t i = 0; i < nodes_.size(); ++i) {
+        const FlatNode &node = nodes_[i];
+        double value;
+        switch (node.opcode) {
+            case FlatOpcode::NUMBER:
+                value = node.number;
+                break;
+            case FlatOpcode::VARIABLE:
+                value = context.getVariableValue(node.variable);
+                break;
+            case FlatOpcode::CALL:
+                value = context.callFunction(node.call.function, values[base + node.call.argument]);
+                break;
+            case FlatOpcode::ADD:
+                value = values[base + node.binary.left] + values[base + node.binary.right];
+                break;
+            case FlatOpcode::SUBTRACT:
+                value = values[base + node.binary.left] - values[base + node.binary.right];
+                break;
+            case FlatOpcode::MULTIPLY:
+                value = values[base + node.binary.left] * values[base + node.binary.right];
+                break;
+            default:
+                value = values[base + node.binary.left] / values[base + node.binary.right];
+                break;
+        }
+        values[base + i] = value;
+    }
+
+    double result = values.back();
+    values.resize(base);
+    return result;
+}
+
+FlatExpression FlatExpression::derivative(SymbolId argument) const
+{
+    // The derivative starts with a copy of this expression, which the derivatives of
+    // products, quotients and calls refer to; derivatives[i] is that of node i.
+    // Then the nodes the derivative does not use are dropped.
+    FlatExpression result = *this;
+    std::vector<Index> derivatives(nodes_.size());
+    for (std::size_t i = 0; i < nodes_.size(); ++i) {
+        const FlatNode &node = nodes_[i];
+        switch (node.opcode) {
+            case FlatOpcode::NUMBER:
+                derivatives[i] = result.addNumber(0);
+                break;
+            case FlatOpcode::VARIABLE:
+                derivatives[i] = result.addNumber(node.variable == argument ? 1 : 0);
+                break;
+            case FlatOpcode::CALL: {
+                // f(g)' = f'(g) g'
+                Index f_g = result.addCall(intern(symbolName(node.call.function) + "'"), node.call.argument);
+                derivatives[i] = result.addBinary(FlatOpcode::MULTIPLY, f_g, derivatives[node.call.argument]);
+                break;
+            }
+            case FlatOpcode::ADD:
+            case FlatOpcode::SUBTRACT:
+                derivatives[i] = result.addBinary(node.opcode, derivatives[node.binary.left], derivatives[node.binary.right]);
+                break;
+            case FlatOpcode::MULTIPLY: {
+                // (f g)' = f' g + f g'
+                Index f = node.binary.left, g = node.binary.right;
+                Index f_g = result.addBinary(FlatOpcode::MULTIPLY, derivatives[f], g);
+                Index fg_ = result.addBinary(FlatOpcode::MULTIPLY, f, derivatives[g]);
+                derivatives[i] = result.addBinary(FlatOpcode::ADD, f_g, fg_);
+                break;
+            }
+            case FlatOpcode::DIVIDE: {
+                // (f / g)' = (f'g - fg') / g^2
+                Index f = node.binary.left, g = node.binary.right;
+                Index f_g = result.addBinary(FlatOpcode::MULTIPLY, derivatives[f], g);
+                Index fg_ = result.addBinary(FlatOpcode::MULTIPLY, f, derivatives[g]);
+                Index g2 = result.addBinary(FlatOpcode::MULTIPLY, g, g);
+                Index num = result.addBinary(FlatOpcode::SUBTRACT, f_g, fg_);
+                derivatives[i] = result.addBinary(FlatOpcode::DIVIDE, num, g2);
+                break;
+            }
+        }
+    }
+
+    result.compact();
+    return result;
+}
+
+void FlatExpression::compact()
+{
+    // Mark what the root uses, scanning down from it, then renumber the marked nodes
+    std::vector<bool> used(nodes_.size(), false);
+    used.back() = true;
+    for (std::size_t i = nodes_.size(); i-- > 0;) {
+        if (!used[i]) {
+            continue;
+        }
+        const FlatNode &node = nodes_[i];
+        if (node.opcode == FlatOpcode::CALL) {
+            used[node.call.argument] = true;
+        } else if (node.opcode != FlatOpcode::NUMBER && node.opcode != FlatOpcode::VARIABLE) {
+            used[node.binary.left] = true;
+            used[node.binary.right] = true;
+        }
+    }
+
+    std::vector<Index> renumbered(nodes_.size());
+    Index next = 0;
+    for (std::size_t i = 0; i < nodes_.size(); ++i) {
+        if (!used[i]) {
+            continue;
+        }
+        FlatNode node = nodes_[i];
+        if (node.opcode == FlatOpcode::CALL) {
+            node.call.argument = renumbered[node.call.argument];
+        } else if (node.opcode != FlatOpcode::NUMBER && node.opcode != FlatOpcode::VARIABLE) {
+            node.binary.left = renumbered[node.binary.left];
+            node.binary.right = renumbered[node.binary.right];
+        }
+        renumbered[i] = next;
+        nodes_[next++] = node;
+    }
+    nodes_.resize(next);
+}
@@ -0,0 +1,75 @@
+#ifndef FLAT_EXPRESSION_H
+#define FLAT_EXPRESSION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "evaluation.h"
+#include "nodeArena.h"
+
+enum class FlatOpcode : std::uint8_t
+{
+    NUMBER,
+    VARIABLE,
+    CALL,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE
+};
+
+// A node record of a FlatExpression. Operands are referred to by their index in the
+// expression, which is always lower than that of the node using them.
+struct FlatNode {
+    FlatOpcode opcode;
+    union {
+        double number;
+        SymbolId variable;
+        struct {
+            std::uint32_t argument;
+            SymbolId function;
+        } call;
+        struct {
+            std::uint32_t left;
+            std::uint32_t right;
+        } binary;
+    };
+};
+
+// An expression stored as one contiguous array of node records, operands before the
+// nodes using them (post-order), the root last. Operands may be shared, which makes
+// the derivative compact. Evaluation and derivation are linear scans of the array.
+//
+// This is an alternative to the Node tree, with the same semantics: fromNode and
+// toNode convert between the two.
+class FlatExpression
+{
+public:
+    using Index = std::uint32_t;
+
+    static FlatExpression fromNode(const Node *root);
+    NodePtr toNode(NodeArena &arena) const;
+
+    Index addNumber(double number);
+    Index addVariable(SymbolId variable);
+    Index addCall(SymbolId function, Index argument);
+    Index addBinary(FlatOpcode opcode, Index left, Index right);
+
+    inline std::size_t size() const { return nodes_.size(); }
+    inline bool empty() const { return nodes_.empty(); }
+    inline const FlatNode &operator [](std::size_t index) const { return nodes_[index]; }
+    inline Index root() const { return static_cast<Index>(nodes_.size() - 1); }
+
+    std::string toString() const;
+    double eval(EvaluationContext &context) const;
+    FlatExpression derivative(SymbolId argument) const;
+
+private:
+    std::vector<FlatNode> nodes_;
+
+    // Drops the nodes the root does not depend on
+    void compact();
+};
+
+#endif
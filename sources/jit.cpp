@@ -0,0 +1,361 @@
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "jit.h"
+#include "virtualMachine.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_HAS_X86_64 1
+#endif
+
+#ifdef JIT_HAS_X86_64
+
+double JitHelpers::getVariable(EvaluationContext *context, std::uint32_t name)
+{
+    return context->getVariableValue(name);
+}
+
+double JitHelpers::callUser(VirtualMachine *machine, EvaluationContext *context, std::uint32_t name, double argument)
+{
+    return machine->callUserFunction(name, argument, *context);
+}
+
+double JitHelpers::callUnknown(EvaluationContext *context, std::uint32_t name, double argument)
+{
+    return context->callFunction(name, argument);
+}
+
+namespace {
+
+// Slot i of the operand stack is in xmm i; the parameter stays in xmm15, and xmm14 holds
+// the right operand of superinstructions. Every xmm register is caller saved, so the
+// slots below a call, and the parameter, are saved to the frame around it.
+const int SLOT_REGISTERS = 14;
+const int SCRATCH = 14;
+const int PARAMETER = 15;
+
+// 16 spill slots, then the temporaries, in a frame of an even number of slots plus 8 bytes,
+// so that rsp is 16-byte aligned at calls once rbx and r12 are pushed
+const int FIRST_TEMPORARY = 16;
+
+// Larger frames are not compiled
+const std::size_t MAX_TEMPORARIES = 4096;
+
+std::int32_t frameSize(std::size_t temporaries)
+{
+    std::size_t slots = FIRST_TEMPORARY + temporaries;
+    return static_cast<std::int32_t>((slots + slots % 2) * 8 + 8);
+}
+
+// Machine code encoding, just for the few instructions used
+class Assembler
+{
+public:
+    std::vector<std::uint8_t> bytes;
+
+    void emit(std::initializer_list<std::uint8_t> values) {
+        bytes.insert(bytes.end(), values);
+    }
+
+    void emit32(std::uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            bytes.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void emit64(std::uint64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            bytes.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    // op dst, src on two xmm registers, with its mandatory prefix (F2 for scalar double)
+    void sse(std::uint8_t prefix, std::uint8_t opcode, int dst, int src) {
+        bytes.push_back(prefix);
+        rex(false, dst, src);
+        emit({0x0F, opcode, modRm(dst, src)});
+    }
+
+    void movapd(int dst, int src) {
+        if (dst != src) {
+            sse(0x66, 0x28, dst, src);
+        }
+    }
+
+    void addsd(int dst, int src) { sse(0xF2, 0x58, dst, src); }
+    void subsd(int dst, int src) { sse(0xF2, 0x5C, dst, src); }
+    void mulsd(int dst, int src) { sse(0xF2, 0x59, dst, src); }
+    void divsd(int dst, int src) { sse(0xF2, 0x5E, dst, src); }
+
+    // movsd between xmm and [rsp + 8 * slot]
+    void store(int slot, int xmm) { stackAccess(0x11, xmm, slot); }
+    void load(int xmm, int slot) { stackAccess(0x10, xmm, slot); }
+
+    // mov rax, bits; movq xmm, rax
+    void loadConstant(int xmm, double value) {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        emit({0x48, 0xB8});
+        emit64(bits);
+        bytes.push_back(0x66);
+        rex(true, xmm, 0);
+        emit({0x0F, 0x6E, modRm(xmm, 0)});
+    }
+
+    // mov rax, function; call rax
+    void call(const void *function) {
+        emit({0x48, 0xB8});
+        emit64(reinterpret_cast<std::uintptr_t>(function));
+        emit({0xFF, 0xD0});
+    }
+
+private:
+    static std::uint8_t modRm(int reg, int rm) {
+        return static_cast<std::uint8_t>(0xC0 | (reg & 7) << 3 | (rm & 7));
+    }
+
+    void rex(bool wide, int reg, int rm) {
+        std::uint8_t prefix = (wide ? 8 : 0) | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0);
+        if (prefix != 0) {
+            bytes.push_back(0x40 | prefix);
+        }
+    }
+
+    void stackAccess(std::uint8_t opcode, int xmm, int slot) {
+        // [rsp + disp32] needs a SIB byte
+        bytes.push_back(0xF2);
+        rex(false, xmm, 0);
+        emit({0x0F, opcode, static_cast<std::uint8_t>(0x84 | (xmm & 7) << 3), 0x24});
+        emit32(static_cast<std::uint32_t>(8 * slot));
+    }
+};
+
+class FunctionCompiler
+{
+public:
+    explicit FunctionCompiler(Assembler &assembler) : a_(assembler), depth_(0) {}
+
+    bool compile(const Bytecode &code) {
+        if (code.maxDepth() > SLOT_REGISTERS || code.temporaries() > MAX_TEMPORARIES) {
+            return false;
+        }
+        std::int32_t size = frameSize(code.temporaries());
+
+        // push rbx; push r12; sub rsp, size; machine in rbx, context in r12
+        a_.emit({0x53, 0x41, 0x54, 0x48, 0x81, 0xEC});
+        a_.emit32(static_cast<std::uint32_t>(size));
+        a_.emit({0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4});
+        a_.movapd(PARAMETER, 0);
+        a_.store(PARAMETER, PARAMETER);
+
+        for (const Instruction &instruction : code.instructions()) {
+            std::uint32_t operand = instruction.operand;
+            switch (instruction.opcode) {
+                case Opcode::CONSTANT:
+                    a_.loadConstant(depth_++, code.constant(operand));
+                    break;
+                case Opcode::PARAMETER:
+                    a_.movapd(depth_++, PARAMETER);
+                    break;
+                case Opcode::VARIABLE:
+                    getVariable(operand, depth_);
+                    ++depth_;
+                    break;
+                case Opcode::ADD:
+                    --depth_;
+                    a_.addsd(depth_ - 1, depth_);
+                    break;
+                case Opcode::SUBTRACT:
+                    --depth_;
+                    a_.subsd(depth_ - 1, depth_);
+                    break;
+                case Opcode::MULTIPLY:
+                    --depth_;
+                    a_.mulsd(depth_ - 1, depth_);
+                    break;
+                case Opcode::DIVIDE:
+                    --depth_;
+                    a_.divsd(depth_ - 1, depth_);
+                    break;
+                case Opcode::CALL_BUILTIN:
+                    callBuiltin(code.builtin(operand), depth_ - 1);
+                    break;
+                case Opcode::CALL_USER:
+                    callFunction(Opcode::CALL_USER, operand, depth_ - 1);
+                    break;
+                case Opcode::CALL_UNKNOWN:
+                    callFunction(Opcode::CALL_UNKNOWN, operand, depth_ - 1);
+                    break;
+                case Opcode::RETURN:
+                    // The value is in xmm0. add rsp, size; pop r12; pop rbx; ret
+                    a_.emit({0x48, 0x81, 0xC4});
+                    a_.emit32(static_cast<std::uint32_t>(size));
+                    a_.emit({0x41, 0x5C, 0x5B, 0xC3});
+                    break;
+                case Opcode::MULTIPLY_VARIABLE:
+                    getVariable(operand, SCRATCH);
+                    a_.mulsd(depth_ - 1, SCRATCH);
+                    break;
+                case Opcode::MULTIPLY_PARAMETER:
+                    a_.mulsd(depth_ - 1, PARAMETER);
+                    break;
+                case Opcode::ADD_CONSTANT:
+                    a_.loadConstant(SCRATCH, code.constant(operand));
+                    a_.addsd(depth_ - 1, SCRATCH);
+                    break;
+                case Opcode::MULTIPLY_CALL_BUILTIN:
+                    callBuiltin(code.builtin(operand), depth_ - 1, SCRATCH);
+                    --depth_;
+                    a_.mulsd(depth_ - 1, SCRATCH);
+                    break;
+                case Opcode::STORE:
+                    a_.store(FIRST_TEMPORARY + static_cast<int>(operand), depth_ - 1);
+                    break;
+                case Opcode::LOAD:
+                    a_.load(depth_++, FIRST_TEMPORARY + static_cast<int>(operand));
+                    break;
+            }
+        }
+        return true;
+    }
+
+private:
+    Assembler &a_;
+    int depth_;
+
+    // The slots below live are saved, the call made, its value moved to result, and
+    // the slots and the parameter restored
+    void saveSlots(int live) {
+        for (int slot = 0; slot < live; ++slot) {
+            a_.store(slot, slot);
+        }
+    }
+
+    void restoreSlots(int live, int result) {
+        a_.movapd(result, 0);
+        for (int slot = 0; slot < live; ++slot) {
+            a_.load(slot, slot);
+        }
+        a_.load(PARAMETER, PARAMETER);
+    }
+
+    void getVariable(std::uint32_t name, int result) {
+        saveSlots(depth_);
+        // mov rdi, r12; mov esi, name
+        a_.emit({0x4C, 0x89, 0xE7, 0xBE});
+        a_.emit32(name);
+        a_.call(reinterpret_cast<const void *>(&JitHelpers::getVariable));
+        restoreSlots(depth_, result);
+    }
+
+    void callBuiltin(builtinFunction function, int argument, int result = -1) {
+        saveSlots(argument);
+        a_.movapd(0, argument);
+        a_.call(reinterpret_cast<const void *>(function));
+        restoreSlots(argument, result < 0 ? argument : result);
+    }
+
+    void callFunction(Opcode opcode, std::uint32_t name, int argument) {
+        saveSlots(argument);
+        a_.movapd(0, argument);
+        if (opcode == Opcode::CALL_USER) {
+            // mov rdi, rbx; mov rsi, r12; mov edx, name
+            a_.emit({0x48, 0x89, 0xDF, 0x4C, 0x89, 0xE6, 0xBA});
+            a_.emit32(name);
+            a_.call(reinterpret_cast<const void *>(&JitHelpers::callUser));
+        } else {
+            // mov rdi, r12; mov esi, name
+            a_.emit({0x4C, 0x89, 0xE7, 0xBE});
+            a_.emit32(name);
+            a_.call(reinterpret_cast<const void *>(&JitHelpers::callUnknown));
+        }
+        restoreSlots(argument, argument);
+    }
+};
+
+}
+
+bool JitFunction::isSupported()
+{
+    return true;
+}
+
+JitFunction JitFunction::compile(const Bytecode &code)
+{
+    JitFunction function;
+    Assembler assembler;
+    FunctionCompiler compiler(assembler);
+    if (!compiler.compile(code)) {
+        return function;
+    }
+
+    // Written while writable, then made executable and read only
+    std::size_t pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::size_t size = (assembler.bytes.size() + pageSize - 1) / pageSize * pageSize;
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return function;
+    }
+    std::memcpy(memory, assembler.bytes.data(), assembler.bytes.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return function;
+    }
+
+    function.memory_ = memory;
+    function.size_ = size;
+    function.codeSize_ = assembler.bytes.size();
+    return function;
+}
+
+void JitFunction::release()
+{
+    if (memory_ != nullptr) {
+        munmap(memory_, size_);
+    }
+}
+
+#else
+
+bool JitFunction::isSupported()
+{
+    return false;
+}
+
+JitFunction JitFunction::compile(const Bytecode &code)
+{
+    return JitFunction();
+}
+
+void JitFunction::release()
+{
+}
+
+#endif
+
+JitFunction::JitFunction(JitFunction &&other)
+    : memory_(other.memory_), size_(other.size_), codeSize_(other.codeSize_)
+{
+    other.memory_ = nullptr;
+}
+
+JitFunction &JitFunction::operator =(JitFunction &&other)
+{
+    if (this != &other) {
+        release();
+        memory_ = other.memory_;
+        size_ = other.size_;
+        codeSize_ = other.codeSize_;
+        other.memory_ = nullptr;
+    }
+    return *this;
+}
+
+JitFunction::~JitFunction()
+{
+    release();
+}
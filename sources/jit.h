@@ -0,0 +1,60 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "bytecode.h"
+#include "evaluation.h"
+
+class VirtualMachine;
+
+// Called from the native code for what it does not do itself
+struct JitHelpers {
+    static double getVariable(EvaluationContext *context, std::uint32_t name);
+    static double callUser(VirtualMachine *machine, EvaluationContext *context, std::uint32_t name, double argument);
+    static double callUnknown(EvaluationContext *context, std::uint32_t name, double argument);
+};
+
+// Native code compiled from the bytecode of a function body, in executable pages of
+// its own. x86-64 only, with the System V calling convention (Linux): the operand stack
+// lives in SSE2 registers, the parameter in one of them, and builtins are called directly.
+// Variables and user functions are reached through the machine and context it runs in.
+class JitFunction
+{
+public:
+    // Whether this build and platform can compile at all
+    static bool isSupported();
+
+    // Returns an invalid function if the code cannot be compiled: on another platform,
+    // when its operand stack is deeper than the registers, or its temporaries too many for the frame
+    static JitFunction compile(const Bytecode &code);
+
+    JitFunction() : memory_(nullptr), size_(0), codeSize_(0) {}
+    JitFunction(JitFunction &&other);
+    JitFunction &operator =(JitFunction &&other);
+    ~JitFunction();
+
+    JitFunction(const JitFunction &) = delete;
+    JitFunction &operator =(const JitFunction &) = delete;
+
+    inline bool valid() const { return memory_ != nullptr; }
+    inline std::size_t codeSize() const { return codeSize_; }
+
+    // Runs the function; the parameter must already be bound in the context, for the
+    // functions it calls (see EvaluationContext::withParameter)
+    inline double operator ()(double parameter, VirtualMachine &machine, EvaluationContext &context) const {
+        return reinterpret_cast<Entry>(memory_)(parameter, &machine, &context);
+    }
+
+private:
+    using Entry = double (*)(double parameter, VirtualMachine *machine, EvaluationContext *context);
+
+    void *memory_;
+    std::size_t size_;
+    std::size_t codeSize_;
+
+    void release();
+};
+
+#endif
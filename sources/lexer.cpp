@@ -1,130 +1,228 @@
 #include <istream>
-#include <cctype>
 #include <string>
-#include <set>
 
 #include "lexer.h"
-#include "exceptions.h"
-
-static std::set<std::string> validOperators = {"+", "-", "*", "/", "(", ")", "="};
+#include "charClass.h"
+#include "scan.h"
+#include "number.h"
 
 Lexer::Lexer(std::istream& istream)
-    : istream_(istream), atEof_(false)
+    : istream_(&istream), begin_(nullptr), cursor_(nullptr), end_(nullptr), beginOffset_(0), tokenOffset_(0)
+{
+}
+
+Lexer::Lexer(int fd, std::size_t chunkSize)
+    : istream_(nullptr), chunks_(new ChunkedInput(fd, chunkSize)),
+      begin_(nullptr), cursor_(nullptr), end_(nullptr), beginOffset_(0), tokenOffset_(0)
+{
+}
+
+Lexer::Lexer(const char *begin, const char *end)
+    : istream_(nullptr), begin_(begin), cursor_(begin), end_(end), beginOffset_(0), tokenOffset_(0)
 {
-    advance();
     skipSpaces();
 }
 
-void Lexer::advance()
+bool Lexer::refill()
 {
-    next_ = static_cast<char>(istream_.get());
-    atEof_ = istream_.eof();
+    if (chunks_) {
+        // On failure the chunk is left untouched, so the last token stays valid
+        std::size_t consumed = end_ - begin_;
+        if (!chunks_->next()) {
+            return false;
+        }
+        beginOffset_ += consumed;
+        begin_ = cursor_ = chunks_->begin();
+        end_ = chunks_->end();
+        return true;
+    }
+
+    // A memory buffer is never refilled
+    if (istream_ == nullptr) {
+        return false;
+    }
+
+    // Read the next line, putting back the newline that getline strips.
+    // On failure line_ is left untouched, so the last token stays valid.
+    std::string nextLine;
+    if (!std::getline(*istream_, nextLine)) {
+        return false;
+    }
+    if (!istream_->eof()) {
+        nextLine += '\n';
+    }
+    beginOffset_ += line_.size();
+    line_.swap(nextLine);
+    begin_ = cursor_ = line_.data();
+    end_ = cursor_ + line_.size();
+    return true;
 }
 
 void Lexer::skipSpaces()
 {
-    while (!atEof_ && !isEol(next_) && std::isspace(next_)) {
-        advance();
+    // Most runs are a single space, so only call the vectorized scan for longer ones
+    if (cursor_ != end_ && isSpace(*cursor_)) {
+        cursor_ = scanSpaces(cursor_ + 1, end_);
     }
 }
 
 bool Lexer::hasNextToken() const
 {
-    return !atEof_;
+    if (cursor_ != end_) {
+        return true;
+    }
+    if (chunks_) {
+        return !chunks_->atEof();
+    }
+    return istream_ != nullptr && istream_->peek() != std::istream::traits_type::eof();
 }
 
 Token Lexer::nextToken()
 {
-    if (atEof_) {
-        return Token(TokenType::END_OF_INPUT, "");
+    // Lines are only read when needed, so that the previous ones stay valid
+    while (cursor_ == end_) {
+        if (!refill()) {
+            tokenOffset_ = beginOffset_ + (cursor_ - begin_);
+            return Token(TokenType::END_OF_INPUT, "", 0);
+        }
+        skipSpaces();
     }
+    tokenOffset_ = beginOffset_ + (cursor_ - begin_);
 
-    if (std::isdigit(next_)) {
+    if (isDigit(*cursor_)) {
         return parseNumber();
-    } else if (isIdentifierStart(next_)) {
+    } else if (isIdentifierStart(*cursor_)) {
         return parseIdentifier();
-    } else if (isEol(next_)) {
+    } else if (isEol(*cursor_)) {
         return parseNewLine();
     } else {
         return parseOperator();
     }
 }
 
+void Lexer::tokenizeAll(TokenStream &tokens)
+{
+    while (hasNextToken()) {
+        Token token = nextToken();
+        if (token.getTokenType() == TokenType::END_OF_INPUT) {
+            break;
+        }
+        tokens.push(token, tokenOffset_);
+    }
+}
+
+void Lexer::tokenizeLine(TokenStream &tokens)
+{
+    while (hasNextToken()) {
+        Token token = nextToken();
+        if (token.getTokenType() == TokenType::END_OF_INPUT) {
+            break;
+        }
+        tokens.push(token, tokenOffset_);
+        if (token.getTokenType() == TokenType::END_OF_LINE) {
+            break;
+        }
+    }
+}
+
 Token Lexer::parseNumber()
 {
-    std::string num;
+    const char *start = cursor_;
 
     // Integer part
-    while (!atEof_ && isdigit(next_)) {
-        num += next_;
-        advance();
-    }
+    cursor_ = scanDigits(cursor_, end_);
 
     // Dot and floating part?
-    if (!atEof_ && next_ == '.') {
-        num += '.';
-        advance();
-        while (!atEof_ && isdigit(next_)) {
-            num += next_;
-            advance();
+    if (cursor_ != end_ && *cursor_ == '.') {
+        cursor_ = scanDigits(cursor_ + 1, end_);
+    }
+
+    // Exponent? Only if digits follow, otherwise the 'e' starts an identifier
+    if (cursor_ != end_ && (*cursor_ == 'e' || *cursor_ == 'E')) {
+        const char *exponentDigits = cursor_ + 1;
+        if (exponentDigits != end_ && (*exponentDigits == '+' || *exponentDigits == '-')) {
+            ++exponentDigits;
+        }
+        if (exponentDigits != end_ && isDigit(*exponentDigits)) {
+            cursor_ = scanDigits(exponentDigits, end_);
         }
     }
 
+    Token token(TokenType::NUMBER, start, cursor_ - start, TokenSubType::NONE, parseNumberLiteral(start, cursor_));
     skipSpaces();
-    return Token(TokenType::NUMBER, num);
+    return token;
 }
 
 Token Lexer::parseIdentifier()
 {
-    // Add the first character to the identifier
-    std::string identifier{next_};
-    advance();
-
-    // Match more identifier parts
-    while (!atEof_ && isIdentifierPart(next_)) {
-        identifier += next_;
-        advance();
-    }
+    // Match the first character and then all the following identifier parts
+    const char *start = cursor_;
+    cursor_ = scanIdentifierParts(cursor_ + 1, end_);
 
+    Token token = makeIdentifierOrKeyword(start, cursor_ - start);
     skipSpaces();
-    return Token(TokenType::IDENTIFIER, identifier);
+    return token;
 }
 
 Token Lexer::parseNewLine()
 {
-    if (next_ == '\r') {
-        advance();
-        if (next_ != '\n') {
-            throw InvalidInputException("Expected a \n after a \r");
+    // The token text is a literal rather than the source, so that it outlives the line;
+    // its length is still that of the newline, so that the next line's offset is known
+    static const char crlf[] = "\r\n";
+    const char *text = crlf + 1;
+    if (*cursor_ == '\r') {
+        ++cursor_;
+        if (cursor_ == end_ || *cursor_ != '\n') {
+            // The '\r' is skipped, so that lexing can go on after the error
+            return Token(TokenType::ERROR, cursor_ - 1, 1, TokenSubType::INVALID_NEWLINE);
         }
+        text = crlf;
     }
-    advance();
+    ++cursor_;
     skipSpaces();
-    return Token(TokenType::END_OF_LINE, "");
+    return Token(TokenType::END_OF_LINE, text, crlf + 2 - text);
 }
 
-Token Lexer::parseOperator()
+Token Lexer::makeIdentifierOrKeyword(const char *text, std::size_t length) const
 {
-    std::string operatorText = std::string{next_};
-    if (!validOperators.count(operatorText)) {
-        throw InvalidInputException("Invalid operator type: " + operatorText);
+    TokenSubType keyword = TokenSubType::NONE;
+    if (length == 3 && text[0] == 'd' && text[1] == 'e') {
+        if (text[2] == 'f') {
+            keyword = TokenSubType::DEF;
+        } else if (text[2] == 'r') {
+            keyword = TokenSubType::DER;
+        }
     }
-    advance();
-    skipSpaces();
-    return Token(TokenType::OPERATOR, operatorText);
+    return Token::makeIdentifier(intern(text, length), text, length, keyword);
 }
 
-bool Lexer::isIdentifierStart(char candidate) const
+Token Lexer::parseOperator()
 {
-    return std::isalpha(candidate);
-}
+    TokenSubType subType;
+    switch (*cursor_) {
+        case '+': subType = TokenSubType::PLUS; break;
+        case '-': subType = TokenSubType::MINUS; break;
+        case '*': subType = TokenSubType::STAR; break;
+        case '/': subType = TokenSubType::SLASH; break;
+        case '(': subType = TokenSubType::OPEN_PARENTHESIS; break;
+        case ')': subType = TokenSubType::CLOSED_PARENTHESIS; break;
+        case '=': subType = TokenSubType::ASSIGN; break;
+        default:
+            subType = TokenSubType::INVALID_CHARACTER; break;
+    }
 
-bool Lexer::isIdentifierPart(char candidate) const
-{
-    return isIdentifierStart(candidate) || std::isdigit(candidate);
+    // An invalid character becomes an ERROR token and is skipped, so that lexing can go on
+    TokenType type = subType == TokenSubType::INVALID_CHARACTER ? TokenType::ERROR : TokenType::OPERATOR;
+    Token token(type, cursor_, 1, subType);
+    ++cursor_;
+    skipSpaces();
+    return token;
 }
 
-bool Lexer::isEol(char candidate) const
+Status Lexer::errorStatus(const Token &token, std::size_t offset)
 {
-    return candidate == '\n' || candidate == '\r';
+    if (token.is(TokenSubType::INVALID_NEWLINE)) {
+        return Status(ErrorCode::INVALID_INPUT, "Expected a \n after a \r", offset);
+    }
+    return Status(ErrorCode::INVALID_INPUT, "Invalid operator type: " + token.getContent(), offset);
 }
@@ -1,31 +1,65 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <istream>
+#include <memory>
+#include <string>
+
+#include "chunkedInput.h"
+#include "status.h"
 #include "token.h"
+#include "tokenStream.h"
 
 class Lexer
 {
 public:
+    // Lexes a true stream, one line at a time. Tokens point into the current line,
+    // so they stay valid until the lexer moves past the following END_OF_LINE.
     explicit Lexer(std::istream& istream);
+
+    // Lexes a file descriptor read in large chunks, with bounded memory.
+    // Tokens point into the current chunk, so they stay valid until the lexer
+    // moves past the following END_OF_LINE.
+    explicit Lexer(int fd, std::size_t chunkSize = ChunkedInput::DEFAULT_CHUNK_SIZE);
+
+    // Lexes a contiguous in-memory buffer without copying it.
+    // Tokens point into the buffer, which must outlive them.
+    Lexer(const char *begin, const char *end);
+
+    // Never throws on bad input: an invalid character or line ending is returned
+    // as an ERROR token and skipped, and lexing goes on after it
     Token nextToken();
     bool hasNextToken() const;
 
+    // Offset from the start of the source of the token last returned by nextToken
+    inline std::size_t lastTokenOffset() const { return tokenOffset_; }
+
+    // Lex the whole source, or only up to and including the next END_OF_LINE,
+    // appending the tokens to the stream
+    void tokenizeAll(TokenStream &tokens);
+    void tokenizeLine(TokenStream &tokens);
+
+    // What is wrong with an ERROR token found at the given offset
+    static Status errorStatus(const Token &token, std::size_t offset = 0);
+
 private:
-    std::istream& istream_;
-    char next_;
-    bool atEof_;
+    std::istream *istream_;
+    std::string line_;
+    std::unique_ptr<ChunkedInput> chunks_;
+    const char *begin_;
+    const char *cursor_;
+    const char *end_;
+    std::size_t beginOffset_;
+    std::size_t tokenOffset_;
 
-    void advance();
+    bool refill();
     void skipSpaces();
     Token parseNumber();
     Token parseNewLine();
     Token parseOperator();
 
-    bool isIdentifierStart(char candidate) const;
-    bool isIdentifierPart(char candidate) const;
-    bool isEol(char candidate) const;
-
     Token parseIdentifier();
+    Token makeIdentifierOrKeyword(const char *text, std::size_t length) const;
 };
 
 #endif
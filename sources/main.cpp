@@ -1,11 +1,41 @@
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <unistd.h>
 
 #include "parser.h"
+#include "mappedFile.h"
 
+// Usage: derivative [--batch] [file]
+// In batch mode bad statements are skipped, and the errors are reported at the end
+// on stderr, as JSON lines (see writeErrorReport).
 int main(int argc, char *argv[])
 {
-    Parser parser(std::cin, std::cout);
-    parser.parseProgram();
+    bool batch = argc > 1 && std::strcmp(argv[1], "--batch") == 0;
+    int fileArgument = batch ? 2 : 1;
 
+    // A file given on the command line is mapped and lexed in place; otherwise
+    // stdin is read in chunks, so that unbounded input runs in bounded memory
+    std::unique_ptr<MappedFile> file;
+    std::unique_ptr<Parser> parser;
+    if (argc > fileArgument) {
+        file.reset(new MappedFile(argv[fileArgument]));
+        parser.reset(new Parser(file->begin(), file->end(), std::cout));
+    } else {
+        parser.reset(new Parser(STDIN_FILENO, std::cout));
+    }
+
+    if (batch) {
+        std::vector<StatementError> errors = parser->runBatch();
+        std::cout.flush();
+        writeErrorReport(std::cerr, errors);
+        return errors.empty() ? 0 : 1;
+    }
+
+    Status status = parser->run();
+    if (!status.ok()) {
+        std::cerr << "Error at offset " << status.offset() << ": " << status.message() << std::endl;
+        return 1;
+    }
     return 0;
 }
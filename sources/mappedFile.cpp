@@ -0,0 +1,42 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mappedFile.h"
+#include "exceptions.h"
+
+MappedFile::MappedFile(const std::string &path)
+    : data_(nullptr), size_(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw FileException("Cannot open file: " + path);
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0) {
+        close(fd);
+        throw FileException("Cannot read size of file: " + path);
+    }
+
+    // An empty file cannot be mapped, but it is a valid empty buffer
+    size_ = static_cast<std::size_t>(fileStat.st_size);
+    if (size_ > 0) {
+        void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw FileException("Cannot map file: " + path);
+        }
+        data_ = static_cast<const char *>(mapping);
+        madvise(mapping, size_, MADV_SEQUENTIAL);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_ != nullptr) {
+        munmap(const_cast<char *>(data_), size_);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+
+// A read-only memory mapping of a whole file, so that it can be lexed as a buffer
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator =(const MappedFile &) = delete;
+
+    inline const char *begin() const { return data_; }
+    inline const char *end() const { return data_ + size_; }
+
+private:
+    const char *data_;
+    std::size_t size_;
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "node.h"
+
+NodePtr Node::child(std::size_t index) const
+{
+    assert(false && "leaf nodes have no children");
+    return nullptr;
+}
+
+std::string Node::toString(ToStringType toStringType) const
+{
+    // Each frame writes its parts in turn, stepping into a child between two parts
+    struct Frame {
+        const Node *node;
+        std::size_t part;
+        ToStringType toStringType;
+    };
+
+    std::ostringstream oss;
+    std::vector<Frame> frames {{this, 0, toStringType}};
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+        frame.node->writePart(oss, frame.part, frame.toStringType);
+        if (frame.part < frame.node->childCount()) {
+            const Node *child = frame.node->child(frame.part);
+            ++frame.part;
+            frames.push_back(Frame {child, 0, ToStringType::RECURSIVE_CALL});
+        } else {
+            frames.pop_back();
+        }
+    }
+    return oss.str();
+}
+
+double Node::eval(EvaluationContext &context)
+{
+    // Post-order walk: a node is evaluated once the values of all its children are on the stack.
+    // The stacks are reused across calls; evaluating a user function body from evalWith nests
+    // a walk above this one, which leaves them as it found them.
+    // Numbers and binary operators are evaluated here from their kind, without virtual calls.
+    // A shared node is evaluated once, its value then reused: names are bound the same way
+    // throughout the walk, so it would have the same value, and set the same error, again.
+    // Each level of nested walks has its own map of shared values, reused across calls and
+    // only cleared once the walk reaches a shared node.
+    struct Frame {
+        Node *node;
+        std::size_t nextChild;
+    };
+    static thread_local std::vector<Frame> frames;
+    static thread_local std::vector<double> values;
+    static thread_local std::deque<std::unordered_map<const Node *, double>> sharedValuesByLevel;
+    static thread_local std::size_t level = 0;
+
+    struct Nesting {
+        Nesting() { ++level; }
+        ~Nesting() { --level; }
+    } nesting;
+    std::unordered_map<const Node *, double> *sharedValues = nullptr;
+    auto remember = [&](const Node *node, double value) {
+        if (sharedValues == nullptr) {
+            while (sharedValuesByLevel.size() < level) {
+                sharedValuesByLevel.emplace_back();
+            }
+            sharedValues = &sharedValuesByLevel[level - 1];
+            sharedValues->clear();
+        }
+        sharedValues->emplace(node, value);
+    };
+
+    auto visit = [&](Node *child) {
+        if (child->shared() && sharedValues != nullptr) {
+            auto found = sharedValues->find(child);
+            if (found != sharedValues->end()) {
+                values.push_back(found->second);
+                return;
+            }
+        }
+        frames.push_back(Frame {child, 0});
+    };
+
+    std::size_t base = frames.size();
+    frames.push_back(Frame {this, 0});
+    while (frames.size() > base) {
+        Frame &frame = frames.back();
+        Node *node = frame.node;
+        FlatOpcode kind = node->kind_;
+
+        if (kind == FlatOpcode::NUMBER) {
+            frames.pop_back();
+            values.push_back(static_cast<NumberNode *>(node)->value());
+            continue;
+        }
+
+        if (BinaryOpNode::isBinary(kind)) {
+            BinaryOpNode *binary = static_cast<BinaryOpNode *>(node);
+            if (frame.nextChild < 2) {
+                Node *child = frame.nextChild == 0 ? binary->left() : binary->right();
+                ++frame.nextChild;
+                visit(child);
+                continue;
+            }
+            frames.pop_back();
+            double right = values.back();
+            values.pop_back();
+            values.back() = BinaryOpNode::apply(kind, values.back(), right);
+            if (node->shared()) {
+                remember(node, values.back());
+            }
+            continue;
+        }
+
+        std::size_t count = node->childCount();
+        if (frame.nextChild < count) {
+            Node *child = node->child(frame.nextChild);
+            ++frame.nextChild;
+            visit(child);
+            continue;
+        }
+
+        // Copy the children values out, since a nested walk may grow the stack
+        frames.pop_back();
+        double childValues[MAX_CHILDREN];
+        std::copy(values.end() - count, values.end(), childValues);
+        values.resize(values.size() - count);
+        values.push_back(node->evalWith(context, childValues));
+        if (node->shared()) {
+            remember(node, values.back());
+        }
+    }
+
+    double value = values.back();
+    values.pop_back();
+    return value;
+}
+
+NodePtr Node::derivative(SymbolId argument, NodeArena &arena) const
+{
+    // Post-order walk: a node is derived once the derivatives of all its children are on the stack.
+    // A node shared in the tree (see NodeArena) is derived once, so that sharing does not make
+    // the walk exponential.
+    struct Frame {
+        const Node *node;
+        std::size_t nextChild;
+    };
+
+    std::vector<Frame> frames {{this, 0}};
+    std::vector<NodePtr> derivatives;
+    std::unordered_map<const Node *, NodePtr> derived;
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+        if (frame.nextChild < frame.node->childCount()) {
+            const Node *child = frame.node->child(frame.nextChild);
+            ++frame.nextChild;
+            auto found = derived.find(child);
+            if (found != derived.end()) {
+                derivatives.push_back(found->second);
+            } else {
+                frames.push_back(Frame {child, 0});
+            }
+            continue;
+        }
+
+        const Node *node = frame.node;
+        frames.pop_back();
+        std::size_t count = node->childCount();
+        NodePtr childDerivatives[MAX_CHILDREN];
+        std::copy(derivatives.end() - count, derivatives.end(), childDerivatives);
+        derivatives.resize(derivatives.size() - count);
+        derivatives.push_back(node->derivativeWith(argument, childDerivatives, arena));
+        derived.emplace(node, derivatives.back());
+    }
+
+    return derivatives.back();
+}
+
+NodePtr Node::copy(NodeArena &arena) const
+{
+    // Post-order walk: a node is copied once the copies of all its children are on the stack.
+    // A shared node is copied once, as in derivative.
+    struct Frame {
+        const Node *node;
+        std::size_t nextChild;
+    };
+
+    std::vector<Frame> frames {{this, 0}};
+    std::vector<NodePtr> copies;
+    std::unordered_map<const Node *, NodePtr> copied;
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+        if (frame.nextChild < frame.node->childCount()) {
+            const Node *child = frame.node->child(frame.nextChild);
+            ++frame.nextChild;
+            auto found = copied.find(child);
+            if (found != copied.end()) {
+                copies.push_back(found->second);
+            } else {
+                frames.push_back(Frame {child, 0});
+            }
+            continue;
+        }
+
+        const Node *node = frame.node;
+        frames.pop_back();
+        std::size_t count = node->childCount();
+        NodePtr children[MAX_CHILDREN];
+        std::copy(copies.end() - count, copies.end(), children);
+        copies.resize(copies.size() - count);
+        copies.push_back(node->copyWith(children, arena));
+        copied.emplace(node, copies.back());
+    }
+
+    return copies.back();
+}
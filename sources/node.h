@@ -3,69 +3,215 @@
 
 #include <sstream>
 #include <cassert>
-#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
 
+#include "bytecode.h"
 #include "evaluation.h"
 #include "exceptions.h"
+#include "flatExpression.h"
+#include "nodeArena.h"
+#include "simplify.h"
 
 enum class ToStringType {
     TOP_LEVEL,
     RECURSIVE_CALL
 };
 
+// Mixes a field into the hash of a node
+inline std::size_t hashMix(std::size_t hash, std::uint64_t value)
+{
+    std::uint64_t mixed = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+    return static_cast<std::size_t>(mixed ^ (mixed >> 29));
+}
+
+// A node only knows how to combine the results of its children. Walking the tree is
+// done by Node itself, with explicit stacks rather than recursion, so that the size
+// of an expression is limited by memory and not by the call stack.
+// Nodes live in a NodeArena, which frees them without destroying them.
 class Node
 {
 public:
-    virtual ~Node() {}
+    // No node has more children than this
+    static const std::size_t MAX_CHILDREN = 2;
 
-    virtual std::string toString(ToStringType toStringType) const = 0;
-    virtual double eval(EvaluationContext &context) = 0;
-    virtual NodePtr derivative(const std::string &argument) const = 0;
-};
+    std::string toString(ToStringType toStringType) const;
+    double eval(EvaluationContext &context);
+
+    // The derivative shares the unchanged subtrees of this node, so the arena must not outlive it
+    NodePtr derivative(SymbolId argument, NodeArena &arena) const;
+
+    // A copy of the tree made in the arena, which shares nothing with this one
+    NodePtr copy(NodeArena &arena) const;
+
+    virtual std::size_t childCount() const { return 0; }
+    virtual NodePtr child(std::size_t index) const;
+
+    // Writes the text before the first child (part 0), between two children,
+    // or after the last one (part childCount())
+    virtual void writePart(std::ostream &ostream, std::size_t part, ToStringType toStringType) const = 0;
+
+    // The value of the node, given the values of its children
+    virtual double evalWith(EvaluationContext &context, const double *childValues) = 0;
+
+    // The derivative of the node, given the derivatives of its children
+    virtual NodePtr derivativeWith(SymbolId argument, const NodePtr *childDerivatives, NodeArena &arena) const = 0;
+
+    // A copy of the node, given the copies of its children
+    virtual NodePtr copyWith(const NodePtr *children, NodeArena &arena) const = 0;
+
+    // Appends the node to a flat expression, given the indices of its children there
+    virtual FlatExpression::Index flattenWith(FlatExpression &flat, const FlatExpression::Index *childIndices) const = 0;
+
+    // Appends the instruction of the node to compiled code, after those of its children
+    virtual void compileWith(BytecodeCompiler &compiler) const = 0;
 
-using NodePtr = std::shared_ptr<Node>;
+    // The node simplified (see Simplifier), given its children simplified: itself if nothing changed
+    virtual NodePtr simplifyWith(const Simplifier &simplifier, const NodePtr *children, NodeArena &arena) = 0;
+
+    // Hash-consing (see NodeArena): a hash of the node's own fields and of its children
+    // pointers, and their equality with those of a node of the same type
+    virtual std::size_t shallowHash() const = 0;
+    virtual bool shallowEquals(const Node &other) const = 0;
+
+    // What the node is, read without a virtual call: the walks handle the most common
+    // kinds, numbers and binary operators, directly
+    inline FlatOpcode kind() const { return kind_; }
+
+    // Whether the node has children and several parents in its arena, so that it may be
+    // reached more than once in a walk: eval computes its value once per walk
+    inline bool shared() const { return parents_ > 1; }
+
+protected:
+    explicit Node(FlatOpcode kind) : kind_(kind), parents_(0) {}
+    ~Node() = default;
+
+private:
+    friend class NodeArena;
+
+    FlatOpcode kind_;
+    // Saturates at 2, which is all shared() needs
+    std::uint8_t parents_;
+};
 
 class NumberNode : public Node {
 public:
-    NumberNode(double n) : n_(n) {}
-    virtual ~NumberNode() {}
+    NumberNode(double n) : Node(FlatOpcode::NUMBER), n_(n) {}
 
-    virtual std::string toString(ToStringType toStringType) const override {
-        std::ostringstream oss;
-        oss << n_;
-        return oss.str();
+    inline double value() const { return n_; }
+
+    virtual void writePart(std::ostream &ostream, std::size_t part, ToStringType toStringType) const override {
+        ostream << n_;
     }
 
-    virtual NodePtr derivative(const std::string &argument) const override {
-        return NodePtr(new NumberNode(0));
+    virtual NodePtr derivativeWith(SymbolId argument, const NodePtr *childDerivatives, NodeArena &arena) const override {
+        return arena.make<NumberNode>(0);
     }
 
-    virtual double eval(EvaluationContext &context) override {
+    virtual double evalWith(EvaluationContext &context, const double *childValues) override {
         return n_;
     }
 
+    virtual NodePtr copyWith(const NodePtr *children, NodeArena &arena) const override {
+        return arena.make<NumberNode>(n_);
+    }
+
+    virtual FlatExpression::Index flattenWith(FlatExpression &flat, const FlatExpression::Index *childIndices) const override {
+        return flat.addNumber(n_);
+    }
+
+    virtual void compileWith(BytecodeCompiler &compiler) const override {
+        compiler.addNumber(n_);
+    }
+
+    virtual NodePtr simplifyWith(const Simplifier &simplifier, const NodePtr *children, NodeArena &arena) override {
+        return this;
+    }
+
+    // Numbers are compared bit for bit, so that 0 and -0 stay apart, and a NaN matches itself
+    virtual std::size_t shallowHash() const override {
+        return hashMix(0, bits());
+    }
+
+    virtual bool shallowEquals(const Node &other) const override {
+        return bits() == static_cast<const NumberNode &>(other).bits();
+    }
+
 private:
     double n_;
+
+    inline std::uint64_t bits() const {
+        std::uint64_t bits;
+        std::memcpy(&bits, &n_, sizeof(bits));
+        return bits;
+    }
 };
 
+// The operator is the kind of the node, so that evaluating is a switch on it rather than
+// an indirect call, and a node holds nothing besides its children and kind
 class BinaryOpNode : public Node {
 public:
-    using evalFunc = std::function<double(double, double)>;
-    using toStringFunc = std::function<std::string(std::string, std::string)>;
+    BinaryOpNode(NodePtr left, NodePtr right, FlatOpcode opcode)
+    : Node(opcode), left_(left), right_(right) {}
+
+    static inline bool isBinary(FlatOpcode kind) { return kind >= FlatOpcode::ADD; }
+
+    virtual std::size_t childCount() const override final { return 2; }
+    virtual NodePtr child(std::size_t index) const override final {
+        return index == 0 ? left_ : right_;
+    }
+
+    virtual void writePart(std::ostream &ostream, std::size_t part, ToStringType toStringType) const override final {
+        // (left symbol right), without the parenthesis at the top level
+        if (part == 1) {
+            ostream << ' ' << symbol() << ' ';
+        } else if (toStringType != ToStringType::TOP_LEVEL) {
+            ostream << (part == 0 ? '(' : ')');
+        }
+    }
+
+    virtual double evalWith(EvaluationContext &context, const double *childValues) override final {
+        return apply(kind(), childValues[0], childValues[1]);
+    }
+
+    virtual FlatExpression::Index flattenWith(FlatExpression &flat, const FlatExpression::Index *childIndices) const override final {
+        return flat.addBinary(kind(), childIndices[0], childIndices[1]);
+    }
+
+    virtual void compileWith(BytecodeCompiler &compiler) const override final {
+        compiler.addBinary(kind());
+    }
 
-    BinaryOpNode(NodePtr left, NodePtr right, toStringFunc toString, evalFunc eval)
-    : left_(left), right_(right), toString_(toString), eval_(eval) {}
-    virtual ~BinaryOpNode() {}
+    virtual NodePtr simplifyWith(const Simplifier &simplifier, const NodePtr *children, NodeArena &arena) override final {
+        return simplifier.binary(this, children[0], children[1], arena);
+    }
 
-    virtual std::string toString(ToStringType toStringType) const override {
-        std::string s = toString_(
-                left_->toString(ToStringType::RECURSIVE_CALL),
-                right_->toString(ToStringType::RECURSIVE_CALL));
-        return toStringType == ToStringType::TOP_LEVEL ? s : "(" + s + ")";
+    virtual std::size_t shallowHash() const override final {
+        std::size_t hash = hashMix(static_cast<std::size_t>(kind()), reinterpret_cast<std::uintptr_t>(left_));
+        return hashMix(hash, reinterpret_cast<std::uintptr_t>(right_));
     }
 
-    virtual double eval(EvaluationContext &context) override {
-        return eval_(left_->eval(context), right_->eval(context));
+    virtual bool shallowEquals(const Node &other) const override final {
+        const BinaryOpNode &binary = static_cast<const BinaryOpNode &>(other);
+        return left_ == binary.left_ && right_ == binary.right_;
+    }
+
+    inline NodePtr left() const { return left_; }
+    inline NodePtr right() const { return right_; }
+
+    static inline double apply(FlatOpcode opcode, double left, double right) {
+        switch (opcode) {
+            case FlatOpcode::ADD:
+                return left + right;
+            case FlatOpcode::SUBTRACT:
+                return left - right;
+            case FlatOpcode::MULTIPLY:
+                return left * right;
+            default:
+                assert(opcode == FlatOpcode::DIVIDE);
+                return left / right;
+        }
     }
 
 protected:
@@ -73,122 +219,202 @@ protected:
     NodePtr right_;
 
 private:
-    toStringFunc toString_;
-    evalFunc eval_;
+    inline char symbol() const {
+        switch (kind()) {
+            case FlatOpcode::ADD:
+                return '+';
+            case FlatOpcode::SUBTRACT:
+                return '-';
+            case FlatOpcode::MULTIPLY:
+                return '*';
+            default:
+                return '/';
+        }
+    }
 };
 
-class AdditionNode : public BinaryOpNode {
+class AdditionNode final : public BinaryOpNode {
 public:
     AdditionNode(NodePtr left, NodePtr right)
-    : BinaryOpNode(left, right,
-        [](std::string s1, std::string s2){return s1 + " + " + s2;},
-        [](double v1, double v2){return v1 + v2; }) {}
-    virtual ~AdditionNode() {}
+    : BinaryOpNode(left, right, FlatOpcode::ADD) {}
+
+    virtual NodePtr copyWith(const NodePtr *children, NodeArena &arena) const override {
+        return arena.make<AdditionNode>(children[0], children[1]);
+    }
 
-    virtual NodePtr derivative(const std::string &argument) const override {
-        return NodePtr(new AdditionNode(
-                left_->derivative(argument), right_->derivative(argument)));
+    virtual NodePtr derivativeWith(SymbolId argument, const NodePtr *childDerivatives, NodeArena &arena) const override {
+        return arena.make<AdditionNode>(childDerivatives[0], childDerivatives[1]);
     }
 };
 
-class SubtractionNode : public BinaryOpNode {
+class SubtractionNode final : public BinaryOpNode {
 public:
     SubtractionNode(NodePtr left, NodePtr right)
-            : BinaryOpNode(left, right,
-            [](std::string s1, std::string s2){return s1 + " - " + s2;},
-            [](double v1, double v2){return v1 - v2; }) {}
-    virtual ~SubtractionNode() {}
+            : BinaryOpNode(left, right, FlatOpcode::SUBTRACT) {}
 
-    virtual NodePtr derivative(const std::string &argument) const override {
-        return NodePtr(new SubtractionNode(
-                left_->derivative(argument), right_->derivative(argument)));
+    virtual NodePtr copyWith(const NodePtr *children, NodeArena &arena) const override {
+        return arena.make<SubtractionNode>(children[0], children[1]);
+    }
+
+    virtual NodePtr derivativeWith(SymbolId argument, const NodePtr *childDerivatives, NodeArena &arena) const override {
+        return arena.make<SubtractionNode>(childDerivatives[0], childDerivatives[1]);
     }
 };
 
-class MultiplicationNode : public BinaryOpNode {
+class MultiplicationNode final : public BinaryOpNode {
 public:
     MultiplicationNode(NodePtr left, NodePtr right)
-            : BinaryOpNode(left, right,
-            [](std::string s1, std::string s2){return s1 + " * " + s2;},
-            [](double v1, double v2){return v1 * v2; }) {}
-    virtual ~MultiplicationNode() {}
+            : BinaryOpNode(left, right, FlatOpcode::MULTIPLY) {}
+
+    virtual NodePtr copyWith(const NodePtr *children, NodeArena &arena) const override {
+        return arena.make<MultiplicationNode>(children[0], children[1]);
+    }
 
-    virtual NodePtr derivative(const std::string &argument) const override {
+    virtual NodePtr derivativeWith(SymbolId argument, const NodePtr *childDerivatives, NodeArena &arena) const override {
         // (f g)' = f' g + f g'
-        NodePtr f_g = NodePtr(new MultiplicationNode(left_->derivative(argument), right_));
-        NodePtr fg_ = NodePtr(new MultiplicationNode(left_, right_->derivative(argument)));
-        return NodePtr(new AdditionNode(f_g, fg_));
+        NodePtr f_g = arena.make<MultiplicationNode>(childDerivatives[0], right_);
+        NodePtr fg_ = arena.make<MultiplicationNode>(left_, childDerivatives[1]);
+        return arena.make<AdditionNode>(f_g, fg_);
     }
 };
 
-class DivisionNode : public BinaryOpNode {
+class DivisionNode final : public BinaryOpNode {
 public:
     DivisionNode(NodePtr left, NodePtr right)
-            : BinaryOpNode(left, right,
-            [](std::string s1, std::string s2){return s1 + " / " + s2;},
-            [](double v1, double v2){return v1 / v2; }) {}
-    virtual ~DivisionNode() {}
+            : BinaryOpNode(left, right, FlatOpcode::DIVIDE) {}
+
+    virtual NodePtr copyWith(const NodePtr *children, NodeArena &arena) const override {
+        return arena.make<DivisionNode>(children[0], children[1]);
+    }
 
-    virtual NodePtr derivative(const std::string &argument) const override {
+    virtual NodePtr derivativeWith(SymbolId argument, const NodePtr *childDerivatives, NodeArena &arena) const override {
         // (f / g)' = (f'g - fg') / g^2
-        NodePtr f_g = NodePtr(new MultiplicationNode(left_->derivative(argument), right_));
-        NodePtr fg_ = NodePtr(new MultiplicationNode(left_, right_->derivative(argument)));
-        NodePtr g2 = NodePtr(new MultiplicationNode(right_, right_));
-        NodePtr num = NodePtr(new SubtractionNode(f_g, fg_));
-        return NodePtr(new DivisionNode(num, g2));
+        NodePtr f_g = arena.make<MultiplicationNode>(childDerivatives[0], right_);
+        NodePtr fg_ = arena.make<MultiplicationNode>(left_, childDerivatives[1]);
+        NodePtr g2 = arena.make<MultiplicationNode>(right_, right_);
+        NodePtr num = arena.make<SubtractionNode>(f_g, fg_);
+        return arena.make<DivisionNode>(num, g2);
     }
 };
 
 class VariableNode : public Node {
 public:
-    VariableNode(const std::string &varName) : varName_(varName) {}
-    ~VariableNode() {};
+    VariableNode(SymbolId varName) : Node(FlatOpcode::VARIABLE), varName_(varName) {}
+    VariableNode(const std::string &varName) : VariableNode(intern(varName)) {}
 
-    virtual std::string toString(ToStringType toStringType) const override {
-        return varName_;
+    virtual void writePart(std::ostream &ostream, std::size_t part, ToStringType toStringType) const override {
+        ostream << symbolName(varName_);
     }
 
-    virtual double eval(EvaluationContext &context) override {
+    virtual double evalWith(EvaluationContext &context, const double *childValues) override {
         return context.getVariableValue(varName_);
     }
 
-    virtual NodePtr derivative(const std::string &argument) const override {
+    virtual FlatExpression::Index flattenWith(FlatExpression &flat, const FlatExpression::Index *childIndices) const override {
+        return flat.addVariable(varName_);
+    }
+
+    virtual void compileWith(BytecodeCompiler &compiler) const override {
+        compiler.addVariable(varName_);
+    }
+
+    virtual NodePtr simplifyWith(const Simplifier &simplifier, const NodePtr *children, NodeArena &arena) override {
+        const double *value = simplifier.constant(varName_);
+        if (value != nullptr) {
+            return arena.make<NumberNode>(*value);
+        }
+        return this;
+    }
+
+    virtual std::size_t shallowHash() const override {
+        return hashMix(1, varName_);
+    }
+
+    virtual bool shallowEquals(const Node &other) const override {
+        return varName_ == static_cast<const VariableNode &>(other).varName_;
+    }
+
+    virtual NodePtr derivativeWith(SymbolId argument, const NodePtr *childDerivatives, NodeArena &arena) const override {
         if (varName_ == argument) {
-            return NodePtr(new NumberNode(1));
+            return arena.make<NumberNode>(1);
         } else {
-            return NodePtr(new NumberNode(0));
+            return arena.make<NumberNode>(0);
         }
     }
 
+    virtual NodePtr copyWith(const NodePtr *children, NodeArena &arena) const override {
+        return arena.make<VariableNode>(varName_);
+    }
+
 private:
-    std::string varName_;
+    SymbolId varName_;
 };
 
 class FunctionCallNode : public Node {
 public:
+    FunctionCallNode(SymbolId funcName, NodePtr argumentExpression)
+            : Node(FlatOpcode::CALL), funcName_(funcName), argumentExpression_(argumentExpression) {}
     FunctionCallNode(const std::string &funcName, NodePtr argumentExpression)
-            : funcName_(funcName), argumentExpression_(argumentExpression) {}
-    ~FunctionCallNode() {};
+            : FunctionCallNode(intern(funcName), argumentExpression) {}
+
+    virtual std::size_t childCount() const override { return 1; }
+    virtual NodePtr child(std::size_t index) const override { return argumentExpression_; }
+
+    virtual void writePart(std::ostream &ostream, std::size_t part, ToStringType toStringType) const override {
+        // (name argument), without the parenthesis at the top level
+        bool parenthesis = toStringType != ToStringType::TOP_LEVEL;
+        if (part == 0) {
+            ostream << (parenthesis ? "(" : "") << symbolName(funcName_) << ' ';
+        } else if (parenthesis) {
+            ostream << ')';
+        }
+    }
+
+    virtual double evalWith(EvaluationContext &context, const double *childValues) override {
+        return context.callFunction(funcName_, childValues[0]);
+    }
+
+    virtual FlatExpression::Index flattenWith(FlatExpression &flat, const FlatExpression::Index *childIndices) const override {
+        return flat.addCall(funcName_, childIndices[0]);
+    }
 
-    virtual std::string toString(ToStringType toStringType) const override {
-        std::string call = funcName_ + " " + argumentExpression_->toString(ToStringType::RECURSIVE_CALL);
-        return toStringType == ToStringType::TOP_LEVEL ? call : "(" + call + ")";
+    virtual void compileWith(BytecodeCompiler &compiler) const override {
+        compiler.addCall(funcName_);
     }
 
-    virtual double eval(EvaluationContext &context) override {
-        double arg = argumentExpression_->eval(context);
-        return context.callFunction(funcName_, arg);
+    virtual NodePtr simplifyWith(const Simplifier &simplifier, const NodePtr *children, NodeArena &arena) override {
+        // A builtin is pure, so its value on a number is known now
+        builtinFunction builtin = simplifier.foldableBuiltin(funcName_);
+        if (builtin != nullptr && children[0]->kind() == FlatOpcode::NUMBER) {
+            return arena.make<NumberNode>(builtin(static_cast<NumberNode *>(children[0])->value()));
+        }
+        if (children[0] == argumentExpression_) {
+            return this;
+        }
+        return arena.make<FunctionCallNode>(funcName_, children[0]);
     }
 
-    virtual NodePtr derivative(const std::string &argument) const override {
+    virtual std::size_t shallowHash() const override {
+        return hashMix(hashMix(2, funcName_), reinterpret_cast<std::uintptr_t>(argumentExpression_));
+    }
+
+    virtual bool shallowEquals(const Node &other) const override {
+        const FunctionCallNode &call = static_cast<const FunctionCallNode &>(other);
+        return funcName_ == call.funcName_ && argumentExpression_ == call.argumentExpression_;
+    }
+
+    virtual NodePtr derivativeWith(SymbolId argument, const NodePtr *childDerivatives, NodeArena &arena) const override {
         // f(g)' = f'(g) g'
-        NodePtr f_g = NodePtr(new FunctionCallNode(funcName_ + "'", argumentExpression_));
-        NodePtr g_ = argumentExpression_->derivative(argument);
-        return NodePtr(new MultiplicationNode(f_g, g_));
+        NodePtr f_g = arena.make<FunctionCallNode>(symbolName(funcName_) + "'", argumentExpression_);
+        return arena.make<MultiplicationNode>(f_g, childDerivatives[0]);
+    }
+
+    virtual NodePtr copyWith(const NodePtr *children, NodeArena &arena) const override {
+        return arena.make<FunctionCallNode>(funcName_, children[0]);
     }
 
 private:
-    std::string funcName_;
+    SymbolId funcName_;
     NodePtr argumentExpression_;
 };
 
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cassert>
+#include <typeinfo>
+
+#include "nodeArena.h"
+#include "node.h"
+
+NodeArena::~NodeArena()
+{
+    for (char *block : blocks_) {
+        delete[] block;
+    }
+}
+
+void NodeArena::reset()
+{
+    // A table grown by a large statement is dropped, so that clearing it does not
+    // cost every following small statement
+    if (interned_.size() > FIRST_TABLE_SIZE * 64) {
+        std::vector<Node *>().swap(interned_);
+    } else {
+        std::fill(interned_.begin(), interned_.end(), nullptr);
+    }
+    internedCount_ = 0;
+
+    if (blocks_.empty()) {
+        return;
+    }
+    char *last = blocks_.back();
+    for (std::size_t i = 0; i + 1 < blocks_.size(); ++i) {
+        delete[] blocks_[i];
+    }
+    blocks_.assign(1, last);
+
+    // The current block is always the last one, so end_ is still its end
+    cursor_ = last;
+}
+
+void NodeArena::swap(NodeArena &other)
+{
+    std::swap(blocks_, other.blocks_);
+    std::swap(cursor_, other.cursor_);
+    std::swap(end_, other.end_);
+    std::swap(nextBlockSize_, other.nextBlockSize_);
+    std::swap(interned_, other.interned_);
+    std::swap(internedCount_, other.internedCount_);
+}
+
+void *NodeArena::allocateInNewBlock(std::size_t size)
+{
+    assert(size <= FIRST_BLOCK_SIZE);
+
+    // new[] memory is aligned for any fundamental type, which covers all the nodes
+    std::size_t blockSize = nextBlockSize_;
+    char *block = new char[blockSize];
+    blocks_.push_back(block);
+    cursor_ = block + size;
+    end_ = block + blockSize;
+    if (nextBlockSize_ < MAX_BLOCK_SIZE) {
+        nextBlockSize_ *= 2;
+    }
+    return block;
+}
+
+Node *NodeArena::intern(Node *node)
+{
+    if ((internedCount_ + 1) * 2 > interned_.size()) {
+        growTable();
+    }
+
+    std::size_t mask = interned_.size() - 1;
+    for (std::size_t i = node->shallowHash() & mask; ; i = (i + 1) & mask) {
+        Node *candidate = interned_[i];
+        if (candidate == nullptr) {
+            interned_[i] = node;
+            ++internedCount_;
+            countParents(node);
+            return node;
+        }
+        if (typeid(*candidate) == typeid(*node) && candidate->shallowEquals(*node)) {
+            return candidate;
+        }
+    }
+}
+
+void NodeArena::countParents(Node *node)
+{
+    // Each child gains the node as a parent, since a node is made once. Leaves are never
+    // counted: they cost no more to evaluate again than to look up.
+    for (std::size_t i = 0; i < node->childCount(); ++i) {
+        Node *child = node->child(i);
+        if (child->childCount() > 0 && child->parents_ < 2) {
+            ++child->parents_;
+        }
+    }
+}
+
+void NodeArena::growTable()
+{
+    std::vector<Node *> old;
+    old.swap(interned_);
+    interned_.assign(old.empty() ? FIRST_TABLE_SIZE : old.size() * 2, nullptr);
+
+    std::size_t mask = interned_.size() - 1;
+    for (Node *node : old) {
+        if (node != nullptr) {
+            std::size_t i = node->shallowHash() & mask;
+            while (interned_[i] != nullptr) {
+                i = (i + 1) & mask;
+            }
+            interned_[i] = node;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class Node;
+
+// Bump allocator for nodes. Nodes are never freed one by one: the whole arena is
+// freed at once, without running destructors, so nodes must not own anything.
+//
+// Nodes are also hash-consed: making a node structurally equal to one already in the
+// arena returns that one, so the nodes of an arena form a maximally shared DAG and two
+// of its nodes are structurally equal exactly when they are the same pointer. The
+// arena counts the parents of each node, to find those shared (see Node::shared).
+class NodeArena
+{
+public:
+    // Blocks double in size from the first to the last, so that small arenas stay small
+    static const std::size_t FIRST_BLOCK_SIZE = 1024;
+    static const std::size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+    NodeArena() : cursor_(nullptr), end_(nullptr), nextBlockSize_(FIRST_BLOCK_SIZE), internedCount_(0) {}
+    ~NodeArena();
+
+    NodeArena(const NodeArena &) = delete;
+    NodeArena &operator =(const NodeArena &) = delete;
+
+    template <typename T, typename... Args>
+    T *make(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        char *mark = cursor_;
+        std::size_t blockCount = blocks_.size();
+        T *node = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+
+        Node *existing = intern(node);
+        if (existing != node) {
+            // Take the allocation back, unless it started a new block
+            if (blocks_.size() == blockCount) {
+                cursor_ = mark;
+            }
+            return static_cast<T *>(existing);
+        }
+        return node;
+    }
+
+    // Frees everything allocated so far. The last, largest, block is kept, so that an
+    // arena reused for statements of about the same size does not allocate at all.
+    void reset();
+
+    // Exchanges the nodes of the two arenas, e.g. to replace one with a compacted copy
+    void swap(NodeArena &other);
+
+    // Blocks currently held, i.e. heap allocations made since the last reset
+    inline std::size_t blockCount() const { return blocks_.size(); }
+
+    // Distinct nodes made since the last reset
+    inline std::size_t nodeCount() const { return internedCount_; }
+
+private:
+    std::vector<char *> blocks_;
+    char *cursor_;
+    char *end_;
+    std::size_t nextBlockSize_;
+
+    // Open addressing hash table of the nodes, by structure
+    static const std::size_t FIRST_TABLE_SIZE = 256;
+    std::vector<Node *> interned_;
+    std::size_t internedCount_;
+
+    // Returns the node structurally equal to the given one, adding it if there is none
+    Node *intern(Node *node);
+    void countParents(Node *node);
+    void growTable();
+
+    inline void *allocate(std::size_t size, std::size_t alignment)
+    {
+        std::uintptr_t address = (reinterpret_cast<std::uintptr_t>(cursor_) + alignment - 1) & ~(alignment - 1);
+        char *aligned = reinterpret_cast<char *>(address);
+        if (cursor_ == nullptr || aligned + size > end_) {
+            return allocateInNewBlock(size);
+        }
+        cursor_ = aligned + size;
+        return aligned;
+    }
+
+    void *allocateInNewBlock(std::size_t size);
+};
+
+#endif
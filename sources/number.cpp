@@ -0,0 +1,221 @@
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <locale>
+#include <sstream>
+#include <string>
+
+#include "number.h"
+#include "charClass.h"
+#include "powersOfFive.h"
+
+namespace {
+
+// The powers of ten that a double represents exactly
+const double exactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+const int MAX_EXACT_POWER_OF_TEN = 22;
+
+// Integers up to 2^53 are exactly representable
+const std::uint64_t MAX_EXACT_MANTISSA = std::uint64_t(1) << 53;
+
+// A uint64_t holds any 19 digits number
+const int MAX_MANTISSA_DIGITS = 19;
+
+// Exponents beyond this over- or underflow anyway; clamping them avoids int overflow
+const int MAX_EXPONENT = 100000;
+
+// Full 64x64 -> 128 bits multiplication
+struct Product128 {
+    std::uint64_t high;
+    std::uint64_t low;
+};
+
+inline Product128 multiply(std::uint64_t a, std::uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    return {static_cast<std::uint64_t>(product >> 64), static_cast<std::uint64_t>(product)};
+#else
+    // Schoolbook multiplication of the 32 bits halves, for compilers without a 128 bits type
+    const std::uint64_t LOW_HALF = 0xFFFFFFFF;
+    std::uint64_t lowLow = (a & LOW_HALF) * (b & LOW_HALF);
+    std::uint64_t highLow = (a >> 32) * (b & LOW_HALF);
+    std::uint64_t lowHigh = (a & LOW_HALF) * (b >> 32);
+    std::uint64_t highHigh = (a >> 32) * (b >> 32);
+    std::uint64_t middle = (lowLow >> 32) + (highLow & LOW_HALF) + (lowHigh & LOW_HALF);
+    return {highHigh + (highLow >> 32) + (lowHigh >> 32) + (middle >> 32), (middle << 32) | (lowLow & LOW_HALF)};
+#endif
+}
+
+inline double doubleFromBits(std::uint64_t bits)
+{
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+const int MANTISSA_EXPLICIT_BITS = 52;
+const int MINIMUM_EXPONENT = -1023;
+const int INFINITE_POWER = 0x7FF;
+
+// The Eisel-Lemire algorithm: the correctly rounded double nearest to w * 10^q, obtained
+// from a 128-bit approximation of 5^q (see "Number Parsing at a Gigabyte per Second",
+// D. Lemire, 2021). Works for any w fitting 64 bits.
+double eiselLemire(std::uint64_t w, int q)
+{
+    if (w == 0 || q < SMALLEST_POWER_OF_FIVE) {
+        return 0;
+    }
+    if (q > LARGEST_POWER_OF_FIVE) {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    int leadingZeros = __builtin_clzll(w);
+    w <<= leadingZeros;
+
+    // Multiply by the high half of 5^q; the low half is only needed when the product
+    // might be just below a carry into the bits we keep
+    const int index = 2 * (q - SMALLEST_POWER_OF_FIVE);
+    const std::uint64_t precisionMask = 0xFFFFFFFFFFFFFFFFULL >> (MANTISSA_EXPLICIT_BITS + 3);
+    Product128 product = multiply(w, powersOfFive128[index]);
+    if ((product.high & precisionMask) == precisionMask) {
+        Product128 lowProduct = multiply(w, powersOfFive128[index + 1]);
+        product.low += lowProduct.high;
+        if (lowProduct.high > product.low) {
+            product.high++;
+        }
+    }
+
+    // Keep 54 bits, then round to 53
+    int upperBit = static_cast<int>(product.high >> 63);
+    int shift = upperBit + 64 - MANTISSA_EXPLICIT_BITS - 3;
+    std::uint64_t mantissa = product.high >> shift;
+    // log2(10^q) = q * log2(10), with log2(10) approximated as (152170 + 65536) / 65536
+    int power2 = (((152170 + 65536) * q) >> 16) + 63 + upperBit - leadingZeros - MINIMUM_EXPONENT;
+
+    if (power2 <= 0) {
+        // Subnormal
+        if (-power2 + 1 >= 64) {
+            return 0;
+        }
+        mantissa >>= -power2 + 1;
+        mantissa += mantissa & 1;
+        mantissa >>= 1;
+        power2 = mantissa < (std::uint64_t(1) << MANTISSA_EXPLICIT_BITS) ? 0 : 1;
+        return doubleFromBits((static_cast<std::uint64_t>(power2) << MANTISSA_EXPLICIT_BITS)
+                | (mantissa & ((std::uint64_t(1) << MANTISSA_EXPLICIT_BITS) - 1)));
+    }
+
+    // Exactly half-way between two doubles: round to even. This can only happen
+    // for the small exponents where 5^q is exact.
+    if (product.low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1
+            && (mantissa << shift) == product.high) {
+        mantissa &= ~std::uint64_t(1);
+    }
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (std::uint64_t(2) << MANTISSA_EXPLICIT_BITS)) {
+        mantissa = std::uint64_t(1) << MANTISSA_EXPLICIT_BITS;
+        power2++;
+    }
+    mantissa &= ~(std::uint64_t(1) << MANTISSA_EXPLICIT_BITS);
+    if (power2 >= INFINITE_POWER) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return doubleFromBits((static_cast<std::uint64_t>(power2) << MANTISSA_EXPLICIT_BITS) | mantissa);
+}
+
+// The slow path: a correctly rounded conversion under the classic locale
+double parseSlowly(const char *begin, const char *end)
+{
+    std::istringstream input(std::string(begin, end));
+    input.imbue(std::locale::classic());
+    double value = 0;
+    input >> value;
+    if (input.fail()) {
+        // Out of range: the stream does not set the value to infinity
+        return std::numeric_limits<double>::infinity();
+    }
+    return value;
+}
+
+}
+
+double parseNumberLiteral(const char *begin, const char *end)
+{
+    // Collect the first significant digits in an integer mantissa,
+    // keeping track of the power of ten it has to be scaled by
+    std::uint64_t mantissa = 0;
+    int significantDigits = 0;
+    int exponent = 0;
+    bool truncated = false;
+
+    const char *p = begin;
+    for (; p != end && isDigit(*p); ++p) {
+        if (significantDigits < MAX_MANTISSA_DIGITS) {
+            mantissa = mantissa * 10 + (*p - '0');
+            significantDigits += mantissa != 0;
+        } else {
+            ++exponent;
+            truncated = truncated || *p != '0';
+        }
+    }
+    if (p != end && *p == '.') {
+        for (++p; p != end && isDigit(*p); ++p) {
+            if (significantDigits < MAX_MANTISSA_DIGITS) {
+                mantissa = mantissa * 10 + (*p - '0');
+                significantDigits += mantissa != 0;
+                --exponent;
+            } else {
+                truncated = truncated || *p != '0';
+            }
+        }
+    }
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negative = p != end && *p == '-';
+        if (p != end && (*p == '-' || *p == '+')) {
+            ++p;
+        }
+        int explicitExponent = 0;
+        for (; p != end && isDigit(*p); ++p) {
+            if (explicitExponent < MAX_EXPONENT) {
+                explicitExponent = explicitExponent * 10 + (*p - '0');
+            }
+        }
+        exponent += negative ? -explicitExponent : explicitExponent;
+    }
+
+    if (mantissa == 0) {
+        return 0;
+    }
+
+    // Clinger's fast path: when both the mantissa and the power of ten are exact doubles,
+    // a single multiplication or division is correctly rounded.
+    if (!truncated && mantissa <= MAX_EXACT_MANTISSA) {
+        double value = static_cast<double>(mantissa);
+        if (exponent >= 0 && exponent <= MAX_EXACT_POWER_OF_TEN) {
+            return value * exactPowersOfTen[exponent];
+        }
+        if (exponent < 0 && exponent >= -MAX_EXACT_POWER_OF_TEN) {
+            return value / exactPowersOfTen[-exponent];
+        }
+    }
+
+    if (!truncated) {
+        return eiselLemire(mantissa, exponent);
+    }
+
+    // The literal had more than 19 significant digits: the value lies between
+    // mantissa and mantissa + 1 (times 10^exponent). If both round the same way, that's it.
+    double lower = eiselLemire(mantissa, exponent);
+    if (lower == eiselLemire(mantissa + 1, exponent)) {
+        return lower;
+    }
+
+    return parseSlowly(begin, end);
+}
@@ -0,0 +1,9 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+// Converts a numeric literal already validated by the lexer, in the form
+// digits [ '.' digits ] [ ('e' | 'E') [ '+' | '-' ] digits ], to the nearest double.
+// It does not depend on the locale, and the text does not need to be NUL-terminated.
+double parseNumberLiteral(const char *begin, const char *end);
+
+#endif
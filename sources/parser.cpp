@@ -1,259 +1,437 @@
-#include <cstdlib>
 #include <iostream>
+#include <vector>
 
 #include "parser.h"
+#include "exceptions.h"
+
+template <typename OperatorNode>
+static NodePtr makeBinaryNode(NodeArena &arena, NodePtr left, NodePtr right)
+{
+    return arena.make<OperatorNode>(left, right);
+}
+
+// How a token subtype parses as a binary operator
+struct BinaryOperator {
+    int precedence;
+    NodePtr (*make)(NodeArena &arena, NodePtr left, NodePtr right);
+};
+
+// Binary operators by token subtype. Tokens that are not binary operators,
+// including all the tokens without a subtype, have precedence 0.
+static const BinaryOperator binaryOperators[] = {
+    {0, nullptr},                                   // NONE
+    {1, makeBinaryNode<AdditionNode>},              // PLUS
+    {1, makeBinaryNode<SubtractionNode>},           // MINUS
+    {2, makeBinaryNode<MultiplicationNode>},        // STAR
+    {2, makeBinaryNode<DivisionNode>},              // SLASH
+    {0, nullptr},                                   // OPEN_PARENTHESIS
+    {0, nullptr},                                   // CLOSED_PARENTHESIS
+    {0, nullptr},                                   // ASSIGN
+    {0, nullptr},                                   // DEF
+    {0, nullptr},                                   // DER
+    {0, nullptr},                                   // INVALID_CHARACTER
+    {0, nullptr}                                    // INVALID_NEWLINE
+};
+static_assert(sizeof(binaryOperators) / sizeof(binaryOperators[0])
+              == static_cast<std::size_t>(TokenSubType::INVALID_NEWLINE) + 1,
+              "binaryOperators must have an entry per token subtype");
+
+// A binary operator waiting for its right operand, or an open parenthesis waiting to be
+// closed: that of a function call or that of a group
+struct PendingOperator {
+    const BinaryOperator *binaryOperator;
+    bool isCall;
+    SymbolId function;
+};
+
+// Builds the nodes of the pending binary operators binding at least as tightly as minPrecedence,
+// down to the innermost open parenthesis
+static void reduceOperators(std::vector<NodePtr> &operands, std::vector<PendingOperator> &operators, int minPrecedence,
+                            NodeArena &arena)
+{
+    while (!operators.empty() && operators.back().binaryOperator != nullptr
+           && operators.back().binaryOperator->precedence >= minPrecedence) {
+        NodePtr right = operands.back();
+        operands.pop_back();
+        operands.back() = operators.back().binaryOperator->make(arena, operands.back(), right);
+        operators.pop_back();
+    }
+}
 
 Parser::Parser(std::istream& istream, std::ostream &ostream)
-    :lexer_(istream), ostream_(ostream)
+    :ostream_(ostream), lexer_(istream), position_(0),
+     line_(1), lineStart_(0), statementOffset_(0), statementLine_(1), statementLineStart_(0)
+{
+}
+
+Parser::Parser(const char *begin, const char *end, std::ostream &ostream)
+    :ostream_(ostream), lexer_(begin, end), position_(0),
+     line_(1), lineStart_(0), statementOffset_(0), statementLine_(1), statementLineStart_(0)
 {
-    // Fetch look-ahead tokens
-    for (int i = 0; i < NUM_LOOK_AEAHD_TOKENS; ++i) {
-        if (lexer_.hasNextToken()) {
-            nextTokens_[i] = lexer_.nextToken();
+}
+
+Parser::Parser(int fd, std::ostream &ostream)
+    :ostream_(ostream), lexer_(fd), position_(0),
+     line_(1), lineStart_(0), statementOffset_(0), statementLine_(1), statementLineStart_(0)
+{
+}
+
+bool Parser::fetchTokens(std::size_t lookAhead)
+{
+    while (position_ + lookAhead >= tokens_.size()) {
+        if (!lexer_.hasNextToken()) {
+            return false;
         }
+
+        // Drop the tokens already consumed before lexing the next line
+        tokens_.discard(position_);
+        position_ = 0;
+        lexer_.tokenizeLine(tokens_);
     }
+    return true;
+}
+
+std::size_t Parser::nextTokenOffset()
+{
+    return fetchTokens(0) ? tokens_.offsetAt(position_) : lexer_.lastTokenOffset();
 }
 
-void Parser::advance()
+void Parser::fail(const std::string &reason)
 {
-    // Shift tokens one position back
-    for (int i = 0; i < NUM_LOOK_AEAHD_TOKENS - 1; ++i) {
-        nextTokens_[i] = nextTokens_[i + 1];
+    // Only the first error is kept
+    if (!status_.ok()) {
+        return;
     }
 
-    // Set last available token
-    nextTokens_[NUM_LOOK_AEAHD_TOKENS - 1] =
-            lexer_.hasNextToken()
-                ? lexer_.nextToken()
-                : Token{TokenType::END_OF_INPUT, ""};
+    // An unexpected ERROR token is reported as what the lexer found wrong with it
+    std::size_t offset = nextTokenOffset();
+    if (getNextTokenType() == TokenType::ERROR) {
+        status_ = Lexer::errorStatus(getNextToken(), offset);
+    } else {
+        status_ = Status(ErrorCode::INVALID_INPUT, reason, offset);
+    }
 }
 
-void Parser::match(TokenType tokenType, std::string content, std::string expected) {
-    if (!hasNextToken()
-            || getNextToken().getTokenType() != tokenType
-            || getNextToken().getContent() != content) {
-        throw InvalidInputException("Expected " + expected + " but found token: " + getNextToken().getContent());
+bool Parser::match(TokenSubType subType, const char *expected) {
+    if (!nextTokenIs(subType)) {
+        fail(std::string("Expected ") + expected + " but found token: " + getNextToken().getContent());
+        return false;
     }
     advance();
+    return true;
+}
+
+bool Parser::evaluate(NodePtr node, double &value)
+{
+    EvaluationContext evaluationContext(userDefinedFunctions_, variables_);
+    node = simplifier_.simplify(node, statementArena_);
+    value = virtualMachine_.run(Bytecode::compile(node, userDefinedFunctions_), evaluationContext);
+
+    // Evaluation errors are reported at the start of the statement
+    if (!evaluationContext.status().ok()) {
+        if (status_.ok()) {
+            const Status &error = evaluationContext.status();
+            status_ = Status(error.code(), error.detail(), statementOffset_);
+        }
+        return false;
+    }
+    return true;
+}
+
+bool Parser::nextStatement()
+{
+    skipNewLines();
+    if (!hasNextToken()) {
+        return false;
+    }
+    statementArena_.reset();
+    statementOffset_ = nextTokenOffset();
+    statementLine_ = line_;
+    statementLineStart_ = lineStart_;
+    return true;
+}
+
+bool Parser::runStatement()
+{
+    // Assignment? Each statement is parsed up to its newline before it runs,
+    // so that a bad line has no effect. def and der only start a definition or a
+    // derivative when a name follows them: otherwise they are names themselves.
+    if (getNextTokenType() == TokenType::IDENTIFIER && nextTokenIs(TokenSubType::ASSIGN, 1)) {
+        return parseAssignment();
+    } else if (nextTokenIs(TokenSubType::DEF) && getNextTokenType(1) == TokenType::IDENTIFIER) {
+        return parseFunctionDefinition();
+    } else if (nextTokenIs(TokenSubType::DER) && getNextTokenType(1) == TokenType::IDENTIFIER) {
+        return parseDerivative();
+    } else {
+        return parseExpression();
+    }
+}
+
+void Parser::skipRestOfStatement()
+{
+    // Statements end with their line: resynchronize after the next END_OF_LINE,
+    // unless the failed statement already consumed it
+    if (line_ != statementLine_) {
+        return;
+    }
+    while (hasNextToken() && getNextTokenType() != TokenType::END_OF_LINE) {
+        advance();
+    }
+    if (hasNextToken()) {
+        consumeEndOfLine();
+    }
+}
+
+Status Parser::run()
+{
+    while (status_.ok() && nextStatement()) {
+        runStatement();
+    }
+    return status_;
 }
 
 void Parser::parseProgram()
 {
-    while (hasNextToken()) {
-        skipNewLines();
-
-        // Assignment?
-        if (hasNextTokens(2)
-                && getNextToken().getTokenType() == TokenType::IDENTIFIER
-                && getNextToken(1).getTokenType() == TokenType::OPERATOR
-                && getNextToken(1).getContent() == "=") {
-            parseAssignment();
-        } else if (hasNextTokens(2)
-                && getNextToken().getTokenType() == TokenType::IDENTIFIER
-                && getNextToken().getContent() == "def"
-                && getNextToken(1).getTokenType() == TokenType::IDENTIFIER) {
-            parseFunctionDefinition();
-        } else if (hasNextTokens(2)
-                && getNextToken().getTokenType() == TokenType::IDENTIFIER
-                && getNextToken().getContent() == "der"
-                && getNextToken(1).getTokenType() == TokenType::IDENTIFIER) {
-            parseDerivative();
-        } else {
-            parseExpression();
+    throwIfFailed(run());
+}
+
+std::vector<StatementError> Parser::runBatch()
+{
+    std::vector<StatementError> errors;
+    while (nextStatement()) {
+        if (!runStatement()) {
+            // All errors are found within their statement, which is on a single line
+            errors.push_back(StatementError {status_, statementLine_, status_.offset() - statementLineStart_ + 1});
+            skipRestOfStatement();
+            status_ = Status();
         }
-        parseNewLine();
     }
+    return errors;
 }
 
-void Parser::parseAssignment()
+bool Parser::parseAssignment()
 {
     // Match variable name
-    if (!hasNextToken() || getNextToken().getTokenType() != TokenType::IDENTIFIER) {
-        throw InvalidInputException("Found an unexpected token: " + getNextToken().getContent());
+    if (getNextTokenType() != TokenType::IDENTIFIER) {
+        fail("Found an unexpected token: " + getNextToken().getContent());
+        return false;
     }
-    std::string variableName = getNextToken().getContent();
+    SymbolId variableName = tokens_.symbolAt(position_);
     advance();
 
     // Match =
-    match(TokenType::OPERATOR, "=", "the assigment operator =");
+    if (!match(TokenSubType::ASSIGN, "the assigment operator =")) {
+        return false;
+    }
 
     // Get the expression as a node, evaluate it and save the variable value
-    NodePtr node = getNextExpressionNode();
-    variables_[variableName] = evalNode(node);
+    NodePtr node = parseExpressionNode(statementArena_);
+    double value;
+    if (!node || !parseNewLine() || !evaluate(node, value)) {
+        return false;
+    }
+    variables_.set(variableName, value);
+    return true;
 };
 
-void Parser::parseFunctionDefinition()
+bool Parser::parseFunctionDefinition()
 {
-    match(TokenType::IDENTIFIER, "def", "the keyword def");
+    if (!match(TokenSubType::DEF, "the keyword def")) {
+        return false;
+    }
 
     // Match function name
-    if (!hasNextToken() || getNextToken().getTokenType() != TokenType::IDENTIFIER) {
-        throw InvalidInputException("Found an unexpected token: " + getNextToken().getContent());
+    if (getNextTokenType() != TokenType::IDENTIFIER) {
+        fail("Found an unexpected token: " + getNextToken().getContent());
+        return false;
     }
-    std::string functionName = getNextToken().getContent();
+    SymbolId functionName = tokens_.symbolAt(position_);
     advance();
 
     // Match parameter name
-    if (!hasNextToken() || getNextToken().getTokenType() != TokenType::IDENTIFIER) {
-        throw InvalidInputException("Found an unexpected token: " + getNextToken().getContent());
+    if (getNextTokenType() != TokenType::IDENTIFIER) {
+        fail("Found an unexpected token: " + getNextToken().getContent());
+        return false;
     }
-    std::string parameterName = getNextToken().getContent();
+    SymbolId parameterName = tokens_.symbolAt(position_);
     advance();
 
-    match(TokenType::OPERATOR, "=", "the = operator");
+    if (!match(TokenSubType::ASSIGN, "the = operator")) {
+        return false;
+    }
 
     // Match function definition
-    NodePtr definition = getNextExpressionNode();
+    NodePtr definition = parseExpressionNode(statementArena_);
+    if (!definition || !parseNewLine()) {
+        return false;
+    }
 
+    // A body may be called where any name is shadowed and after any builtin is redefined,
+    // so only its arithmetic folds. Only the simplified body outlives the statement.
+    definition = Simplifier(Simplification::EXACT, nullptr).simplify(definition, statementArena_);
+    definition = definition->copy(functionArena_);
     UserFunctionPtr newFunctionDefinition = UserFunctionPtr(new UserFunction {functionName, parameterName, definition});
-    userDefinedFunctions_[functionName] = newFunctionDefinition;
+    userDefinedFunctions_.set(functionName, newFunctionDefinition);
+    if (functionArena_.nodeCount() > 2 * compactedFunctionNodes_ + MIN_COMPACTED_FUNCTION_NODES) {
+        compactFunctionArena();
+    }
+    return true;
 }
 
-void Parser::parseDerivative()
+void Parser::compactFunctionArena()
 {
-    match(TokenType::IDENTIFIER, "der", "the keyword der");
+    // The bodies are copied to a fresh arena and moved in place, so that the definitions
+    // stay the same objects
+    NodeArena compacted;
+    userDefinedFunctions_.forEach([&](SymbolId, const UserFunctionPtr &function) {
+        function->bodyNode = function->bodyNode->copy(compacted);
+    });
+    functionArena_.swap(compacted);
+    compactedFunctionNodes_ = functionArena_.nodeCount();
+}
+
+bool Parser::parseDerivative()
+{
+    if (!match(TokenSubType::DER, "the keyword der")) {
+        return false;
+    }
 
     // Match function name
-    if (!hasNextToken() || getNextToken().getTokenType() != TokenType::IDENTIFIER) {
-        throw InvalidInputException("Found an unexpected token: " + getNextToken().getContent());
+    if (getNextTokenType() != TokenType::IDENTIFIER) {
+        fail("Found an unexpected token: " + getNextToken().getContent());
+        return false;
     }
-    std::string functionName = getNextToken().getContent();
+    SymbolId functionName = tokens_.symbolAt(position_);
     advance();
+    if (!parseNewLine()) {
+        return false;
+    }
 
     // Find the function
-    auto it = userDefinedFunctions_.find(functionName);
-    if (it == userDefinedFunctions_.end()) {
-        throw UnknownFunctionName(functionName);
+    const UserFunctionPtr *it = userDefinedFunctions_.find(functionName);
+    if (it == nullptr) {
+        status_ = Status(ErrorCode::UNKNOWN_FUNCTION, symbolName(functionName), statementOffset_);
+        return false;
     }
-    UserFunctionPtr func = it->second;
+    UserFunctionPtr func = *it;
 
     // Derive and print it
-    NodePtr derivative = func->derivative();
+    NodePtr derivative = func->derivative(statementArena_);
     ostream_ << derivative->toString(ToStringType::TOP_LEVEL) << std::endl;
+    return true;
 }
 
-void Parser::parseExpression()
+bool Parser::parseExpression()
 {
-    NodePtr node = getNextExpressionNode();
-    ostream_ << evalNode(node) << std::endl;
+    NodePtr node = parseExpressionNode(statementArena_);
+    double value;
+    if (!node || !parseNewLine() || !evaluate(node, value)) {
+        return false;
+    }
+    ostream_ << value << std::endl;
+    return true;
 }
 
 NodePtr Parser::getNextExpressionNode()
 {
-    // First handle multiplication and parenthesis
-    NodePtr node = evalNextTerm();
-
-    // Next handle additions and subtractions. They have lower precedences, so they are handled AFTER.
-    while (hasNextToken() && getNextToken().getTokenType() == TokenType::OPERATOR) {
-        if (getNextToken().getContent() == "+") {
-            advance();
-            node = NodePtr(new AdditionNode(node, evalNextTerm()));
-        } else if (getNextToken().getContent() == "-") {
-            advance();
-            node = NodePtr(new SubtractionNode(node, evalNextTerm()));
-        } else {
-            // An operator, but not '+' or '-': let the caller handle it.
-            break;
-        }
-    }
-
+    NodePtr node = parseExpressionNode(statementArena_);
+    throwIfFailed(status_);
     return node;
 }
 
-NodePtr Parser::evalNextTerm()
+NodePtr Parser::parseExpressionNode(NodeArena &arena)
 {
-    // First handle numbers and parenthesis
-    NodePtr node = evalNextFactor();
-
-    // Next handle multiplications and divisions
-    while (hasNextToken() && getNextToken().getTokenType() == TokenType::OPERATOR) {
-        if (getNextToken().getContent() == "*") {
-            advance();
-            node = NodePtr(new MultiplicationNode(node, evalNextFactor()));
-        } else if (getNextToken().getContent() == "/") {
-            advance();
-            node = NodePtr(new DivisionNode(node, evalNextFactor()));
+    // Operator precedence parsing with explicit stacks rather than recursion, so that
+    // nesting costs memory and not call stack
+    std::vector<NodePtr> operands;
+    std::vector<PendingOperator> operators;
+
+    while (true) {
+        // Any number of open parenthesis and function calls, then a number or a variable
+        while (true) {
+            if (nextTokenIs(TokenSubType::OPEN_PARENTHESIS)) {
+                operators.push_back(PendingOperator {nullptr, false, 0});
+                advance();
+            } else if (getNextTokenType() == TokenType::IDENTIFIER && nextTokenIs(TokenSubType::OPEN_PARENTHESIS, 1)) {
+                operators.push_back(PendingOperator {nullptr, true, tokens_.symbolAt(position_)});
+                advance();
+                advance();
+            } else {
+                break;
+            }
+        }
+        if (getNextTokenType() == TokenType::NUMBER) {
+            operands.push_back(arena.make<NumberNode>(tokens_.numberAt(position_)));
+        } else if (getNextTokenType() == TokenType::IDENTIFIER) {
+            operands.push_back(arena.make<VariableNode>(tokens_.symbolAt(position_)));
         } else {
-            // An operator, but not '*' or '/': let the caller handle it.
-            break;
+            fail("Found an unexpected token: " + getNextToken().getContent());
+            return nullptr;
         }
-    }
+        advance();
 
-    return node;
+        // Then any number of closed parenthesis, and a binary operator or the end of the expression
+        while (true) {
+            const BinaryOperator &binaryOperator = binaryOperators[static_cast<std::size_t>(nextSubType())];
+            if (binaryOperator.precedence > 0) {
+                // The pending operators binding at least as tightly are complete: operators are left associative
+                reduceOperators(operands, operators, binaryOperator.precedence, arena);
+                operators.push_back(PendingOperator {&binaryOperator, false, 0});
+                advance();
+                break;
+            }
+
+            // Not a binary operator: close the innermost parenthesis, or end the expression
+            // and let the caller handle the token
+            reduceOperators(operands, operators, 1, arena);
+            if (operators.empty()) {
+                return operands.back();
+            }
+            if (!match(TokenSubType::CLOSED_PARENTHESIS, "a closed parenthesis")) {
+                return nullptr;
+            }
+            PendingOperator parenthesis = operators.back();
+            operators.pop_back();
+            if (parenthesis.isCall) {
+                operands.back() = arena.make<FunctionCallNode>(parenthesis.function, operands.back());
+            }
+        }
+    }
 }
 
-NodePtr Parser::evalNextFactor()
+void Parser::skipNewLines()
 {
-    if (getNextToken().getTokenType() == TokenType::NUMBER) {
-        double value = atof(getNextToken().getContent().c_str());
-        advance();
-        return NodePtr(new NumberNode(value));
-    } else if (getNextToken().getTokenType()  == TokenType::OPERATOR
-        && getNextToken().getContent() == "(") {
-        return evalNextParenthesisFactor();
-    } else if (hasNextTokens(2)
-            && getNextToken().getTokenType() == TokenType::IDENTIFIER
-            && getNextToken(1).getTokenType() == TokenType::OPERATOR
-            && getNextToken(1).getContent() == "(") {
-        return evalNextFunctionCall();
-    } else if (getNextToken().getTokenType() == TokenType::IDENTIFIER) {
-        return evalNextVariable();
-    } else {
-        throw InvalidInputException("Found an unexpected token: " + getNextToken().getContent());
+    while (getNextTokenType() == TokenType::END_OF_LINE) {
+        consumeEndOfLine();
     }
 }
 
-NodePtr Parser::evalNextParenthesisFactor()
+void Parser::consumeEndOfLine()
 {
-    // Match the '('; parse an expression; then match the ')'
-    match(TokenType::OPERATOR, "(", "an open parenthesis");
-    NodePtr node = getNextExpressionNode();
-    match(TokenType::OPERATOR, ")", "a closed parenthesis");
-
-    return node;
-}
-
-NodePtr Parser::evalNextFunctionCall() {
-    // Match the function name and the open parenthesis
-    std::string functionName = getNextToken().getContent();
-    advance();
-    match(TokenType::OPERATOR, "(", "an open parenthesis");
-
-    // Parse its argument as a node and match the closed parenthesis
-    NodePtr argument = getNextExpressionNode();
-    match(TokenType::OPERATOR, ")", "a closed parenthesis");
-
-    // Make a function call node
-    return NodePtr(new FunctionCallNode(functionName, argument));
-}
-
-NodePtr Parser::evalNextVariable() {
-    // Match the variable name
-    std::string variableName = getNextToken().getContent();
+    // The next line starts right after the newline
+    lineStart_ = tokens_.offsetAt(position_) + tokens_.lengthAt(position_);
+    ++line_;
     advance();
-
-    // Make a variable access node
-    return NodePtr(new VariableNode(variableName));
 }
 
-void Parser::skipNewLines()
-{
-    while (hasNextToken() && getNextToken().getTokenType() == TokenType::END_OF_LINE) {
-        advance();
-    }
-}
-
-void Parser::parseNewLine()
+bool Parser::parseNewLine()
 {
     if (!hasNextToken()) {
         // Ok
-        return;
+        return true;
+    }
+    if (getNextTokenType() != TokenType::END_OF_LINE) {
+        fail("Expected newline but found token: " + getNextToken().getContent());
+        return false;
     }
-    match(TokenType::END_OF_LINE, "", "newline");
+    consumeEndOfLine();
+    return true;
 }
 
 double Parser::evalNode(NodePtr node)
 {
-    EvaluationContext evaluationContext(userDefinedFunctions_, variables_);
-    return node->eval(evaluationContext);
+    double value = 0;
+    evaluate(node, value);
+    throwIfFailed(status_);
+    return value;
 }
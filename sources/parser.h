@@ -2,56 +2,118 @@
 #define PARSER_H
 
 #include <memory>
-#include <map>
 #include <cmath>
 #include <iostream>
 
 #include "lexer.h"
+#include "errorReport.h"
 #include "evaluation.h"
 #include "node.h"
+#include "nodeArena.h"
+#include "simplify.h"
+#include "status.h"
+#include "virtualMachine.h"
 
 class Parser
 {
 public:
     Parser(std::istream& istream, std::ostream &ostream = std::cout);
+    Parser(const char *begin, const char *end, std::ostream &ostream = std::cout);
+    explicit Parser(int fd, std::ostream &ostream = std::cout);
 
+    // Runs the program up to its first error, which is returned rather than thrown
+    Status run();
+
+    // Like run, but throws the exception matching the first error (see throwIfFailed)
     void parseProgram();
 
-    // Public only to simplify unit tests; in real code they would be private
+    // Runs the whole program: a statement with an error is skipped up to the end of
+    // its line and the run goes on. Returns the errors, in the order they were found.
+    std::vector<StatementError> runBatch();
+
+    // Public only to simplify unit tests; in real code they would be private.
+    // Like parseProgram, they throw on error.
     NodePtr getNextExpressionNode();
     double evalNode(NodePtr node);
+    inline const NodeArena &statementArena() const { return statementArena_; }
+    inline const NodeArena &functionArena() const { return functionArena_; }
 
-private:
-    static const int NUM_LOOK_AEAHD_TOKENS = 2;
+    // The function arena is compacted when it holds more nodes than twice those left
+    // after the last compaction, plus this many
+    static const std::size_t MIN_COMPACTED_FUNCTION_NODES = 1024;
+
+    // Node counts before and after simplifying the last expression evaluated
+    inline const Simplifier &simplifier() const { return simplifier_; }
 
+private:
     std::ostream &ostream_;
     Lexer lexer_;
-    Token nextTokens_[NUM_LOOK_AEAHD_TOKENS];
+    TokenStream tokens_;
+    std::size_t position_;
+    std::size_t line_;
+    std::size_t lineStart_;
+    std::size_t statementOffset_;
+    std::size_t statementLine_;
+    std::size_t statementLineStart_;
+    Status status_;
+
+    // Nodes of the current statement, freed when the next one starts; and nodes
+    // of the user function bodies, copied there once their definition succeeded.
+    // The bodies replaced by redefinitions are freed by compacting the function arena.
+    NodeArena statementArena_;
+    NodeArena functionArena_;
+    std::size_t compactedFunctionNodes_ = 0;
     userFunctionsMap userDefinedFunctions_;
+    VirtualMachine virtualMachine_;
     variablesMap variables_ {
-        {"e", M_E},
-        {"pi", M_PI}
+        {intern("e"), M_E},
+        {intern("pi"), M_PI}
     };
 
-    inline const Token &getNextToken() const { return nextTokens_[0]; }
-    inline const Token &getNextToken(int position) const { return nextTokens_[position]; }
-    inline bool hasNextToken() const { return getNextToken().getTokenType() != TokenType::END_OF_INPUT; }
-    inline bool hasNextTokens(int numTokens) const { return nextTokens_[numTokens].getTokenType() != TokenType::END_OF_INPUT; }
-
-    void advance();
-    void match(TokenType tokenType, std::string content, std::string expected);
-
-    void parseAssignment();
-    void parseFunctionDefinition();
-    void parseDerivative();
-    void parseExpression();
-    NodePtr evalNextTerm();
-    NodePtr evalNextFactor();
-    NodePtr evalNextParenthesisFactor();
-    NodePtr evalNextFunctionCall();
-    NodePtr evalNextVariable();
-    void parseNewLine();
+    // At the top level no parameter shadows a variable, and every function called is
+    // known: the variables are constants there, and the builtins not redefined fold
+    Simplifier simplifier_ {Simplification::EXACT, &userDefinedFunctions_, &variables_};
+
+    // Tokens are lexed one line at a time, as the parser looks ahead
+    bool fetchTokens(std::size_t lookAhead);
+
+    inline Token getNextToken(std::size_t lookAhead = 0) {
+        return fetchTokens(lookAhead) ? tokens_.at(position_ + lookAhead) : Token();
+    }
+    inline TokenType getNextTokenType(std::size_t lookAhead = 0) {
+        return fetchTokens(lookAhead) ? tokens_.typeAt(position_ + lookAhead) : TokenType::END_OF_INPUT;
+    }
+    inline bool nextTokenIs(TokenSubType subType, std::size_t lookAhead = 0) {
+        return fetchTokens(lookAhead) && tokens_.subTypeAt(position_ + lookAhead) == subType;
+    }
+    inline TokenSubType nextSubType() {
+        return fetchTokens(0) ? tokens_.subTypeAt(position_) : TokenSubType::NONE;
+    }
+    inline bool hasNextToken() { return fetchTokens(0); }
+    inline bool hasNextTokens(std::size_t numTokens) { return fetchTokens(numTokens - 1); }
+
+    inline void advance() { ++position_; }
+    std::size_t nextTokenOffset();
+
+    // Errors are recorded in status_ and unwound by returning false or a null node
+    void fail(const std::string &reason);
+    bool match(TokenSubType subType, const char *expected);
+    bool evaluate(NodePtr node, double &value);
+
+    bool nextStatement();
+    bool runStatement();
+    void skipRestOfStatement();
+
+    void compactFunctionArena();
+
+    bool parseAssignment();
+    bool parseFunctionDefinition();
+    bool parseDerivative();
+    bool parseExpression();
+    NodePtr parseExpressionNode(NodeArena &arena);
+    bool parseNewLine();
     void skipNewLines();
+    void consumeEndOfLine();
 };
 
 #endif
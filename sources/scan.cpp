@@ -0,0 +1,234 @@
+#include "scan.h"
+#include "charClass.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_HAS_X86 1
+#endif
+
+namespace {
+
+template <std::uint8_t charClass>
+const char *scanScalar(const char *begin, const char *end)
+{
+    while (begin != end && hasCharClass(*begin, charClass)) {
+        ++begin;
+    }
+    return begin;
+}
+
+#ifdef SCAN_HAS_X86
+
+// Each classifier returns a mask with a bit set for every byte that is NOT part of the run,
+// so that the first one is found with a count of trailing zeros.
+
+__attribute__((target("sse2")))
+inline unsigned notSpacesSse2(__m128i chars)
+{
+    __m128i isSpace = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(chars, _mm_set1_epi8('\t'))),
+            _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\v')), _mm_cmpeq_epi8(chars, _mm_set1_epi8('\f'))));
+    return ~static_cast<unsigned>(_mm_movemask_epi8(isSpace)) & 0xFFFFu;
+}
+
+// True where (chars - low) <= width as unsigned bytes
+__attribute__((target("sse2")))
+inline __m128i inRangeSse2(__m128i chars, char low, char width)
+{
+    __m128i offset = _mm_sub_epi8(chars, _mm_set1_epi8(low));
+    return _mm_cmpeq_epi8(_mm_max_epu8(offset, _mm_set1_epi8(width)), _mm_set1_epi8(width));
+}
+
+__attribute__((target("sse2")))
+inline unsigned notDigitsSse2(__m128i chars)
+{
+    return ~static_cast<unsigned>(_mm_movemask_epi8(inRangeSse2(chars, '0', 9))) & 0xFFFFu;
+}
+
+__attribute__((target("sse2")))
+inline unsigned notIdentifierPartsSse2(__m128i chars)
+{
+    // Setting bit 0x20 maps upper case letters on lower case ones
+    __m128i isLetter = inRangeSse2(_mm_or_si128(chars, _mm_set1_epi8(0x20)), 'a', 25);
+    __m128i isPart = _mm_or_si128(isLetter, inRangeSse2(chars, '0', 9));
+    return ~static_cast<unsigned>(_mm_movemask_epi8(isPart)) & 0xFFFFu;
+}
+
+template <unsigned (*notInRun)(__m128i), std::uint8_t charClass>
+__attribute__((target("sse2")))
+const char *scanSse2(const char *begin, const char *end)
+{
+    while (end - begin >= 16) {
+        unsigned mask = notInRun(_mm_loadu_si128(reinterpret_cast<const __m128i *>(begin)));
+        if (mask != 0) {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 16;
+    }
+    return scanScalar<charClass>(begin, end);
+}
+
+__attribute__((target("avx2")))
+inline unsigned notSpacesAvx2(__m256i chars)
+{
+    __m256i isSpace = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\t'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\v')), _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\f'))));
+    return ~static_cast<unsigned>(_mm256_movemask_epi8(isSpace));
+}
+
+__attribute__((target("avx2")))
+inline __m256i inRangeAvx2(__m256i chars, char low, char width)
+{
+    __m256i offset = _mm256_sub_epi8(chars, _mm256_set1_epi8(low));
+    return _mm256_cmpeq_epi8(_mm256_max_epu8(offset, _mm256_set1_epi8(width)), _mm256_set1_epi8(width));
+}
+
+__attribute__((target("avx2")))
+inline unsigned notDigitsAvx2(__m256i chars)
+{
+    return ~static_cast<unsigned>(_mm256_movemask_epi8(inRangeAvx2(chars, '0', 9)));
+}
+
+__attribute__((target("avx2")))
+inline unsigned notIdentifierPartsAvx2(__m256i chars)
+{
+    __m256i isLetter = inRangeAvx2(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)), 'a', 25);
+    __m256i isPart = _mm256_or_si256(isLetter, inRangeAvx2(chars, '0', 9));
+    return ~static_cast<unsigned>(_mm256_movemask_epi8(isPart));
+}
+
+template <unsigned (*notInRun)(__m256i), std::uint8_t charClass>
+__attribute__((target("avx2")))
+const char *scanAvx2(const char *begin, const char *end)
+{
+    while (end - begin >= 32) {
+        unsigned mask = notInRun(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin)));
+        if (mask != 0) {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 32;
+    }
+    return scanScalar<charClass>(begin, end);
+}
+
+#endif
+
+using scanFunction = const char *(*)(const char *, const char *);
+
+struct ScanFunctions {
+    scanFunction spaces;
+    scanFunction digits;
+    scanFunction identifierParts;
+};
+
+const ScanFunctions scalarFunctions {
+    scanScalar<CHAR_SPACE>,
+    scanScalar<CHAR_DIGIT>,
+    scanScalar<CHAR_IDENTIFIER_PART>
+};
+
+#ifdef SCAN_HAS_X86
+const ScanFunctions sse2Functions {
+    scanSse2<notSpacesSse2, CHAR_SPACE>,
+    scanSse2<notDigitsSse2, CHAR_DIGIT>,
+    scanSse2<notIdentifierPartsSse2, CHAR_IDENTIFIER_PART>
+};
+
+const ScanFunctions avx2Functions {
+    scanAvx2<notSpacesAvx2, CHAR_SPACE>,
+    scanAvx2<notDigitsAvx2, CHAR_DIGIT>,
+    scanAvx2<notIdentifierPartsAvx2, CHAR_IDENTIFIER_PART>
+};
+#endif
+
+bool isSupported(ScanImplementation implementation)
+{
+#ifdef SCAN_HAS_X86
+    // Needed because this also runs from a static initializer
+    __builtin_cpu_init();
+#endif
+    switch (implementation) {
+        case ScanImplementation::SCALAR:
+            return true;
+#ifdef SCAN_HAS_X86
+        case ScanImplementation::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case ScanImplementation::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+const ScanFunctions &functionsFor(ScanImplementation implementation)
+{
+    switch (implementation) {
+#ifdef SCAN_HAS_X86
+        case ScanImplementation::SSE2:
+            return sse2Functions;
+        case ScanImplementation::AVX2:
+            return avx2Functions;
+#endif
+        default:
+            return scalarFunctions;
+    }
+}
+
+ScanImplementation currentImplementation = bestScanImplementation();
+const ScanFunctions *currentFunctions = &functionsFor(currentImplementation);
+
+}
+
+const char *scanSpaces(const char *begin, const char *end)
+{
+    return currentFunctions->spaces(begin, end);
+}
+
+const char *scanDigits(const char *begin, const char *end)
+{
+    return currentFunctions->digits(begin, end);
+}
+
+const char *scanIdentifierParts(const char *begin, const char *end)
+{
+    return currentFunctions->identifierParts(begin, end);
+}
+
+ScanImplementation bestScanImplementation()
+{
+    if (isSupported(ScanImplementation::AVX2)) {
+        return ScanImplementation::AVX2;
+    } else if (isSupported(ScanImplementation::SSE2)) {
+        return ScanImplementation::SSE2;
+    }
+    return ScanImplementation::SCALAR;
+}
+
+ScanImplementation currentScanImplementation()
+{
+    return currentImplementation;
+}
+
+bool setScanImplementation(ScanImplementation implementation)
+{
+    if (!isSupported(implementation)) {
+        return false;
+    }
+    currentImplementation = implementation;
+    currentFunctions = &functionsFor(implementation);
+    return true;
+}
+
+std::string scanImplementationName(ScanImplementation implementation)
+{
+    switch (implementation) {
+        case ScanImplementation::SSE2:
+            return "sse2";
+        case ScanImplementation::AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
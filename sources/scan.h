@@ -0,0 +1,30 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <string>
+
+// Scanning of character runs for the lexer. Each function returns the first position in
+// [begin, end) that does not belong to the run, or end. Long runs are classified 16 or 32
+// bytes at a time with SSE2 or AVX2, chosen once at startup from what the CPU supports.
+
+enum class ScanImplementation {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+const char *scanSpaces(const char *begin, const char *end);
+const char *scanDigits(const char *begin, const char *end);
+const char *scanIdentifierParts(const char *begin, const char *end);
+
+// The best implementation the CPU supports, and the one currently in use
+ScanImplementation bestScanImplementation();
+ScanImplementation currentScanImplementation();
+
+// Forces an implementation, e.g. to compare them in benchmarks and tests.
+// Returns false, changing nothing, if the CPU does not support it.
+bool setScanImplementation(ScanImplementation implementation);
+
+std::string scanImplementationName(ScanImplementation implementation);
+
+#endif
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "node.h"
+#include "simplify.h"
+
+namespace {
+
+bool isNumber(const Node *node, double &value)
+{
+    if (node->kind() != FlatOpcode::NUMBER) {
+        return false;
+    }
+    value = static_cast<const NumberNode *>(node)->value();
+    return true;
+}
+
+// The number bit for bit, telling 0 from -0
+bool isExactly(const Node *node, double number)
+{
+    double value;
+    return isNumber(node, value) && std::memcmp(&value, &number, sizeof(value)) == 0;
+}
+
+bool isZero(const Node *node)
+{
+    double value;
+    return isNumber(node, value) && value == 0;
+}
+
+NodePtr makeBinary(FlatOpcode kind, NodePtr left, NodePtr right, NodeArena &arena)
+{
+    switch (kind) {
+        case FlatOpcode::ADD:
+            return arena.make<AdditionNode>(left, right);
+        case FlatOpcode::SUBTRACT:
+            return arena.make<SubtractionNode>(left, right);
+        case FlatOpcode::MULTIPLY:
+            return arena.make<MultiplicationNode>(left, right);
+        default:
+            return arena.make<DivisionNode>(left, right);
+    }
+}
+
+}
+
+NodePtr Simplifier::simplify(NodePtr root, NodeArena &arena)
+{
+    // Post-order walk: a node is simplified once all its children are. A node shared
+    // in the tree (see NodeArena) is simplified once.
+    struct Frame {
+        NodePtr node;
+        std::size_t nextChild;
+    };
+
+    std::vector<Frame> frames {{root, 0}};
+    std::vector<NodePtr> results;
+    std::unordered_map<const Node *, NodePtr> simplified;
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+        if (frame.nextChild < frame.node->childCount()) {
+            NodePtr child = frame.node->child(frame.nextChild);
+            ++frame.nextChild;
+            auto found = simplified.find(child);
+            if (found != simplified.end()) {
+                results.push_back(found->second);
+            } else {
+                frames.push_back(Frame {child, 0});
+            }
+            continue;
+        }
+
+        NodePtr node = frame.node;
+        frames.pop_back();
+        std::size_t count = node->childCount();
+        NodePtr children[Node::MAX_CHILDREN];
+        std::copy(results.end() - count, results.end(), children);
+        results.resize(results.size() - count);
+        results.push_back(node->simplifyWith(*this, children, arena));
+        simplified.emplace(node, results.back());
+    }
+
+    nodesBefore_ = treeSize(root);
+    nodesAfter_ = treeSize(results.back());
+    return results.back();
+}
+
+std::size_t Simplifier::treeSize(const Node *root)
+{
+    // The size of a node is one plus those of its children, each computed once
+    struct Frame {
+        const Node *node;
+        std::size_t nextChild;
+    };
+
+    std::vector<Frame> frames {{root, 0}};
+    std::vector<std::size_t> sizes;
+    std::unordered_map<const Node *, std::size_t> known;
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+        if (frame.nextChild < frame.node->childCount()) {
+            const Node *child = frame.node->child(frame.nextChild);
+            ++frame.nextChild;
+            auto found = known.find(child);
+            if (found != known.end()) {
+                sizes.push_back(found->second);
+            } else {
+                frames.push_back(Frame {child, 0});
+            }
+            continue;
+        }
+
+        const Node *node = frame.node;
+        frames.pop_back();
+        std::size_t size = 1;
+        for (std::size_t i = 0; i < node->childCount(); ++i) {
+            size += sizes.back();
+            sizes.pop_back();
+        }
+        sizes.push_back(size);
+        known.emplace(node, size);
+    }
+    return sizes.back();
+}
+
+const double *Simplifier::constant(SymbolId name) const
+{
+    return constants_ != nullptr ? constants_->find(name) : nullptr;
+}
+
+builtinFunction Simplifier::foldableBuiltin(SymbolId name) const
+{
+    if (functions_ == nullptr || functions_->find(name) != nullptr) {
+        return nullptr;
+    }
+    return findBuiltinFunction(name);
+}
+
+NodePtr Simplifier::binary(BinaryOpNode *node, NodePtr left, NodePtr right, NodeArena &arena) const
+{
+    FlatOpcode kind = node->kind();
+    double leftValue, rightValue;
+    if (isNumber(left, leftValue) && isNumber(right, rightValue)) {
+        return arena.make<NumberNode>(BinaryOpNode::apply(kind, leftValue, rightValue));
+    }
+
+    bool algebraic = simplification_ == Simplification::ALGEBRAIC;
+    switch (kind) {
+        case FlatOpcode::ADD:
+            // -0 is the only exact neutral of addition: 0 + -0 is 0, not -0
+            if (isExactly(right, -0.0) || (algebraic && isZero(right))) {
+                return left;
+            }
+            if (isExactly(left, -0.0) || (algebraic && isZero(left))) {
+                return right;
+            }
+            break;
+        case FlatOpcode::SUBTRACT:
+            if (isExactly(right, 0.0) || (algebraic && isZero(right))) {
+                return left;
+            }
+            break;
+        case FlatOpcode::MULTIPLY:
+            if (isExactly(right, 1.0)) {
+                return left;
+            }
+            if (isExactly(left, 1.0)) {
+                return right;
+            }
+            if (algebraic && (isZero(left) || isZero(right))) {
+                return arena.make<NumberNode>(0);
+            }
+            break;
+        default:
+            if (isExactly(right, 1.0)) {
+                return left;
+            }
+            break;
+    }
+
+    if (left == node->left() && right == node->right()) {
+        return node;
+    }
+    return makeBinary(kind, left, right, arena);
+}
@@ -0,0 +1,54 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <cstddef>
+
+#include "evaluation.h"
+
+// Which rewrites a simplification may do
+enum class Simplification {
+    // Only those giving the same value and errors whatever the values of the names,
+    // -0 and NaN included: constant folding, a * 1, 1 * a, a / 1, a - 0 and a + -0
+    EXACT,
+    // Also the rules of algebra, for symbolic results such as derivatives: 0 * a = 0,
+    // a + 0 = a and a - 0 = a, for any a, even one whose value would be NaN or fail
+    ALGEBRAIC
+};
+
+class BinaryOpNode;
+
+// Folds constant subtrees into numbers, with the given constants for the names they
+// contain and calls to builtins on numbers, and applies identities of arithmetic.
+// The result shares the unchanged subtrees of the expression simplified.
+class Simplifier
+{
+public:
+    // Names in constants are replaced by their values; the functions called are those
+    // defined, so that a builtin hidden by a user function is not folded, and no call
+    // is folded without them
+    Simplifier(Simplification simplification, const userFunctionsMap *functions, const variablesMap *constants = nullptr)
+        : simplification_(simplification), functions_(functions), constants_(constants), nodesBefore_(0), nodesAfter_(0) {}
+
+    NodePtr simplify(NodePtr root, NodeArena &arena);
+
+    // The sizes of the last expression simplified and of its result, in nodes visited by a tree walk
+    inline std::size_t nodesBefore() const { return nodesBefore_; }
+    inline std::size_t nodesAfter() const { return nodesAfter_; }
+
+    // The number of nodes a tree walk visits, a shared node once per use
+    static std::size_t treeSize(const Node *root);
+
+    // For the nodes (see Node::simplifyWith)
+    const double *constant(SymbolId name) const;
+    builtinFunction foldableBuiltin(SymbolId name) const;
+    NodePtr binary(BinaryOpNode *node, NodePtr left, NodePtr right, NodeArena &arena) const;
+
+private:
+    Simplification simplification_;
+    const userFunctionsMap *functions_;
+    const variablesMap *constants_;
+    std::size_t nodesBefore_;
+    std::size_t nodesAfter_;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+enum class ErrorCode
+{
+    OK,
+    INVALID_INPUT,
+    UNKNOWN_FUNCTION,
+    UNKNOWN_VARIABLE
+};
+
+// The outcome of lexing, parsing or evaluating a piece of input. Bad input is
+// reported by returning a failed status instead of throwing, so that an error
+// costs about as much as a success; see throwIfFailed for the throwing API.
+class Status
+{
+public:
+    Status() : code_(ErrorCode::OK), offset_(0) {}
+
+    // detail is the reason for INVALID_INPUT and the offending name otherwise;
+    // offset is where in the source the error was found
+    Status(ErrorCode code, std::string detail, std::size_t offset = 0)
+        : code_(code), detail_(std::move(detail)), offset_(offset) {}
+
+    inline bool ok() const { return code_ == ErrorCode::OK; }
+    inline ErrorCode code() const { return code_; }
+    inline const std::string &detail() const { return detail_; }
+    inline std::size_t offset() const { return offset_; }
+
+    std::string message() const
+    {
+        switch (code_) {
+            case ErrorCode::OK: return "";
+            case ErrorCode::UNKNOWN_FUNCTION: return "Unknown function: " + detail_;
+            case ErrorCode::UNKNOWN_VARIABLE: return "Unknown variable: " + detail_;
+            default: return detail_;
+        }
+    }
+
+private:
+    ErrorCode code_;
+    std::string detail_;
+    std::size_t offset_;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#include <cstring>
+
+#include "symbols.h"
+
+bool SymbolTable::Key::operator ==(const Key &other) const
+{
+    return length == other.length && std::memcmp(text, other.text, length) == 0;
+}
+
+std::size_t SymbolTable::KeyHash::operator ()(const Key &key) const
+{
+    // FNV-1a
+    std::size_t hash = 14695981039346656037ULL;
+    for (std::size_t i = 0; i < key.length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(key.text[i])) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+SymbolId SymbolTable::intern(const char *text, std::size_t length)
+{
+    auto it = ids_.find(Key{text, length});
+    if (it != ids_.end()) {
+        return it->second;
+    }
+
+    // The deque never moves its strings, so the key can point into them
+    SymbolId id = static_cast<SymbolId>(names_.size());
+    names_.emplace_back(text, length);
+    ids_.emplace(Key{names_.back().data(), length}, id);
+    return id;
+}
+
+const std::string &SymbolTable::name(SymbolId id) const
+{
+    return names_[id];
+}
+
+SymbolTable &SymbolTable::global()
+{
+    static SymbolTable table;
+    return table;
+}
@@ -0,0 +1,107 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Identifiers are interned once, when they are lexed, into dense integer ids.
+// Everything after the lexer works on ids, so name lookups are array indexing.
+using SymbolId = std::uint32_t;
+
+class SymbolTable
+{
+public:
+    SymbolId intern(const char *text, std::size_t length);
+    const std::string &name(SymbolId id) const;
+
+    inline std::size_t size() const { return names_.size(); }
+
+    // The table shared by the whole program
+    static SymbolTable &global();
+
+private:
+    // Points either to a name already interned or to the text being looked up,
+    // so that lookups do not allocate
+    struct Key {
+        const char *text;
+        std::size_t length;
+
+        bool operator ==(const Key &other) const;
+    };
+
+    struct KeyHash {
+        std::size_t operator ()(const Key &key) const;
+    };
+
+    std::deque<std::string> names_;
+    std::unordered_map<Key, SymbolId, KeyHash> ids_;
+};
+
+inline SymbolId intern(const char *text, std::size_t length)
+{
+    return SymbolTable::global().intern(text, length);
+}
+
+inline SymbolId intern(const std::string &name)
+{
+    return intern(name.data(), name.size());
+}
+
+inline const std::string &symbolName(SymbolId id)
+{
+    return SymbolTable::global().name(id);
+}
+
+// A map from symbols to values, stored as an array indexed by the symbol id
+template <typename T>
+class SymbolMap
+{
+public:
+    SymbolMap() : size_(0) {}
+
+    SymbolMap(std::initializer_list<std::pair<SymbolId, T>> entries) : size_(0) {
+        for (const auto &entry : entries) {
+            set(entry.first, entry.second);
+        }
+    }
+
+    // Returns nullptr if the symbol has no value
+    inline const T *find(SymbolId id) const {
+        return id < defined_.size() && defined_[id] ? &values_[id] : nullptr;
+    }
+
+    // The number of symbols with a value
+    inline std::size_t size() const { return size_; }
+
+    inline void set(SymbolId id, const T &value) {
+        if (id >= values_.size()) {
+            values_.resize(id + 1);
+            defined_.resize(id + 1, false);
+        }
+        values_[id] = value;
+        size_ += defined_[id] ? 0 : 1;
+        defined_[id] = true;
+    }
+
+    // Calls visit(id, value) for each symbol with a value, in the order of the ids
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        for (std::size_t id = 0; id < values_.size(); ++id) {
+            if (defined_[id]) {
+                visit(static_cast<SymbolId>(id), values_[id]);
+            }
+        }
+    }
+
+private:
+    std::vector<T> values_;
+    std::vector<char> defined_;
+    std::size_t size_;
+};
+
+#endif
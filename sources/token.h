@@ -1,25 +1,64 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <cstdint>
+#include <cstring>
+#include <sstream>
 #include <string>
 
-enum class TokenType
+#include "symbols.h"
+
+enum class TokenType : std::uint8_t
 {
     OPERATOR,
     NUMBER,
     IDENTIFIER,
     END_OF_LINE,
-    END_OF_INPUT
+    END_OF_INPUT,
+    ERROR
+};
+
+// Which operator an OPERATOR token is, which keyword an IDENTIFIER token spells, or what
+// is wrong with an ERROR token; NONE for all the other tokens. Keywords are identifiers
+// too, so that def and der remain usable as names wherever no keyword is expected.
+enum class TokenSubType : std::uint8_t
+{
+    NONE,
+    PLUS,
+    MINUS,
+    STAR,
+    SLASH,
+    OPEN_PARENTHESIS,
+    CLOSED_PARENTHESIS,
+    ASSIGN,
+    DEF,
+    DER,
+    INVALID_CHARACTER,
+    INVALID_NEWLINE
 };
 
+// A token is a small, trivially copyable value. It does not own its text: it points
+// into the source the lexer is reading. Numbers carry their already converted value,
+// identifiers their interned symbol.
 class Token
 {
 public:
-    Token() : Token(TokenType::END_OF_INPUT, "") {}
+    Token() : Token(TokenType::END_OF_INPUT, "", 0) {}
+
+    Token(TokenType tokenType, const char *text, std::size_t length,
+          TokenSubType subType = TokenSubType::NONE, double number = 0)
+        : tokenType_(tokenType), subType_(subType),
+          length_(static_cast<std::uint32_t>(length)), text_(text)
+    {
+        number_ = number;
+    }
 
-    Token(TokenType tokenType, std::string content)
-        : tokenType_(tokenType), content_(content)
+    static Token makeIdentifier(SymbolId symbol, const char *text, std::size_t length,
+                                TokenSubType keyword = TokenSubType::NONE)
     {
+        Token token(TokenType::IDENTIFIER, text, length, keyword);
+        token.symbol_ = symbol;
+        return token;
     }
 
     inline TokenType getTokenType() const
@@ -27,20 +66,77 @@ public:
         return tokenType_;
     }
 
+    inline TokenSubType getSubType() const
+    {
+        return subType_;
+    }
+
+    inline bool is(TokenSubType subType) const
+    {
+        return subType_ == subType;
+    }
+
+    inline double getNumber() const
+    {
+        return number_;
+    }
+
+    inline SymbolId getSymbol() const
+    {
+        return symbol_;
+    }
+
+    inline const char *getText() const
+    {
+        return text_;
+    }
+
+    inline std::size_t getLength() const
+    {
+        return length_;
+    }
+
+    // The source text of the token; only meant for identifiers and error messages
     inline std::string getContent() const
     {
-        return content_;
+        // Numbers and identifiers coming out of a TokenStream only keep their value or symbol
+        if (tokenType_ == TokenType::NUMBER && length_ == 0) {
+            std::ostringstream oss;
+            oss << number_;
+            return oss.str();
+        } else if (tokenType_ == TokenType::IDENTIFIER && length_ == 0) {
+            return symbolName(symbol_);
+        } else if (tokenType_ == TokenType::END_OF_LINE) {
+            // Keeps error messages on one line
+            return "";
+        }
+        return std::string(text_, length_);
     }
 
     inline bool operator ==(const Token& other) const
     {
-        return tokenType_ == other.tokenType_
-            && content_ == other.content_;
+        if (tokenType_ != other.tokenType_ || subType_ != other.subType_) {
+            return false;
+        }
+        switch (tokenType_) {
+            case TokenType::NUMBER:
+                return number_ == other.number_;
+            case TokenType::IDENTIFIER:
+                return symbol_ == other.symbol_;
+            default:
+                return true;
+        }
     }
 
 private:
     TokenType tokenType_;
-    std::string content_;
+    TokenSubType subType_;
+    std::uint32_t length_;
+    const char *text_;
+    union {
+        double number_;
+        SymbolId symbol_;
+    };
 };
 
 #endif
@@ -0,0 +1,47 @@
+#include "tokenStream.h"
+
+void TokenStream::push(const Token &token, std::size_t offset)
+{
+    Payload payload;
+    if (token.getTokenType() == TokenType::NUMBER) {
+        payload.number = token.getNumber();
+    } else if (token.getTokenType() == TokenType::IDENTIFIER) {
+        payload.symbol = token.getSymbol();
+    } else {
+        payload.text = token.getText();
+    }
+
+    types_.push_back(token.getTokenType());
+    subTypes_.push_back(token.getSubType());
+    payloads_.push_back(payload);
+    lengths_.push_back(static_cast<std::uint32_t>(token.getLength()));
+    offsets_.push_back(offset);
+}
+
+void TokenStream::clear()
+{
+    types_.clear();
+    subTypes_.clear();
+    payloads_.clear();
+    lengths_.clear();
+    offsets_.clear();
+}
+
+void TokenStream::discard(std::size_t count)
+{
+    types_.erase(types_.begin(), types_.begin() + count);
+    subTypes_.erase(subTypes_.begin(), subTypes_.begin() + count);
+    payloads_.erase(payloads_.begin(), payloads_.begin() + count);
+    lengths_.erase(lengths_.begin(), lengths_.begin() + count);
+    offsets_.erase(offsets_.begin(), offsets_.begin() + count);
+}
+
+Token TokenStream::at(std::size_t index) const
+{
+    if (types_[index] == TokenType::NUMBER) {
+        return Token(TokenType::NUMBER, "", 0, TokenSubType::NONE, payloads_[index].number);
+    } else if (types_[index] == TokenType::IDENTIFIER) {
+        return Token::makeIdentifier(payloads_[index].symbol, "", 0, subTypes_[index]);
+    }
+    return Token(types_[index], payloads_[index].text, lengths_[index], subTypes_[index]);
+}
@@ -0,0 +1,51 @@
+#ifndef TOKEN_STREAM_H
+#define TOKEN_STREAM_H
+
+#include <cstdint>
+#include <vector>
+
+#include "token.h"
+
+// A sequence of already lexed tokens, stored as parallel arrays (struct of arrays) so that
+// walking it by index only touches the fields that are actually read.
+class TokenStream
+{
+public:
+    void push(const Token &token, std::size_t offset);
+    void clear();
+
+    // Drops the first `count` tokens
+    void discard(std::size_t count);
+
+    inline std::size_t size() const { return types_.size(); }
+    inline bool empty() const { return types_.empty(); }
+
+    inline TokenType typeAt(std::size_t index) const { return types_[index]; }
+    inline TokenSubType subTypeAt(std::size_t index) const { return subTypes_[index]; }
+    inline double numberAt(std::size_t index) const { return payloads_[index].number; }
+    inline SymbolId symbolAt(std::size_t index) const { return payloads_[index].symbol; }
+    inline std::size_t lengthAt(std::size_t index) const { return lengths_[index]; }
+
+    // Offset of the token from the start of the source
+    inline std::size_t offsetAt(std::size_t index) const { return offsets_[index]; }
+
+    // Reassembles the whole token
+    Token at(std::size_t index) const;
+
+private:
+    // Numbers only need their value and identifiers their symbol;
+    // all the other tokens point to their text
+    union Payload {
+        double number;
+        SymbolId symbol;
+        const char *text;
+    };
+
+    std::vector<TokenType> types_;
+    std::vector<TokenSubType> subTypes_;
+    std::vector<Payload> payloads_;
+    std::vector<std::uint32_t> lengths_;
+    std::vector<std::size_t> offsets_;
+};
+
+#endif
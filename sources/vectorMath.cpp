@@ -0,0 +1,37 @@
+#include <cmath>
+
+#include "vectorMath.h"
+
+namespace {
+
+template <double (*function)(double)>
+void mapScalar(double *values, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        values[i] = function(values[i]);
+    }
+}
+
+}
+
+const VectorMath scalarVectorMath = {
+    "scalar", mapScalar<std::exp>, mapScalar<std::log>, mapScalar<std::sin>, mapScalar<std::cos>, mapScalar<std::tan>
+};
+
+std::vector<const VectorMath *> supportedVectorMath()
+{
+    std::vector<const VectorMath *> supported {&scalarVectorMath};
+#ifdef VECTOR_MATH_HAS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        supported.push_back(&sse2VectorMath);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        supported.push_back(&avx2VectorMath);
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        supported.push_back(&avx512VectorMath);
+    }
+#endif
+    return supported;
+}
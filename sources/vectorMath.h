@@ -0,0 +1,48 @@
+#ifndef VECTOR_MATH_H
+#define VECTOR_MATH_H
+
+#include <cstddef>
+#include <vector>
+
+// exp, log, sin, cos and tan over arrays of doubles, a few lanes at a time with SSE2,
+// AVX2 or AVX-512: range reduction, then polynomial kernels after fdlibm's. The lanes
+// only add, multiply and divide, without fused multiply-adds, so each implementation
+// gives the same values, whatever the position of a value in the array.
+//
+// Maximum errors against glibc's libm, in units in the last place (see testVectorMath):
+//   exp  1 ULP       log  1 ULP
+//   sin  1 ULP       cos  1 ULP       tan  2 ULP
+// Special values are those of libm: NaN, infinities, zeros, subnormals and overflow.
+// sin, cos and tan reduce arguments up to VECTOR_MATH_MAX_REDUCED in magnitude; larger
+// ones, rare in practice, are computed with libm.
+
+const double VECTOR_MATH_MAX_REDUCED = 1048576;
+
+// Replaces values[i] with f(values[i]) for i < n
+using arrayFunction = void (*)(double *values, std::size_t n);
+
+struct VectorMath {
+    const char *name;
+    arrayFunction exp;
+    arrayFunction log;
+    arrayFunction sin;
+    arrayFunction cos;
+    arrayFunction tan;
+};
+
+// libm, one value at a time
+extern const VectorMath scalarVectorMath;
+
+// Those the CPU supports, scalarVectorMath first
+std::vector<const VectorMath *> supportedVectorMath();
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VECTOR_MATH_HAS_X86 1
+
+// Only to be called where the CPU supports the instruction set
+extern const VectorMath sse2VectorMath;
+extern const VectorMath avx2VectorMath;
+extern const VectorMath avx512VectorMath;
+#endif
+
+#endif
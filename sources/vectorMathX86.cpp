@@ -0,0 +1,352 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "vectorMath.h"
+
+#ifdef VECTOR_MATH_HAS_X86
+
+// The kernels are written once over GCC vector types and inlined into a function for
+// each instruction set, which compiles them to its registers. Being always inlined,
+// they never return vectors from a call, whose ABI GCC would warn about for the AVX
+// and AVX-512 instantiations. GCC reports that warning at the end of the file, past
+// any diagnostic pop, which is why these kernels have a file of their own.
+#define VECTOR_MATH_INLINE inline __attribute__((always_inline))
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace {
+
+template <int LANES>
+struct Lanes {
+    typedef double Double __attribute__((vector_size(8 * LANES)));
+    typedef std::int64_t Int __attribute__((vector_size(8 * LANES)));
+};
+
+// Adding it rounds a double below 2^51 in magnitude to an integer, found in the low
+// bits of the sum
+const double ROUNDING = 6755399441055744.0;
+
+template <typename Double, typename Int>
+VECTOR_MATH_INLINE Double fromBits(const Int &bits)
+{
+    return reinterpret_cast<Double>(bits);
+}
+
+template <typename Int, typename Double>
+VECTOR_MATH_INLINE Int toBits(const Double &value)
+{
+    return reinterpret_cast<Int>(value);
+}
+
+// A double equal to each integer below 2^51 in magnitude
+template <typename Double, typename Int>
+VECTOR_MATH_INLINE Double toDouble(const Int &integer)
+{
+    Double rounding = Double {} + ROUNDING;
+    return fromBits<Double>(toBits<Int>(rounding) + integer) - rounding;
+}
+
+template <typename Double, typename Int>
+VECTOR_MATH_INLINE Double absolute(const Double &value)
+{
+    return fromBits<Double>(toBits<Int>(value) & (Int {} + 0x7FFFFFFFFFFFFFFFll));
+}
+
+// 2^k, for k from -1022 to 1023
+template <typename Double, typename Int>
+VECTOR_MATH_INLINE Double powerOfTwo(const Int &k)
+{
+    return fromBits<Double>((k + 1023) << 52);
+}
+
+template <int LANES>
+VECTOR_MATH_INLINE typename Lanes<LANES>::Double expLanes(const typename Lanes<LANES>::Double &x)
+{
+    typedef typename Lanes<LANES>::Double Double;
+    typedef typename Lanes<LANES>::Int Int;
+    const double LOG2E = 1.44269504088896338700e+00;
+    const double LN2_HI = 6.93147180369123816490e-01;   // its 32 low bits are zero
+    const double LN2_LO = 1.90821492927058770002e-10;
+    const double P1 = 1.66666666666666019037e-01;
+    const double P2 = -2.77777777770155933842e-03;
+    const double P3 = 6.61375632143793436117e-05;
+    const double P4 = -1.65339022054652515390e-06;
+    const double P5 = 4.13813679705723846039e-08;
+
+    // x = k ln2 + r, |r| <= ln2 / 2, with k in range once x is clamped to where exp
+    // is neither infinite nor zero
+    Double clamped = x < -746.0 ? Double {} - 746.0 : x;
+    clamped = clamped > 710.0 ? Double {} + 710.0 : clamped;
+    Double rounded = clamped * LOG2E + ROUNDING;
+    Int k = toBits<Int>(rounded) - toBits<Int>(Double {} + ROUNDING);
+    Double dk = rounded - ROUNDING;
+    Double hi = clamped - dk * LN2_HI;
+    Double lo = dk * LN2_LO;
+    Double r = hi - lo;
+
+    // exp(r) = 1 + 2r / (R(r^2) - r), with r - R(r^2) = r c / (2 - c)
+    Double t = r * r;
+    Double c = r - t * (P1 + t * (P2 + t * (P3 + t * (P4 + t * P5))));
+    Double y = 1.0 - ((lo - (r * c) / (2.0 - c)) - hi);
+
+    // Scaled in two steps, so that results in the subnormals are rounded once
+    Int k1 = k >> 1;
+    Double result = y * powerOfTwo<Double>(k1) * powerOfTwo<Double>(k - k1);
+
+    result = x > 709.782712893383973096 ? Double {} + HUGE_VAL : result;
+    result = x < -745.13321910194110842 ? Double {} : result;
+    return x != x ? x + x : result;
+}
+
+template <int LANES>
+VECTOR_MATH_INLINE typename Lanes<LANES>::Double logLanes(const typename Lanes<LANES>::Double &x)
+{
+    typedef typename Lanes<LANES>::Double Double;
+    typedef typename Lanes<LANES>::Int Int;
+    const double LN2_HI = 6.93147180369123816490e-01;
+    const double LN2_LO = 1.90821492927058770002e-10;
+    const double LG1 = 6.666666666666735130e-01;
+    const double LG2 = 3.999999999940941908e-01;
+    const double LG3 = 2.857142874366239149e-01;
+    const double LG4 = 2.222219843214978396e-01;
+    const double LG5 = 1.818357216161805012e-01;
+    const double LG6 = 1.531383769920937332e-01;
+    const double LG7 = 1.479819860511658591e-01;
+
+    // Subnormals are scaled to normals first
+    Int subnormal = x < 2.2250738585072014e-308;
+    Double normal = subnormal ? x * 18014398509481984.0 : x;
+    Int k = subnormal ? Int {} - 54 : Int {};
+
+    // x = 2^k (1 + f), with 1 + f in [sqrt(2)/2, sqrt(2)]
+    Int bits = toBits<Int>(normal);
+    Int high = (bits >> 32) + (0x3FF00000 - 0x3FE6A09E);
+    k += (high >> 20) - 0x3FF;
+    high = (high & 0x000FFFFF) + 0x3FE6A09E;
+    Double f = fromBits<Double>((high << 32) | (bits & 0xFFFFFFFF)) - 1.0;
+
+    // log(1 + f) = f - f^2 / 2 + s (f^2 / 2 + R(s^2)), s = f / (2 + f)
+    Double halfSquare = 0.5 * f * f;
+    Double s = f / (2.0 + f);
+    Double z = s * s;
+    Double w = z * z;
+    Double t1 = w * (LG2 + w * (LG4 + w * LG6));
+    Double t2 = z * (LG1 + w * (LG3 + w * (LG5 + w * LG7)));
+    Double dk = toDouble<Double>(k);
+    Double result = s * (halfSquare + (t2 + t1)) + dk * LN2_LO - halfSquare + f + dk * LN2_HI;
+
+    result = x == HUGE_VAL ? x : result;
+    result = x == 0.0 ? Double {} - HUGE_VAL : result;
+    return x < 0.0 || x != x ? Double {} + NAN : result;
+}
+
+// sin and cos of x + y, |x + y| <= pi / 4, y being a small correction to x
+template <typename Double>
+VECTOR_MATH_INLINE Double sinKernel(const Double &x, const Double &y)
+{
+    const double S1 = -1.66666666666666324348e-01;
+    const double S2 = 8.33333333332248946124e-03;
+    const double S3 = -1.98412698298579493134e-04;
+    const double S4 = 2.75573137070700676789e-06;
+    const double S5 = -2.50507602534068634195e-08;
+    const double S6 = 1.58969099521155010221e-10;
+    Double z = x * x;
+    Double w = z * z;
+    Double r = S2 + z * (S3 + z * S4) + z * w * (S5 + z * S6);
+    Double v = z * x;
+    return x - ((z * (0.5 * y - v * r) - y) - v * S1);
+}
+
+template <typename Double>
+VECTOR_MATH_INLINE Double cosKernel(const Double &x, const Double &y)
+{
+    const double C1 = 4.16666666666666019037e-02;
+    const double C2 = -1.38888888888741095749e-03;
+    const double C3 = 2.48015872894767294178e-05;
+    const double C4 = -2.75573143513906633035e-07;
+    const double C5 = 2.08757232129817482790e-09;
+    const double C6 = -1.13596475577881948265e-11;
+    Double z = x * x;
+    Double w = z * z;
+    Double r = z * (C1 + z * (C2 + z * C3)) + w * w * (C4 + z * (C5 + z * C6));
+    Double halfZ = 0.5 * z;
+    w = 1.0 - halfZ;
+    return w + (((1.0 - w) - halfZ) + (z * r - x * y));
+}
+
+// a + b = sum + error exactly
+template <typename Double>
+VECTOR_MATH_INLINE void twoSum(const Double &a, const Double &b, Double &sum, Double &error)
+{
+    sum = a + b;
+    Double bPart = sum - a;
+    error = (a - (sum - bPart)) + (b - bPart);
+}
+
+// x = n pi / 2 + r + y, for |x| <= VECTOR_MATH_MAX_REDUCED: pi / 2 is split in parts of
+// 33 bits, so that n times the first two is exact, and the rest kept as a correction y
+template <int LANES>
+VECTOR_MATH_INLINE void reduce(const typename Lanes<LANES>::Double &x, typename Lanes<LANES>::Double &r,
+                               typename Lanes<LANES>::Double &y, typename Lanes<LANES>::Int &quadrant)
+{
+    typedef typename Lanes<LANES>::Double Double;
+    typedef typename Lanes<LANES>::Int Int;
+    const double TWO_OVER_PI = 6.36619772367581382433e-01;
+    const double PIO2_1 = 1.57079632673412561417e+00;
+    const double PIO2_2 = 6.07710050630396597660e-11;
+    const double PIO2_3 = 2.02226624871116645580e-21;
+    const double PIO2_3T = 8.47842766036889956997e-32;
+
+    Double rounded = x * TWO_OVER_PI + ROUNDING;
+    quadrant = toBits<Int>(rounded) & 3;
+    Double n = rounded - ROUNDING;
+
+    Double sum, error, lowError;
+    twoSum<Double>(x - n * PIO2_1, -(n * PIO2_2), sum, error);
+    twoSum<Double>(sum, -(n * PIO2_3), r, lowError);
+    y = (error + lowError) - n * PIO2_3T;
+    Double high = r + y;
+    y = (r - high) + y;
+    r = high;
+}
+
+// Which of sin, cos and tan
+enum Trigonometric {
+    SIN,
+    COS,
+    TAN
+};
+
+template <Trigonometric function, int LANES>
+VECTOR_MATH_INLINE typename Lanes<LANES>::Double trigonometricLanes(const typename Lanes<LANES>::Double &x)
+{
+    typedef typename Lanes<LANES>::Double Double;
+    typedef typename Lanes<LANES>::Int Int;
+
+    Double r, y;
+    Int quadrant;
+    reduce<LANES>(x, r, y, quadrant);
+    Double sine = sinKernel(r, y);
+    Double cosine = cosKernel(r, y);
+
+    Double result;
+    if (function == SIN) {
+        // sin, cos, -sin, -cos in quadrants 0 to 3
+        result = (quadrant & 1) != 0 ? cosine : sine;
+        result = (quadrant & 2) != 0 ? -result : result;
+    } else if (function == COS) {
+        // cos, -sin, -cos, sin
+        result = (quadrant & 1) != 0 ? sine : cosine;
+        result = ((quadrant + 1) & 2) != 0 ? -result : result;
+    } else {
+        // sin / cos, then -cos / sin, every other quadrant
+        result = (quadrant & 1) != 0 ? -cosine / sine : sine / cosine;
+    }
+
+    // Tiny values are their own sine and tangent, keeping the sign of zeros
+    Int tiny = absolute<Double, Int>(x) < 7.450580596923828125e-9;
+    return tiny ? (function == COS ? Double {} + 1.0 : x) : result;
+}
+
+// Lanes out of the reduced range, infinities and NaNs, are left to libm
+template <int LANES>
+VECTOR_MATH_INLINE bool anyUnreduced(const typename Lanes<LANES>::Double &x, typename Lanes<LANES>::Int &unreduced)
+{
+    typedef typename Lanes<LANES>::Double Double;
+    typedef typename Lanes<LANES>::Int Int;
+    unreduced = !(absolute<Double, Int>(x) <= VECTOR_MATH_MAX_REDUCED);
+    std::int64_t any = 0;
+    for (int lane = 0; lane < LANES; ++lane) {
+        any |= unreduced[lane];
+    }
+    return any != 0;
+}
+
+struct Exp {
+    template <int LANES>
+    static VECTOR_MATH_INLINE typename Lanes<LANES>::Double apply(const typename Lanes<LANES>::Double &x) { return expLanes<LANES>(x); }
+};
+
+struct Log {
+    template <int LANES>
+    static VECTOR_MATH_INLINE typename Lanes<LANES>::Double apply(const typename Lanes<LANES>::Double &x) { return logLanes<LANES>(x); }
+};
+
+template <Trigonometric function, double (*libm)(double)>
+struct Trigonometry {
+    template <int LANES>
+    static VECTOR_MATH_INLINE typename Lanes<LANES>::Double apply(const typename Lanes<LANES>::Double &x) {
+        typename Lanes<LANES>::Double result = trigonometricLanes<function, LANES>(x);
+        typename Lanes<LANES>::Int unreduced;
+        if (anyUnreduced<LANES>(x, unreduced)) {
+            for (int lane = 0; lane < LANES; ++lane) {
+                if (unreduced[lane] != 0) {
+                    result[lane] = libm(x[lane]);
+                }
+            }
+        }
+        return result;
+    }
+};
+
+using Sin = Trigonometry<SIN, std::sin>;
+using Cos = Trigonometry<COS, std::cos>;
+using Tan = Trigonometry<TAN, std::tan>;
+
+// The values left over are run through a vector of their own, so that each value is
+// computed the same way wherever it is in the array
+template <typename Function, int LANES>
+VECTOR_MATH_INLINE void mapLanes(double *values, std::size_t n)
+{
+    typedef typename Lanes<LANES>::Double Double;
+    std::size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        Double lanes;
+        std::memcpy(&lanes, values + i, sizeof(lanes));
+        lanes = Function::template apply<LANES>(lanes);
+        std::memcpy(values + i, &lanes, sizeof(lanes));
+    }
+    if (i < n) {
+        Double lanes = Double {} + 1.0;
+        std::memcpy(&lanes, values + i, (n - i) * sizeof(double));
+        lanes = Function::template apply<LANES>(lanes);
+        std::memcpy(values + i, &lanes, (n - i) * sizeof(double));
+    }
+}
+
+template <typename Function>
+__attribute__((target("sse2")))
+void mapSse2(double *values, std::size_t n)
+{
+    mapLanes<Function, 2>(values, n);
+}
+
+template <typename Function>
+__attribute__((target("avx2")))
+void mapAvx2(double *values, std::size_t n)
+{
+    mapLanes<Function, 4>(values, n);
+}
+
+template <typename Function>
+__attribute__((target("avx512f")))
+void mapAvx512(double *values, std::size_t n)
+{
+    mapLanes<Function, 8>(values, n);
+}
+
+}
+
+const VectorMath sse2VectorMath = {
+    "sse2", mapSse2<Exp>, mapSse2<Log>, mapSse2<Sin>, mapSse2<Cos>, mapSse2<Tan>
+};
+
+const VectorMath avx2VectorMath = {
+    "avx2", mapAvx2<Exp>, mapAvx2<Log>, mapAvx2<Sin>, mapAvx2<Cos>, mapAvx2<Tan>
+};
+
+const VectorMath avx512VectorMath = {
+    "avx512", mapAvx512<Exp>, mapAvx512<Log>, mapAvx512<Sin>, mapAvx512<Cos>, mapAvx512<Tan>
+};
+
+#endif
@@ -0,0 +1,299 @@
+#include "virtualMachine.h"
+
+// Computed gotos are a GCC and Clang extension; other compilers, and builds defining
+// VIRTUAL_MACHINE_SWITCH_DISPATCH, only have the switch loop
+#if defined(__GNUC__) && !defined(VIRTUAL_MACHINE_SWITCH_DISPATCH)
+#define VIRTUAL_MACHINE_HAS_THREADED 1
+#endif
+
+Dispatch VirtualMachine::defaultDispatch()
+{
+#ifdef VIRTUAL_MACHINE_HAS_THREADED
+    return Dispatch::THREADED;
+#else
+    return Dispatch::SWITCH;
+#endif
+}
+
+bool VirtualMachine::isSupported(Dispatch dispatch)
+{
+    return dispatch == Dispatch::SWITCH || dispatch == defaultDispatch();
+}
+
+bool VirtualMachine::setDispatch(Dispatch dispatch)
+{
+    if (!isSupported(dispatch)) {
+        return false;
+    }
+    dispatch_ = dispatch;
+    return true;
+}
+
+bool VirtualMachine::setJit(bool enabled, std::size_t callThreshold)
+{
+    if (enabled && !JitFunction::isSupported()) {
+        return false;
+    }
+    jit_ = enabled;
+    jitThreshold_ = callThreshold;
+    compiledFunctions_ = SymbolMap<std::shared_ptr<CompiledFunction>>();
+    return true;
+}
+
+void VirtualMachine::setClosures(bool enabled, std::size_t callThreshold)
+{
+    closures_ = enabled;
+    closureThreshold_ = callThreshold;
+    compiledFunctions_ = SymbolMap<std::shared_ptr<CompiledFunction>>();
+}
+
+Tier VirtualMachine::tier(SymbolId name) const
+{
+    const std::shared_ptr<CompiledFunction> *found = compiledFunctions_.find(name);
+    if (found == nullptr) {
+        return Tier::BYTECODE;
+    }
+    if ((*found)->native.valid()) {
+        return Tier::NATIVE;
+    }
+    return (*found)->closures.valid() ? Tier::CLOSURES : Tier::BYTECODE;
+}
+
+std::size_t VirtualMachine::calls(SymbolId name) const
+{
+    const std::shared_ptr<CompiledFunction> *found = compiledFunctions_.find(name);
+    return found == nullptr ? 0 : (*found)->calls;
+}
+
+double VirtualMachine::run(const Bytecode &code, EvaluationContext &context, double parameter)
+{
+    return execute(code, context, parameter);
+}
+
+double VirtualMachine::execute(const Bytecode &code, EvaluationContext &context, double parameter)
+{
+    return dispatch_ == Dispatch::THREADED
+        ? executeThreaded(code, context, parameter)
+        : executeSwitch(code, context, parameter);
+}
+
+// Both loops below run the instructions the same way. top points past the top value.
+// The temporaries of a run lie below its values on the stack.
+// A user function call may grow the stack, so the depth is kept across it rather than the pointer.
+
+double VirtualMachine::executeSwitch(const Bytecode &code, EvaluationContext &context, double parameter)
+{
+    std::size_t base = stack_.size();
+    stack_.resize(base + code.temporaries() + code.maxDepth());
+    double *temporaries = stack_.data() + base;
+    double *top = temporaries + code.temporaries();
+
+    const Instruction *instruction = code.instructions().data();
+    while (true) {
+        switch (instruction->opcode) {
+            case Opcode::CONSTANT:
+                *top++ = code.constant(instruction->operand);
+                break;
+            case Opcode::PARAMETER:
+                *top++ = parameter;
+                break;
+            case Opcode::VARIABLE:
+                *top++ = context.getVariableValue(instruction->operand);
+                break;
+            case Opcode::ADD:
+                --top;
+                top[-1] += top[0];
+                break;
+            case Opcode::SUBTRACT:
+                --top;
+                top[-1] -= top[0];
+                break;
+            case Opcode::MULTIPLY:
+                --top;
+                top[-1] *= top[0];
+                break;
+            case Opcode::DIVIDE:
+                --top;
+                top[-1] /= top[0];
+                break;
+            case Opcode::CALL_BUILTIN:
+                top[-1] = code.builtin(instruction->operand)(top[-1]);
+                break;
+            case Opcode::CALL_USER: {
+                std::size_t depth = top - (stack_.data() + base);
+                double result = callUserFunction(instruction->operand, top[-1], context);
+                temporaries = stack_.data() + base;
+                top = temporaries + depth;
+                top[-1] = result;
+                break;
+            }
+            case Opcode::CALL_UNKNOWN:
+                top[-1] = context.callFunction(instruction->operand, top[-1]);
+                break;
+            case Opcode::RETURN: {
+                double result = top[-1];
+                stack_.resize(base);
+                return result;
+            }
+            case Opcode::MULTIPLY_VARIABLE:
+                top[-1] *= context.getVariableValue(instruction->operand);
+                break;
+            case Opcode::MULTIPLY_PARAMETER:
+                top[-1] *= parameter;
+                break;
+            case Opcode::ADD_CONSTANT:
+                top[-1] += code.constant(instruction->operand);
+                break;
+            case Opcode::MULTIPLY_CALL_BUILTIN:
+                --top;
+                top[-1] *= code.builtin(instruction->operand)(top[0]);
+                break;
+            case Opcode::STORE:
+                temporaries[instruction->operand] = top[-1];
+                break;
+            case Opcode::LOAD:
+                *top++ = temporaries[instruction->operand];
+                break;
+        }
+        ++instruction;
+    }
+}
+
+#ifdef VIRTUAL_MACHINE_HAS_THREADED
+
+double VirtualMachine::executeThreaded(const Bytecode &code, EvaluationContext &context, double parameter)
+{
+    // In the order of Opcode
+    static const void *const labels[] = {
+        &&constant, &&parameterLabel, &&variable, &&add, &&subtract, &&multiply, &&divide,
+        &&callBuiltin, &&callUser, &&callUnknown, &&returnLabel,
+        &&multiplyVariable, &&multiplyParameter, &&addConstant, &&multiplyCallBuiltin,
+        &&store, &&load
+    };
+
+    std::size_t base = stack_.size();
+    stack_.resize(base + code.temporaries() + code.maxDepth());
+    double *temporaries = stack_.data() + base;
+    double *top = temporaries + code.temporaries();
+
+    const Instruction *instruction = code.instructions().data();
+#define DISPATCH() goto *labels[static_cast<std::size_t>(instruction->opcode)]
+#define NEXT() ++instruction; DISPATCH()
+
+    DISPATCH();
+
+constant:
+    *top++ = code.constant(instruction->operand);
+    NEXT();
+parameterLabel:
+    *top++ = parameter;
+    NEXT();
+variable:
+    *top++ = context.getVariableValue(instruction->operand);
+    NEXT();
+add:
+    --top;
+    top[-1] += top[0];
+    NEXT();
+subtract:
+    --top;
+    top[-1] -= top[0];
+    NEXT();
+multiply:
+    --top;
+    top[-1] *= top[0];
+    NEXT();
+divide:
+    --top;
+    top[-1] /= top[0];
+    NEXT();
+callBuiltin:
+    top[-1] = code.builtin(instruction->operand)(top[-1]);
+    NEXT();
+callUser: {
+    std::size_t depth = top - (stack_.data() + base);
+    double result = callUserFunction(instruction->operand, top[-1], context);
+    temporaries = stack_.data() + base;
+    top = temporaries + depth;
+    top[-1] = result;
+    NEXT();
+}
+callUnknown:
+    top[-1] = context.callFunction(instruction->operand, top[-1]);
+    NEXT();
+returnLabel: {
+    double result = top[-1];
+    stack_.resize(base);
+    return result;
+}
+multiplyVariable:
+    top[-1] *= context.getVariableValue(instruction->operand);
+    NEXT();
+multiplyParameter:
+    top[-1] *= parameter;
+    NEXT();
+addConstant:
+    top[-1] += code.constant(instruction->operand);
+    NEXT();
+multiplyCallBuiltin:
+    --top;
+    top[-1] *= code.builtin(instruction->operand)(top[0]);
+    NEXT();
+store:
+    temporaries[instruction->operand] = top[-1];
+    NEXT();
+load:
+    *top++ = temporaries[instruction->operand];
+    NEXT();
+
+#undef NEXT
+#undef DISPATCH
+}
+
+#else
+
+double VirtualMachine::executeThreaded(const Bytecode &code, EvaluationContext &context, double parameter)
+{
+    return executeSwitch(code, context, parameter);
+}
+
+#endif
+
+double VirtualMachine::callUserFunction(SymbolId name, double argument, EvaluationContext &context)
+{
+    // Functions are never undefined, so one known when compiling still is
+    const userFunctionsMap &functions = context.userFunctions();
+    const UserFunctionPtr &source = *functions.find(name);
+    const UserFunction &function = *source;
+
+    const std::shared_ptr<CompiledFunction> *found = compiledFunctions_.find(name);
+    if (found == nullptr || (*found)->source != source
+            || (*found)->code.functionsDefined() != functions.size()) {
+        std::shared_ptr<CompiledFunction> fresh = std::make_shared<CompiledFunction>();
+        fresh->source = source;
+        fresh->code = Bytecode::compile(function, functions);
+        fresh->calls = 0;
+        compiledFunctions_.set(name, fresh);
+        found = compiledFunctions_.find(name);
+    }
+
+    // Nothing is defined while running, so the code is not recompiled under this call
+    CompiledFunction &compiled = **found;
+    ++compiled.calls;
+    if (closures_ && compiled.calls == closureThreshold_) {
+        compiled.closures = ClosureFunction::compile(compiled.code);
+    }
+    if (jit_ && compiled.calls == jitThreshold_) {
+        compiled.native = JitFunction::compile(compiled.code);
+    }
+
+    return context.withParameter(function.argumentName, argument, [&]() {
+        if (compiled.native.valid()) {
+            return compiled.native(argument, *this, context);
+        }
+        if (compiled.closures.valid()) {
+            return compiled.closures(argument, *this, context);
+        }
+        return execute(compiled.code, context, argument);
+    });
+}
@@ -0,0 +1,100 @@
+#ifndef VIRTUAL_MACHINE_H
+#define VIRTUAL_MACHINE_H
+
+#include <memory>
+#include <vector>
+
+#include "bytecode.h"
+#include "closure.h"
+#include "evaluation.h"
+#include "jit.h"
+
+// How the machine jumps from one instruction to the next: a switch in a loop, or
+// computed gotos (labels as values, a GCC and Clang extension), which give every
+// instruction its own indirect branch and so its own branch prediction
+enum class Dispatch {
+    SWITCH,
+    THREADED
+};
+
+// Where a call to a user function runs: its bytecode on the machine, its closures, or
+// its native code
+enum class Tier {
+    BYTECODE,
+    CLOSURES,
+    NATIVE
+};
+
+// Runs bytecode on a stack of doubles. The body of a user function is compiled on its
+// first call and kept, until the function is redefined or a new function is defined.
+// A function called a few times is also compiled to closures, then, called often
+// enough, to native code where JitFunction is supported; it runs in the last tier
+// it reached.
+//
+// Same semantics as Node::eval: names are looked up, and errors kept, in the context.
+class VirtualMachine
+{
+public:
+    static const std::size_t DEFAULT_CLOSURE_THRESHOLD = 4;
+    static const std::size_t DEFAULT_JIT_THRESHOLD = 100;
+
+    VirtualMachine()
+        : dispatch_(defaultDispatch()), closures_(true), closureThreshold_(DEFAULT_CLOSURE_THRESHOLD),
+          jit_(JitFunction::isSupported()), jitThreshold_(DEFAULT_JIT_THRESHOLD) {}
+
+    // The parameter is what PARAMETER pushes, in code compiled from a function body
+    double run(const Bytecode &code, EvaluationContext &context, double parameter = 0);
+
+    // THREADED when the compiler supports it, unless the build defines
+    // VIRTUAL_MACHINE_SWITCH_DISPATCH
+    static Dispatch defaultDispatch();
+    static bool isSupported(Dispatch dispatch);
+
+    // Forces a dispatch, e.g. to compare them in benchmarks and tests.
+    // Returns false, changing nothing, if the build does not support it.
+    bool setDispatch(Dispatch dispatch);
+    inline Dispatch dispatch() const { return dispatch_; }
+
+    // Compiles user functions to native code from their callThreshold-th call on, or never.
+    // Returns false, changing nothing, if native code is not supported.
+    bool setJit(bool enabled, std::size_t callThreshold = DEFAULT_JIT_THRESHOLD);
+    inline bool jit() const { return jit_; }
+
+    // Compiles user functions to closures from their callThreshold-th call on, or never
+    void setClosures(bool enabled, std::size_t callThreshold = DEFAULT_CLOSURE_THRESHOLD);
+    inline bool closures() const { return closures_; }
+
+    // The tier the last call to a user function ran in, and the calls to it since it was last
+    // compiled, e.g. to check promotion in tests. BYTECODE and 0 for a function never called.
+    Tier tier(SymbolId name) const;
+    std::size_t calls(SymbolId name) const;
+
+    // Calls a user function in the tier it reached. Public for compiled code, native and closures.
+    double callUserFunction(SymbolId name, double argument, EvaluationContext &context);
+
+private:
+    // The stack of every run in progress: a user function called by a run has its
+    // values above those of the caller
+    std::vector<double> stack_;
+
+    struct CompiledFunction {
+        // Held, so that a definition replacing it cannot reuse its address
+        UserFunctionPtr source;
+        Bytecode code;
+        std::size_t calls;
+        ClosureFunction closures;
+        JitFunction native;
+    };
+    SymbolMap<std::shared_ptr<CompiledFunction>> compiledFunctions_;
+    Dispatch dispatch_;
+    bool closures_;
+    std::size_t closureThreshold_;
+    bool jit_;
+    std::size_t jitThreshold_;
+
+    double execute(const Bytecode &code, EvaluationContext &context, double parameter);
+    double executeSwitch(const Bytecode &code, EvaluationContext &context, double parameter);
+    double executeThreaded(const Bytecode &code, EvaluationContext &context, double parameter);
+};
+
+#endif
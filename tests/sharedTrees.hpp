@@ -0,0 +1,20 @@
+#ifndef SHARED_TREES_HPP
+#define SHARED_TREES_HPP
+
+#include <string>
+
+#include "node.h"
+
+// q(0) = name, q(k + 1) = q(k) / (q(k) + 1), which is name / (1 + k name). Made in the
+// arena, it is a DAG of a few nodes per level, but a tree exponential in the depth, and so
+// is its derivative, which has the quotient rule at every level.
+inline NodePtr nestedQuotient(NodeArena &arena, int depth, const std::string &name)
+{
+    NodePtr quotient = arena.make<VariableNode>(name);
+    for (int level = 0; level < depth; ++level) {
+        quotient = arena.make<DivisionNode>(quotient, arena.make<AdditionNode>(quotient, arena.make<NumberNode>(1)));
+    }
+    return quotient;
+}
+
+#endif
@@ -0,0 +1,108 @@
+#include <sstream>
+#include <cmath>
+#include <vector>
+
+#include "lest.hpp"
+
+#include "batch.h"
+#include "parser.h"
+#include "tierFixture.hpp"
+
+std::vector<BatchImplementation> supportedBatchImplementations()
+{
+    std::vector<BatchImplementation> supported;
+    BatchImplementation saved = currentBatchImplementation();
+    for (BatchImplementation implementation : {BatchImplementation::SCALAR, BatchImplementation::SSE2, BatchImplementation::AVX2, BatchImplementation::AVX512}) {
+        if (setBatchImplementation(implementation)) {
+            supported.push_back(implementation);
+        }
+    }
+    setBatchImplementation(saved);
+    return supported;
+}
+
+// Evaluates h, or its derivative, with the tree walker point by point and in a batch of
+// n points, with every supported implementation (see TierFixture): both must give the same
+// values, and the same errors. Values are the same bit for bit with the scalar
+// implementation, which calls libm, and for bodies without builtins; otherwise within a
+// relative 1e-12, as the builtins of the others differ from libm by a few ULPs.
+bool batchMatchesTree(const std::string &body, std::size_t n, bool derive = false)
+{
+    TierFixture fixture(body);
+    const UserFunction &h = fixture.h;
+    NodePtr tree = derive ? h.derivative(fixture.arena) : h.bodyNode;
+
+    std::vector<double> xs(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        xs[i] = -3 + 0.0625 * static_cast<double>(i % 97);
+    }
+
+    EvaluationContext treeContext(fixture.functions, fixture.variables);
+    std::vector<double> expected(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        expected[i] = treeContext.withParameter(h.argumentName, xs[i], [&]() { return tree->eval(treeContext); });
+    }
+
+    bool ok = true;
+    BatchImplementation saved = currentBatchImplementation();
+    for (BatchImplementation implementation : supportedBatchImplementations()) {
+        setBatchImplementation(implementation);
+        EvaluationContext batchContext(fixture.functions, fixture.variables);
+        std::vector<double> out(n);
+        if (derive) {
+            evalDerivativeBatch(h, batchContext, xs.data(), out.data(), n);
+        } else {
+            evalBatch(h, batchContext, xs.data(), out.data(), n);
+        }
+
+        bool callsBuiltins = false;
+        for (const char *builtin : {"exp(", "log(", "sin(", "cos(", "tan("}) {
+            callsBuiltins = callsBuiltins || body.find(builtin) != std::string::npos;
+        }
+        double tolerance = implementation != BatchImplementation::SCALAR && callsBuiltins ? 1e-12 : 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            ok = ok && sameValues(expected[i], out[i], tolerance);
+        }
+        ok = ok && sameErrors(treeContext, batchContext);
+    }
+    setBatchImplementation(saved);
+    return ok;
+}
+
+const lest::test testBatch[] = {
+    CASE("the best batch implementation is supported") {
+        EXPECT(setBatchImplementation(bestBatchImplementation()));
+        EXPECT(setBatchImplementation(BatchImplementation::SCALAR));
+        EXPECT(setBatchImplementation(bestBatchImplementation()));
+        EXPECT("scalar" == batchImplementationName(BatchImplementation::SCALAR));
+    },
+
+    CASE("Batches evaluate function bodies like the tree walker, at every point") {
+        for (std::size_t n : {0, 1, 3, 4, 7, 8, 9, 255, 256, 257, 1000}) {
+            EXPECT(batchMatchesTree("x * x * x - 3 * x + 1", n));
+        }
+        EXPECT(batchMatchesTree("x", 100));
+        EXPECT(batchMatchesTree("2.5", 100));
+        EXPECT(batchMatchesTree("sin(x) * cos(x) / (1 + exp(x))", 300));
+        EXPECT(batchMatchesTree("log(x * x + 1) - tan(x / 4) * 2 + exp(x)", 300));
+        EXPECT(batchMatchesTree("x * y + y / x - sin(y)", 300));
+        EXPECT(batchMatchesTree("1 / (x - 1) / (x + 2)", 300));
+    },
+
+    CASE("Batches call user functions, which see the parameters of their callers") {
+        EXPECT(batchMatchesTree("f(x) * g(x + 1) - f(f(x))", 300));
+        EXPECT(batchMatchesTree("g(2) + g(x)", 300));
+    },
+
+    CASE("Batches evaluate derivatives like the tree walker") {
+        EXPECT(batchMatchesTree("x * x * x - 3 * x + 1", 300, true));
+        EXPECT(batchMatchesTree("x / (x * x + 1) - 2 / x", 300, true));
+        EXPECT(batchMatchesTree("(x * y + 1) * (x - y) / (x + 4)", 300, true));
+    },
+
+    CASE("Batches keep the errors of the tree walker") {
+        EXPECT(batchMatchesTree("zz * x + 1", 300));
+        EXPECT(batchMatchesTree("unknown(x) - 2", 300));
+        EXPECT(batchMatchesTree("sin(x) * x", 300, true));
+    },
+};
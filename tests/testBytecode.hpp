@@ -0,0 +1,188 @@
+#include <sstream>
+#include <cmath>
+
+#include "lest.hpp"
+using lest::approx;
+
+#include "bytecode.h"
+#include "parser.h"
+#include "sharedTrees.hpp"
+#include "tierFixture.hpp"
+#include "virtualMachine.h"
+
+// Compiles the body of h as an expression, its parameter looked up like any name, and runs
+// it on the virtual machine at x = 0.7 (see TierFixture), in each dispatch the build supports
+bool bytecodeMatchesTree(const std::string &body)
+{
+    TierFixture fixture(body);
+    Bytecode code = Bytecode::compile(fixture.h.bodyNode, fixture.functions);
+
+    bool matches = true;
+    for (Dispatch dispatch : {Dispatch::SWITCH, Dispatch::THREADED}) {
+        VirtualMachine machine;
+        if (!machine.setDispatch(dispatch)) {
+            continue;
+        }
+        matches = matches && fixture.matchesTreeAt(0.7, [&](double, EvaluationContext &context) { return machine.run(code, context); });
+    }
+    return matches;
+}
+
+std::string runBytecodeProgram(const std::string &program)
+{
+    std::ostringstream out;
+    Parser parser(program.data(), program.data() + program.size(), out);
+    Status status = parser.run();
+    return status.ok() ? out.str() : out.str() + status.message();
+}
+
+const lest::test testBytecode[] = {
+    CASE("Expressions compile to post-order stack code") {
+        NodeArena arena;
+        NodePtr x = arena.make<VariableNode>("x");
+        NodePtr node = arena.make<AdditionNode>(
+            arena.make<MultiplicationNode>(arena.make<NumberNode>(2), x),
+            arena.make<FunctionCallNode>("sin", x));
+        userFunctionsMap functions;
+        Bytecode code = Bytecode::compile(node, functions);
+
+        // 2 * x fuses into a superinstruction
+        const Opcode expected[] = {Opcode::CONSTANT, Opcode::MULTIPLY_VARIABLE,
+                                   Opcode::VARIABLE, Opcode::CALL_BUILTIN, Opcode::ADD, Opcode::RETURN};
+        EXPECT(6u == code.instructions().size());
+        for (std::size_t i = 0; i < code.instructions().size(); ++i) {
+            EXPECT(expected[i] == code.instructions()[i].opcode);
+        }
+        EXPECT(2 == code.constant(code.instructions()[0].operand));
+        EXPECT(intern("x") == code.instructions()[1].operand);
+        EXPECT(findBuiltinFunction(intern("sin")) == code.builtin(code.instructions()[3].operand));
+        EXPECT(2u == code.maxDepth());
+    },
+
+    CASE("Function bodies compile their parameter and resolve their calls") {
+        NodeArena arena;
+        NodePtr body = arena.make<FunctionCallNode>("h",
+            arena.make<FunctionCallNode>("f", arena.make<SubtractionNode>(arena.make<VariableNode>("y"), arena.make<VariableNode>("x"))));
+        UserFunctionPtr f(new UserFunction{intern("f"), intern("y"), body});
+        userFunctionsMap functions {{f->name, f}};
+        Bytecode code = Bytecode::compile(*f, functions);
+
+        const Opcode expected[] = {Opcode::PARAMETER, Opcode::VARIABLE, Opcode::SUBTRACT,
+                                   Opcode::CALL_USER, Opcode::CALL_UNKNOWN, Opcode::RETURN};
+        EXPECT(6u == code.instructions().size());
+        for (std::size_t i = 0; i < code.instructions().size(); ++i) {
+            EXPECT(expected[i] == code.instructions()[i].opcode);
+        }
+        EXPECT(1u == code.functionsDefined());
+    },
+
+    CASE("Operations fuse with a right operand that is a leaf or a builtin call") {
+        NodeArena arena;
+        NodePtr x = arena.make<VariableNode>("x");
+        NodePtr sinX = arena.make<FunctionCallNode>("sin", x);
+        // ((x * y) + 1) * sin x, as the derivatives make them, then x * (y * 2) which does not fuse
+        NodePtr node = arena.make<SubtractionNode>(
+            arena.make<MultiplicationNode>(arena.make<AdditionNode>(arena.make<MultiplicationNode>(x, x), arena.make<NumberNode>(1)), sinX),
+            arena.make<MultiplicationNode>(x, arena.make<MultiplicationNode>(arena.make<NumberNode>(2), arena.make<NumberNode>(3))));
+        UserFunctionPtr f(new UserFunction{intern("f"), intern("x"), node});
+        userFunctionsMap functions;
+        Bytecode code = Bytecode::compile(*f, functions);
+
+        const Opcode expected[] = {Opcode::PARAMETER, Opcode::MULTIPLY_PARAMETER, Opcode::ADD_CONSTANT,
+                                   Opcode::PARAMETER, Opcode::MULTIPLY_CALL_BUILTIN,
+                                   Opcode::PARAMETER, Opcode::CONSTANT, Opcode::CONSTANT, Opcode::MULTIPLY, Opcode::MULTIPLY,
+                                   Opcode::SUBTRACT, Opcode::RETURN};
+        EXPECT(12u == code.instructions().size());
+        for (std::size_t i = 0; i < code.instructions().size(); ++i) {
+            EXPECT(expected[i] == code.instructions()[i].opcode);
+        }
+        EXPECT(4u == code.maxDepth());
+
+        // Same value with both dispatches
+        variablesMap variables;
+        for (Dispatch dispatch : {Dispatch::SWITCH, Dispatch::THREADED}) {
+            VirtualMachine machine;
+            if (!machine.setDispatch(dispatch)) {
+                continue;
+            }
+            EvaluationContext context(functions, variables);
+            double value = context.withParameter(intern("x"), 0.5, [&]() { return machine.run(Bytecode::compile(node, functions), context); });
+            EXPECT(approx((0.25 + 1) * std::sin(0.5) - 0.5 * 6) == value);
+        }
+    },
+
+    CASE("A subtree used more than once is computed once, into a temporary") {
+        NodeArena arena;
+        NodePtr sinX = arena.make<FunctionCallNode>("sin", arena.make<VariableNode>("x"));
+        userFunctionsMap functions;
+        Bytecode code = Bytecode::compile(arena.make<MultiplicationNode>(sinX, sinX), functions);
+
+        const Opcode expected[] = {Opcode::VARIABLE, Opcode::CALL_BUILTIN, Opcode::STORE,
+                                   Opcode::LOAD, Opcode::MULTIPLY, Opcode::RETURN};
+        EXPECT(6u == code.instructions().size());
+        for (std::size_t i = 0; i < code.instructions().size(); ++i) {
+            EXPECT(expected[i] == code.instructions()[i].opcode);
+        }
+        EXPECT(1u == code.temporaries());
+        EXPECT(2u == code.maxDepth());
+    },
+
+    CASE("Nested quotient derivatives compile to code linear in their depth, and run like the tree walker") {
+        NodeArena arena;
+        userFunctionsMap functions;
+        variablesMap variables;
+        std::size_t sizes[3];
+        for (int i = 0; i < 3; ++i) {
+            UserFunction h {intern("h"), intern("x"), nestedQuotient(arena, 20 * (i + 1), "x")->derivative(intern("x"), arena)};
+            Bytecode code = Bytecode::compile(h, functions);
+            sizes[i] = code.instructions().size();
+
+            for (Dispatch dispatch : {Dispatch::SWITCH, Dispatch::THREADED}) {
+                VirtualMachine machine;
+                if (!machine.setDispatch(dispatch)) {
+                    continue;
+                }
+                EvaluationContext treeContext(functions, variables);
+                EvaluationContext machineContext(functions, variables);
+                double treeValue = treeContext.withParameter(h.argumentName, 0.5, [&]() { return h.bodyNode->eval(treeContext); });
+                EXPECT(treeValue == machine.run(code, machineContext, 0.5));
+            }
+        }
+        std::size_t growth = sizes[1] - sizes[0];
+        EXPECT(growth == sizes[2] - sizes[1]);
+    },
+
+    CASE("The stack depth of right nested expressions grows with the nesting") {
+        std::istringstream input{"1 - (2 - (3 - (4 - x)))"};
+        Parser parser(input);
+        userFunctionsMap functions;
+        EXPECT(5u == Bytecode::compile(parser.getNextExpressionNode(), functions).maxDepth());
+    },
+
+    CASE("The virtual machine evaluates like the tree walker") {
+        EXPECT(bytecodeMatchesTree("1"));
+        EXPECT(bytecodeMatchesTree("x"));
+        EXPECT(bytecodeMatchesTree("1 - 2 - 3 * x / y + 4"));
+        EXPECT(bytecodeMatchesTree("sin(x) * cos(y) - exp(log(x)) / tan(1)"));
+        EXPECT(bytecodeMatchesTree("f(x) + f(f(y))"));
+        EXPECT(bytecodeMatchesTree("g(2) * g(f(3))"));
+        EXPECT(bytecodeMatchesTree("1 / 0 - x"));
+        EXPECT(bytecodeMatchesTree("zz + x"));
+        EXPECT(bytecodeMatchesTree("unknown(x) * 2"));
+    },
+
+    CASE("Compiled function bodies follow the definitions made after them") {
+        // A builtin hidden by a user function, a user function redefined, and one defined late
+        EXPECT("0.841471\n2\n" == runBytecodeProgram("def f x = sin(x)\nf(1)\ndef sin x = 2 * x\nf(1)\n"));
+        EXPECT("3\n4\n" == runBytecodeProgram("def f x = x\nf(3)\ndef f x = x + 1\nf(3)\n"));
+        // The definition replaced in between may leave its address to the last one
+        EXPECT("1\n3\n" == runBytecodeProgram("def f x = x\nf(1)\ndef f x = 2 * x\ndef f x = 3 * x\nf(1)\n"));
+        EXPECT("Unknown function: h" == runBytecodeProgram("def g x = h(x)\ng(2)\n"));
+        EXPECT("6\n" == runBytecodeProgram("def g x = h(x)\ndef h x = x * 3\ng(2)\n"));
+    },
+
+    CASE("Function bodies run by the virtual machine see the parameters of their callers") {
+        EXPECT("109\n" == runBytecodeProgram("x = 100\ndef g y = y + x\ndef f x = g(x * 2)\nf(3) + x\n"));
+        EXPECT("Unknown variable: zz" == runBytecodeProgram("def f x = x + zz\n1 + f(2)\n"));
+    },
+};
@@ -0,0 +1,146 @@
+#include <sstream>
+#include <cmath>
+
+#include "lest.hpp"
+
+#include "bytecode.h"
+#include "closure.h"
+#include "parser.h"
+#include "tierFixture.hpp"
+#include "virtualMachine.h"
+
+// Compiles h, or its derivative, to closures and compares them with the tree walker
+// (see TierFixture)
+bool closuresMatchTree(const std::string &body, bool derive = false)
+{
+    TierFixture fixture(body, derive);
+    ClosureFunction closures = ClosureFunction::compile(Bytecode::compile(fixture.h, fixture.functions));
+    VirtualMachine machine;
+    return closures.valid()
+        && fixture.matchesTree([&](double x, EvaluationContext &context) { return closures(x, machine, context); });
+}
+
+const lest::test testClosure[] = {
+    CASE("Closures evaluate function bodies like the tree walker") {
+        EXPECT(closuresMatchTree("x"));
+        EXPECT(closuresMatchTree("2.5"));
+        EXPECT(closuresMatchTree("x * x * x - 3 * x + 1"));
+        EXPECT(closuresMatchTree("sin(x) * cos(x) / (1 + exp(x))"));
+        EXPECT(closuresMatchTree("log(x * x + 1) - tan(x / 4) * 2 + exp(x)"));
+        EXPECT(closuresMatchTree("x * y + y / x - sin(y)"));
+        EXPECT(closuresMatchTree("f(x) * g(x + 1) - f(f(x))"));
+        EXPECT(closuresMatchTree("sin(2) + f(3) * y - 4 / 2"));
+        EXPECT(closuresMatchTree("1 / (x - 1) / (x + 2)"));
+    },
+
+    CASE("Closures evaluate derivatives like the tree walker") {
+        EXPECT(closuresMatchTree("x * x * x - 3 * x + 1", true));
+        EXPECT(closuresMatchTree("x / (x * x + 1) - 2 / x", true));
+        EXPECT(closuresMatchTree("(x * y + 1) * (x - y) / (x + 4)", true));
+    },
+
+    CASE("Closures keep the errors of the tree walker") {
+        EXPECT(closuresMatchTree("zz * x + 1"));
+        EXPECT(closuresMatchTree("unknown(x) - 2"));
+        EXPECT(closuresMatchTree("sin(x) * x", true));
+    },
+
+    CASE("Each tier of the machine computes a subtree used more than once once") {
+        // h x = f(x) * f(x): the call to f is one shared node, so a call to h calls f once
+        NodeArena arena;
+        NodePtr fBody = arena.make<AdditionNode>(arena.make<VariableNode>("x"), arena.make<NumberNode>(1));
+        NodePtr fOfX = arena.make<FunctionCallNode>("f", arena.make<VariableNode>("x"));
+        UserFunctionPtr f(new UserFunction{intern("f"), intern("x"), fBody});
+        UserFunctionPtr h(new UserFunction{intern("h"), intern("x"), arena.make<MultiplicationNode>(fOfX, fOfX)});
+        userFunctionsMap functions {{f->name, f}, {h->name, h}};
+        variablesMap variables;
+        Bytecode call = Bytecode::compile(arena.make<FunctionCallNode>("h", arena.make<NumberNode>(2)), functions);
+
+        for (Tier tier : {Tier::BYTECODE, Tier::CLOSURES, Tier::NATIVE}) {
+            VirtualMachine machine;
+            machine.setClosures(tier == Tier::CLOSURES, 1);
+            if (!machine.setJit(tier == Tier::NATIVE, 1)) {
+                continue;
+            }
+            EvaluationContext context(functions, variables);
+            EXPECT(9 == machine.run(call, context));
+            EXPECT(tier == machine.tier(h->name));
+            EXPECT(1u == machine.calls(f->name));
+        }
+    },
+
+    CASE("Constant and parameter operands are read by their operation, not by closures of their own") {
+        std::istringstream input{"x * 2 + 1"};
+        Parser parser(input);
+        UserFunction h {intern("h"), intern("x"), parser.getNextExpressionNode()};
+        userFunctionsMap functions;
+        ClosureFunction closures = ClosureFunction::compile(Bytecode::compile(h, functions));
+        EXPECT(closures.valid());
+        EXPECT(2u == closures.size());
+    },
+
+    CASE("Bodies too deep to run recursively are not compiled to closures, and run on the machine") {
+        std::string body = "x";
+        for (std::size_t level = 0; level <= ClosureFunction::MAX_HEIGHT; ++level) {
+            body += " + x";
+        }
+        std::istringstream input{body};
+        Parser parser(input);
+        UserFunction h {intern("h"), intern("x"), parser.getNextExpressionNode()};
+        userFunctionsMap functions;
+        EXPECT(!ClosureFunction::compile(Bytecode::compile(h, functions)).valid());
+
+        std::ostringstream out;
+        std::string program = "def h x = " + body + "\nh(1) + h(1) + h(1) + h(1) + h(1) + h(1)\n";
+        Parser programParser(program.data(), program.data() + program.size(), out);
+        EXPECT(programParser.run().ok());
+        std::string expected = std::to_string(6 * (ClosureFunction::MAX_HEIGHT + 2)) + "\n";
+        EXPECT(expected == out.str());
+    },
+
+    CASE("The machine runs functions as closures from their threshold call on") {
+        VirtualMachine machine;
+        machine.setJit(false);
+        machine.setClosures(true, 2);
+        NodeArena arena;
+        NodePtr body = arena.make<MultiplicationNode>(arena.make<VariableNode>("x"), arena.make<VariableNode>("y"));
+        UserFunctionPtr f(new UserFunction{intern("f"), intern("x"), body});
+        userFunctionsMap functions {{f->name, f}};
+        variablesMap variables {{intern("y"), 3}};
+        EvaluationContext context(functions, variables);
+
+        Bytecode call = Bytecode::compile(arena.make<FunctionCallNode>("f", arena.make<NumberNode>(2)), functions);
+        for (int i = 0; i < 5; ++i) {
+            EXPECT(6 == machine.run(call, context));
+        }
+        EXPECT(context.status().ok());
+    },
+
+    CASE("The machine promotes a function to closures at its 4th call and to native code at its 100th") {
+        VirtualMachine machine;
+        NodeArena arena;
+        NodePtr body = arena.make<MultiplicationNode>(arena.make<VariableNode>("x"), arena.make<NumberNode>(3));
+        UserFunctionPtr f(new UserFunction{intern("f"), intern("x"), body});
+        userFunctionsMap functions {{f->name, f}};
+        variablesMap variables;
+        EvaluationContext context(functions, variables);
+        Bytecode call = Bytecode::compile(arena.make<FunctionCallNode>("f", arena.make<NumberNode>(2)), functions);
+
+        // Where native code is not supported, functions stay in closures
+        Tier last = JitFunction::isSupported() ? Tier::NATIVE : Tier::CLOSURES;
+        const std::pair<std::size_t, Tier> expected[] = {
+            {3, Tier::BYTECODE}, {4, Tier::CLOSURES}, {99, Tier::CLOSURES}, {100, last}
+        };
+        EXPECT(0u == machine.calls(f->name));
+        std::size_t calls = 0;
+        for (const std::pair<std::size_t, Tier> &check : expected) {
+            while (calls < check.first) {
+                EXPECT(6 == machine.run(call, context));
+                ++calls;
+            }
+            EXPECT(check.first == machine.calls(f->name));
+            EXPECT(check.second == machine.tier(f->name));
+        }
+        EXPECT(context.status().ok());
+    },
+};
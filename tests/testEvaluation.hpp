@@ -4,43 +4,107 @@
 #include "../sources/node.h"
 
 const lest::test testEvaluation[] = {
+    CASE("Symbols are interned once and map to values by id") {
+        SymbolId a = intern("someVariable");
+        EXPECT(a == intern(std::string("someVariable")));
+        EXPECT(a != intern("someOtherVariable"));
+        EXPECT("someVariable" == symbolName(a));
+
+        variablesMap variables {{a, 2.5}};
+        EXPECT(variables.find(a) != nullptr);
+        EXPECT(2.5 == *variables.find(a));
+        EXPECT(variables.find(intern("someOtherVariable")) == nullptr);
+        EXPECT(variables.find(SymbolId(1000000)) == nullptr);
+    },
+
     CASE("Calling the builtin function exp 1") {
+        NodeArena arena;
         // Call the builtin function with value 1
-        NodePtr n1(new NumberNode(1));
-        NodePtr functionCallNode(new FunctionCallNode("exp", n1));
+        NodePtr n1 = arena.make<NumberNode>(1);
+        NodePtr functionCallNode = arena.make<FunctionCallNode>("exp", n1);
 
         userFunctionsMap functions;
-        EvaluationContext ec(functions, variablesMap());
+        variablesMap variables;
+        EvaluationContext ec(functions, variables);
         EXPECT(approx(M_E) == functionCallNode->eval(ec));
     },
 
     CASE("Calling the user defined function c0") {
+        NodeArena arena;
         // Define a function returning always 0
-        NodePtr n0(new NumberNode(0));
-        UserFunctionPtr constant0(new UserFunction{"c0", "x", n0});
+        NodePtr n0 = arena.make<NumberNode>(0);
+        UserFunctionPtr constant0(new UserFunction{intern("c0"), intern("x"), n0});
 
         // Call it with value 0
-        NodePtr functionCallNode(new FunctionCallNode("c0", n0));
+        NodePtr functionCallNode = arena.make<FunctionCallNode>("c0", n0);
 
         userFunctionsMap functions {{constant0->name, constant0}};
-        EvaluationContext ec(functions, variablesMap());
+        variablesMap variables;
+        EvaluationContext ec(functions, variables);
         EXPECT(approx(0.) == functionCallNode->eval(ec));
     },
 
     CASE("Calling the user defined function f(x) = 1 + exp x") {
+        NodeArena arena;
         // Define the function f(x) + 1 + exp x
-        NodePtr accessX(new VariableNode("x"));
-        NodePtr callExp(new FunctionCallNode("exp", accessX));
-        NodePtr n1(new NumberNode(1));
-        NodePtr sumNode(new AdditionNode(n1, callExp));
-        UserFunctionPtr f(new UserFunction{"f", "x", sumNode});
+        NodePtr accessX = arena.make<VariableNode>("x");
+        NodePtr callExp = arena.make<FunctionCallNode>("exp", accessX);
+        NodePtr n1 = arena.make<NumberNode>(1);
+        NodePtr sumNode = arena.make<AdditionNode>(n1, callExp);
+        UserFunctionPtr f(new UserFunction{intern("f"), intern("x"), sumNode});
 
         // Call it with value 2
-        NodePtr n2(new NumberNode(2));
-        NodePtr functionCallNode(new FunctionCallNode("f", n2));
+        NodePtr n2 = arena.make<NumberNode>(2);
+        NodePtr functionCallNode = arena.make<FunctionCallNode>("f", n2);
 
         userFunctionsMap functions {{f->name, f}};
-        EvaluationContext ec(functions, variablesMap());
+        variablesMap variables;
+        EvaluationContext ec(functions, variables);
         EXPECT(approx(1 + exp(2)) == functionCallNode->eval(ec));
     },
+    CASE("Unknown names evaluate to NaN and the first error is kept") {
+        NodeArena arena;
+        // The argument is evaluated, and fails, before the call
+        NodePtr callFoo = arena.make<FunctionCallNode>("foo", arena.make<VariableNode>("zz"));
+
+        userFunctionsMap functions;
+        variablesMap variables;
+        EvaluationContext ec(functions, variables);
+        EXPECT(std::isnan(callFoo->eval(ec)));
+        EXPECT(ErrorCode::UNKNOWN_VARIABLE == ec.status().code());
+        EXPECT("Unknown variable: zz" == ec.status().message());
+    },
+
+    CASE("Errors in a user defined function body are errors of the call") {
+        NodeArena arena;
+        NodePtr body = arena.make<VariableNode>("zz");
+        UserFunctionPtr f(new UserFunction{intern("f"), intern("x"), body});
+        NodePtr functionCallNode = arena.make<FunctionCallNode>("f", arena.make<NumberNode>(2));
+
+        userFunctionsMap functions {{f->name, f}};
+        variablesMap variables;
+        EvaluationContext ec(functions, variables);
+        EXPECT(std::isnan(functionCallNode->eval(ec)));
+        EXPECT(ErrorCode::UNKNOWN_VARIABLE == ec.status().code());
+        EXPECT("zz" == ec.status().detail());
+    },
+
+    CASE("A function body sees the parameters of its callers") {
+        NodeArena arena;
+        // g(y) = y + x, f(x) = g(x * 2): g sees the x of f, which hides the global x
+        NodePtr gBody = arena.make<AdditionNode>(arena.make<VariableNode>("y"), arena.make<VariableNode>("x"));
+        UserFunctionPtr g(new UserFunction{intern("g"), intern("y"), gBody});
+        NodePtr fBody = arena.make<FunctionCallNode>("g", arena.make<MultiplicationNode>(arena.make<VariableNode>("x"), arena.make<NumberNode>(2)));
+        UserFunctionPtr f(new UserFunction{intern("f"), intern("x"), fBody});
+
+        userFunctionsMap functions {{f->name, f}, {g->name, g}};
+        variablesMap variables {{intern("x"), 100}};
+        EvaluationContext ec(functions, variables);
+        NodePtr call = arena.make<AdditionNode>(arena.make<FunctionCallNode>("f", arena.make<NumberNode>(3)), arena.make<VariableNode>("x"));
+        EXPECT(approx(9 + 100) == call->eval(ec));
+        EXPECT(ec.status().ok());
+
+        // Outside of the calls, y is not defined
+        EXPECT(std::isnan(arena.make<VariableNode>("y")->eval(ec)));
+    },
 };
@@ -0,0 +1,91 @@
+#include <sstream>
+#include <cmath>
+
+#include "lest.hpp"
+using lest::approx;
+
+#include "flatExpression.h"
+#include "parser.h"
+
+// Parses the expression as a tree and flattens it: both must print, evaluate and derive
+// the same, and the flat expression must convert back to the same tree
+bool flatMatchesTree(const std::string &expression)
+{
+    std::istringstream input{expression};
+    Parser parser(input);
+    NodePtr tree = parser.getNextExpressionNode();
+    FlatExpression flat = FlatExpression::fromNode(tree);
+
+    userFunctionsMap functions;
+
+    variablesMap variables {{intern("x"), 0.7}, {intern("y"), 1.3}};
+    EvaluationContext treeContext(functions, variables);
+    EvaluationContext flatContext(functions, variables);
+    double treeValue = tree->eval(treeContext);
+    double flatValue = flat.eval(flatContext);
+
+    NodeArena arena;
+    SymbolId x = intern("x");
+    return tree->toString(ToStringType::TOP_LEVEL) == flat.toString()
+        && (treeValue == flatValue || (std::isnan(treeValue) && std::isnan(flatValue)))
+        && tree->derivative(x, arena)->toString(ToStringType::TOP_LEVEL) == flat.derivative(x).toString()
+        && flat.toNode(arena)->toString(ToStringType::TOP_LEVEL) == flat.toString();
+}
+
+const lest::test testFlatExpression[] = {
+    CASE("Flat expressions match trees") {
+        EXPECT(flatMatchesTree("3.5"));
+        EXPECT(flatMatchesTree("x"));
+        EXPECT(flatMatchesTree("x + 2 * y - 1"));
+        EXPECT(flatMatchesTree("(x - y) / (x * y)"));
+        EXPECT(flatMatchesTree("sin(x * 2) + exp(cos(y / x))"));
+        EXPECT(flatMatchesTree("x / (1 + x / (1 + x / (1 + x)))"));
+        EXPECT(flatMatchesTree("zz + x"));
+    },
+
+    CASE("Flat expressions are stored operands first, root last") {
+        FlatExpression flat;
+        FlatExpression::Index x = flat.addVariable(intern("x"));
+        FlatExpression::Index two = flat.addNumber(2);
+        FlatExpression::Index product = flat.addBinary(FlatOpcode::MULTIPLY, x, two);
+        flat.addCall(intern("sin"), product);
+
+        EXPECT(4u == flat.size());
+        EXPECT(3u == flat.root());
+        EXPECT(FlatOpcode::CALL == flat[flat.root()].opcode);
+        EXPECT(product == flat[flat.root()].call.argument);
+        EXPECT("sin (x * 2)" == flat.toString());
+    },
+
+    CASE("Flat derivatives share operands and drop unused nodes") {
+        FlatExpression flat;
+        flat.addBinary(FlatOpcode::MULTIPLY, flat.addVariable(intern("x")), flat.addVariable(intern("y")));
+        FlatExpression derivative = flat.derivative(intern("x"));
+
+        // x, y, 1, 0, 1 * y, x * 0, and their sum: nothing is copied twice
+        EXPECT(7u == derivative.size());
+        EXPECT("(1 * y) + (x * 0)" == derivative.toString());
+    },
+
+    CASE("Flat expressions handle a chain of a million additions") {
+        const int terms = 1000000;
+        FlatExpression flat;
+        FlatExpression::Index chain = flat.addVariable(intern("x"));
+        for (int i = 1; i < terms; ++i) {
+            chain = flat.addBinary(FlatOpcode::ADD, chain, flat.addVariable(intern("x")));
+        }
+
+        userFunctionsMap functions;
+
+        variablesMap variables {{intern("x"), 0.5}};
+        EvaluationContext context(functions, variables);
+        EXPECT(approx(terms * 0.5) == flat.eval(context));
+        EXPECT(flat.toString().size() == std::size_t(terms - 1) * 6 - 1);
+
+        FlatExpression derivative = flat.derivative(intern("x"));
+        EXPECT(approx(terms) == derivative.eval(context));
+
+        NodeArena arena;
+        EXPECT(approx(terms * 0.5) == flat.toNode(arena)->eval(context));
+    }
+};
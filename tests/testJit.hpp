@@ -0,0 +1,89 @@
+#include <sstream>
+#include <cmath>
+
+#include "lest.hpp"
+
+#include "bytecode.h"
+#include "jit.h"
+#include "parser.h"
+#include "tierFixture.hpp"
+#include "virtualMachine.h"
+
+// Compiles h, or its derivative, to native code and compares it with the tree walker
+// (see TierFixture). Where native code is not supported, there is nothing to compare.
+bool jitMatchesTree(const std::string &body, bool derive = false)
+{
+    if (!JitFunction::isSupported()) {
+        return true;
+    }
+
+    TierFixture fixture(body, derive);
+    JitFunction native = JitFunction::compile(Bytecode::compile(fixture.h, fixture.functions));
+    VirtualMachine machine;
+    return native.valid()
+        && fixture.matchesTree([&](double x, EvaluationContext &context) { return native(x, machine, context); });
+}
+
+const lest::test testJit[] = {
+    CASE("Native function bodies evaluate like the tree walker") {
+        EXPECT(jitMatchesTree("x"));
+        EXPECT(jitMatchesTree("2.5"));
+        EXPECT(jitMatchesTree("x * x * x - 3 * x + 1"));
+        EXPECT(jitMatchesTree("sin(x) * cos(x) / (1 + exp(x))"));
+        EXPECT(jitMatchesTree("log(x * x + 1) - tan(x / 4) * 2 + exp(x)"));
+        EXPECT(jitMatchesTree("x * y + y / x - sin(y)"));
+        EXPECT(jitMatchesTree("f(x) * g(x + 1) - f(f(x))"));
+        EXPECT(jitMatchesTree("x - (y - (x - (y - (x - (y - (x - (y - (x - 1))))))))"));
+        EXPECT(jitMatchesTree("1 / (x - 1) / (x + 2)"));
+    },
+
+    CASE("Native derivatives evaluate like the tree walker") {
+        EXPECT(jitMatchesTree("x * x * x - 3 * x + 1", true));
+        EXPECT(jitMatchesTree("x / (x * x + 1) - 2 / x", true));
+        EXPECT(jitMatchesTree("(x * y + 1) * (x - y) / (x + 4)", true));
+        EXPECT(jitMatchesTree("x * (x * (x * (x * (x * (x + 1) + 2) + 3) + 4) + 5)", true));
+    },
+
+    CASE("Native code keeps the errors of the tree walker") {
+        EXPECT(jitMatchesTree("zz * x + 1"));
+        EXPECT(jitMatchesTree("unknown(x) - 2"));
+        EXPECT(jitMatchesTree("sin(x) * x", true));
+    },
+
+    CASE("Code whose stack does not fit in registers is not compiled, and runs on the machine") {
+        std::string body = "x";
+        for (int level = 0; level < 20; ++level) {
+            body = "x - (" + body + ")";
+        }
+        std::istringstream input{body};
+        Parser parser(input);
+        UserFunction h {intern("h"), intern("x"), parser.getNextExpressionNode()};
+        userFunctionsMap functions;
+        EXPECT(!JitFunction::compile(Bytecode::compile(h, functions)).valid());
+
+        std::ostringstream out;
+        std::string program = "def h x = " + body + "\nh(2) + h(3)\n";
+        Parser programParser(program.data(), program.data() + program.size(), out);
+        EXPECT(programParser.run().ok());
+        EXPECT("5\n" == out.str());
+    },
+
+    CASE("The machine runs functions natively from their threshold call on") {
+        VirtualMachine machine;
+        if (!machine.setJit(true, 2)) {
+            return;
+        }
+        NodeArena arena;
+        NodePtr body = arena.make<MultiplicationNode>(arena.make<VariableNode>("x"), arena.make<NumberNode>(3));
+        UserFunctionPtr f(new UserFunction{intern("f"), intern("x"), body});
+        userFunctionsMap functions {{f->name, f}};
+        variablesMap variables;
+        EvaluationContext context(functions, variables);
+
+        Bytecode call = Bytecode::compile(arena.make<FunctionCallNode>("f", arena.make<NumberNode>(2)), functions);
+        for (int i = 0; i < 5; ++i) {
+            EXPECT(6 == machine.run(call, context));
+        }
+        EXPECT(context.status().ok());
+    },
+};
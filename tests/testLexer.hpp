@@ -1,17 +1,84 @@
 #include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <unistd.h>
 
 #include "lest.hpp"
 
 #include "lexer.h"
 #include "exceptions.h"
 
+Token numberToken(double value)
+{
+    return Token(TokenType::NUMBER, "", 0, TokenSubType::NONE, value);
+}
+
+Token identifierToken(const char *name)
+{
+    return Token::makeIdentifier(intern(name), name, std::strlen(name));
+}
+
+Token operatorToken(TokenSubType subType)
+{
+    return Token(TokenType::OPERATOR, "", 0, subType);
+}
+
+Token keywordToken(const char *name, TokenSubType keyword)
+{
+    return Token::makeIdentifier(intern(name), name, std::strlen(name), keyword);
+}
+
+// What is wrong with the next token, which should be an ERROR token
+Status lexErrorToken(Lexer &lexer)
+{
+    Token token = lexer.nextToken();
+    if (token.getTokenType() != TokenType::ERROR) {
+        return Status();
+    }
+    return Lexer::errorStatus(token, lexer.lastTokenOffset());
+}
+
+// A temporary file holding the given content, open for reading from the start
+FILE *temporaryFileWith(const std::string &content)
+{
+    FILE *file = std::tmpfile();
+    std::fwrite(content.data(), 1, content.size(), file);
+    std::fflush(file);
+    std::rewind(file);
+    lseek(fileno(file), 0, SEEK_SET);
+    return file;
+}
+
+// Lexes the input read in chunks of the given size, and as a buffer:
+// the tokens and their offsets must be the same
+bool lexesInChunksLikeBuffer(const std::string &input, std::size_t chunkSize)
+{
+    FILE *file = temporaryFileWith(input);
+    Lexer chunkedLexer(fileno(file), chunkSize);
+    TokenStream chunkedTokens;
+    chunkedLexer.tokenizeAll(chunkedTokens);
+    std::fclose(file);
+
+    Lexer bufferLexer(input.data(), input.data() + input.size());
+    TokenStream bufferTokens;
+    bufferLexer.tokenizeAll(bufferTokens);
+
+    bool same = chunkedTokens.size() == bufferTokens.size();
+    for (std::size_t i = 0; same && i < bufferTokens.size(); ++i) {
+        same = chunkedTokens.at(i) == bufferTokens.at(i)
+            && chunkedTokens.offsetAt(i) == bufferTokens.offsetAt(i);
+    }
+    return same;
+}
+
 const lest::test testLexer[] = {
     CASE("lexing '1'") {
         std::istringstream input{"1"};
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "1"));
+        EXPECT(lexer.nextToken() == numberToken(1));
 
         EXPECT_NOT(lexer.hasNextToken());
     },
@@ -21,7 +88,7 @@ const lest::test testLexer[] = {
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "3.14"));
+        EXPECT(lexer.nextToken() == numberToken(3.14));
 
         EXPECT_NOT(lexer.hasNextToken());
     },
@@ -31,10 +98,10 @@ const lest::test testLexer[] = {
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::IDENTIFIER, "sin"));
+        EXPECT(lexer.nextToken() == identifierToken("sin"));
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::IDENTIFIER, "x"));
+        EXPECT(lexer.nextToken() == identifierToken("x"));
         EXPECT_NOT(lexer.hasNextToken());
     },
 
@@ -43,13 +110,13 @@ const lest::test testLexer[] = {
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "1"));
+        EXPECT(lexer.nextToken() == numberToken(1));
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, "+"));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::PLUS));
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "23"));
+        EXPECT(lexer.nextToken() == numberToken(23));
         EXPECT_NOT(lexer.hasNextToken());
     },
 
@@ -58,11 +125,11 @@ const lest::test testLexer[] = {
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "2.3"));
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, "*"));
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "1"));
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, "+"));
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "4"));
+        EXPECT(lexer.nextToken() == numberToken(2.3));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::STAR));
+        EXPECT(lexer.nextToken() == numberToken(1));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::PLUS));
+        EXPECT(lexer.nextToken() == numberToken(4));
         EXPECT_NOT(lexer.hasNextToken());
     },
 
@@ -71,31 +138,44 @@ const lest::test testLexer[] = {
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, "("));
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "1"));
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, "+"));
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "23"));
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, ")"));
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, "*"));
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "4"));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::OPEN_PARENTHESIS));
+        EXPECT(lexer.nextToken() == numberToken(1));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::PLUS));
+        EXPECT(lexer.nextToken() == numberToken(23));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::CLOSED_PARENTHESIS));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::STAR));
+        EXPECT(lexer.nextToken() == numberToken(4));
 
         EXPECT_NOT(lexer.hasNextToken());
     },
 
+    CASE("lexing '1.5e-7 * 2E3 + 4e'") {
+        std::istringstream input{"1.5e-7 * 2E3 + 4e"};
+        Lexer lexer(input);
+
+        EXPECT(lexer.nextToken() == numberToken(1.5e-7));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::STAR));
+        EXPECT(lexer.nextToken() == numberToken(2e3));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::PLUS));
+        EXPECT(lexer.nextToken() == numberToken(4));
+        EXPECT(lexer.nextToken() == identifierToken("e"));
+        EXPECT_NOT(lexer.hasNextToken());
+    },
+
     CASE("lexing 'cos (3 * x ) + sin x'") {
         std::istringstream input{"cos (3 * x ) + sin x"};
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::IDENTIFIER, "cos"));
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, "("));
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "3"));
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, "*"));
-        EXPECT(lexer.nextToken() == Token(TokenType::IDENTIFIER, "x"));
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, ")"));
-        EXPECT(lexer.nextToken() == Token(TokenType::OPERATOR, "+"));
-        EXPECT(lexer.nextToken() == Token(TokenType::IDENTIFIER, "sin"));
-        EXPECT(lexer.nextToken() == Token(TokenType::IDENTIFIER, "x"));
+        EXPECT(lexer.nextToken() == identifierToken("cos"));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::OPEN_PARENTHESIS));
+        EXPECT(lexer.nextToken() == numberToken(3));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::STAR));
+        EXPECT(lexer.nextToken() == identifierToken("x"));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::CLOSED_PARENTHESIS));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::PLUS));
+        EXPECT(lexer.nextToken() == identifierToken("sin"));
+        EXPECT(lexer.nextToken() == identifierToken("x"));
 
         EXPECT_NOT(lexer.hasNextToken());
     },
@@ -105,8 +185,22 @@ const lest::test testLexer[] = {
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "1"));
-        EXPECT_THROWS_AS(lexer.nextToken(), InvalidInputException);
+        EXPECT(lexer.nextToken() == numberToken(1));
+        EXPECT_THROWS_AS(throwIfFailed(lexErrorToken(lexer)), InvalidInputException);
+    },
+
+    CASE("lexing goes on after an invalid character") {
+        std::string input{"1 % 5\n2"};
+        Lexer lexer(input.data(), input.data() + input.size());
+
+        EXPECT(lexer.nextToken() == numberToken(1));
+        Status error = lexErrorToken(lexer);
+        EXPECT(ErrorCode::INVALID_INPUT == error.code());
+        EXPECT("Invalid operator type: %" == error.message());
+        EXPECT(2u == error.offset());
+        EXPECT(lexer.nextToken() == numberToken(5));
+        EXPECT(lexer.nextToken().getTokenType() == TokenType::END_OF_LINE);
+        EXPECT(lexer.nextToken() == numberToken(2));
     },
 
     CASE("lexing past eOF") {
@@ -114,7 +208,7 @@ const lest::test testLexer[] = {
         Lexer lexer(input);
         lexer.nextToken();
         EXPECT_NOT(lexer.hasNextToken());
-        EXPECT(lexer.nextToken() == Token(TokenType::END_OF_INPUT, ""));
+        EXPECT(lexer.nextToken() == Token());
         EXPECT_NOT(lexer.hasNextToken());
     },
 
@@ -123,9 +217,9 @@ const lest::test testLexer[] = {
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::IDENTIFIER, "a"));
-        EXPECT(lexer.nextToken() == Token(TokenType::END_OF_LINE, ""));
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "3"));
+        EXPECT(lexer.nextToken() == identifierToken("a"));
+        EXPECT(lexer.nextToken() == Token(TokenType::END_OF_LINE, "", 0));
+        EXPECT(lexer.nextToken() == numberToken(3));
 
         EXPECT_NOT(lexer.hasNextToken());
     },
@@ -135,9 +229,9 @@ const lest::test testLexer[] = {
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "3"));
-        EXPECT(lexer.nextToken() == Token(TokenType::END_OF_LINE, ""));
-        EXPECT(lexer.nextToken() == Token(TokenType::IDENTIFIER, "b"));
+        EXPECT(lexer.nextToken() == numberToken(3));
+        EXPECT(lexer.nextToken() == Token(TokenType::END_OF_LINE, "", 0));
+        EXPECT(lexer.nextToken() == identifierToken("b"));
 
         EXPECT_NOT(lexer.hasNextToken());
     },
@@ -147,7 +241,190 @@ const lest::test testLexer[] = {
         Lexer lexer(input);
         EXPECT(lexer.hasNextToken());
 
-        EXPECT(lexer.nextToken() == Token(TokenType::NUMBER, "3"));
-        EXPECT_THROWS_AS(lexer.nextToken(), InvalidInputException);
+        EXPECT(lexer.nextToken() == numberToken(3));
+        EXPECT_THROWS_AS(throwIfFailed(lexErrorToken(lexer)), InvalidInputException);
+    },
+
+    CASE("lexing 'def f x = 2 - x'") {
+        std::istringstream input{"def f x = 2 - x"};
+        Lexer lexer(input);
+
+        EXPECT(lexer.nextToken() == keywordToken("def", TokenSubType::DEF));
+        EXPECT(lexer.nextToken() == identifierToken("f"));
+        EXPECT(lexer.nextToken() == identifierToken("x"));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::ASSIGN));
+        EXPECT(lexer.nextToken() == numberToken(2));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::MINUS));
+        EXPECT(lexer.nextToken() == identifierToken("x"));
+        EXPECT_NOT(lexer.hasNextToken());
+    },
+
+    CASE("lexing 'der dx define'") {
+        std::istringstream input{"der dx define"};
+        Lexer lexer(input);
+
+        EXPECT(lexer.nextToken() == keywordToken("der", TokenSubType::DER));
+        EXPECT(lexer.nextToken() == identifierToken("dx"));
+        EXPECT(lexer.nextToken() == identifierToken("define"));
+        EXPECT_NOT(lexer.hasNextToken());
+    },
+
+    CASE("lexing '\t1\v+\f2 '") {
+        std::istringstream input{"\t1\v+\f2 "};
+        Lexer lexer(input);
+
+        EXPECT(lexer.nextToken() == numberToken(1));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::PLUS));
+        EXPECT(lexer.nextToken() == numberToken(2));
+        EXPECT_NOT(lexer.hasNextToken());
+    },
+
+    CASE("lexing non-ASCII bytes") {
+        std::istringstream input{"x\xE9"};
+        Lexer lexer(input);
+
+        EXPECT(lexer.nextToken() == identifierToken("x"));
+        EXPECT_THROWS_AS(throwIfFailed(lexErrorToken(lexer)), InvalidInputException);
+    },
+
+    CASE("lexing 'x + x1 + x' interns identifiers") {
+        std::istringstream input{"x + x1 + x"};
+        Lexer lexer(input);
+
+        Token x = lexer.nextToken();
+        lexer.nextToken();
+        Token x1 = lexer.nextToken();
+        lexer.nextToken();
+        EXPECT(x.getSymbol() == lexer.nextToken().getSymbol());
+        EXPECT(x.getSymbol() != x1.getSymbol());
+        EXPECT("x1" == symbolName(x1.getSymbol()));
+    },
+
+    CASE("tokens are small trivially copyable values") {
+        EXPECT(std::is_trivially_copyable<Token>::value);
+        EXPECT(sizeof(Token) <= 24u);
+    },
+
+    // Lexing an in-memory buffer
+    CASE("lexing buffer 'cos (3 * x)\n1.5'") {
+        std::string input{"cos (3 * x)\n1.5"};
+        Lexer lexer(input.data(), input.data() + input.size());
+        EXPECT(lexer.hasNextToken());
+
+        EXPECT(lexer.nextToken() == identifierToken("cos"));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::OPEN_PARENTHESIS));
+        EXPECT(lexer.nextToken() == numberToken(3));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::STAR));
+        EXPECT(lexer.nextToken() == identifierToken("x"));
+        EXPECT(lexer.nextToken() == operatorToken(TokenSubType::CLOSED_PARENTHESIS));
+        EXPECT(lexer.nextToken() == Token(TokenType::END_OF_LINE, "", 0));
+        EXPECT(lexer.nextToken() == numberToken(1.5));
+
+        EXPECT_NOT(lexer.hasNextToken());
+        EXPECT(lexer.nextToken() == Token());
+    },
+
+    CASE("lexing buffer tokens point into the buffer") {
+        std::string input{"  alpha + 2"};
+        Lexer lexer(input.data(), input.data() + input.size());
+
+        Token alpha = lexer.nextToken();
+        Token plus = lexer.nextToken();
+        EXPECT("alpha" == alpha.getContent());
+        EXPECT("+" == plus.getContent());
+    },
+
+    CASE("lexing empty buffer") {
+        Lexer lexer(nullptr, nullptr);
+        EXPECT_NOT(lexer.hasNextToken());
+        EXPECT(lexer.nextToken() == Token());
+    },
+
+    // Lexing a file descriptor in chunks
+    CASE("lexing in chunks tokens that straddle chunk boundaries") {
+        std::string input{"alpha = 123.456e-2 * beta\n\n  def f x = sin(x) + 3\r\nf(alpha)"};
+        for (std::size_t chunkSize = 1; chunkSize < 20; ++chunkSize) {
+            EXPECT(lexesInChunksLikeBuffer(input, chunkSize));
+        }
+        EXPECT(lexesInChunksLikeBuffer(input, ChunkedInput::DEFAULT_CHUNK_SIZE));
+        EXPECT(lexesInChunksLikeBuffer("", 4));
+        EXPECT(lexesInChunksLikeBuffer("\n\n", 4));
+    },
+
+    CASE("reading in chunks keeps memory bounded") {
+        std::string input;
+        for (int i = 0; i < 20000; ++i) {
+            input += "x = x + 1\n";
+        }
+        input += std::string(10000, 'y') + "\nz\n";
+
+        FILE *file = temporaryFileWith(input);
+        ChunkedInput chunks(fileno(file), 1024);
+        std::size_t bytes = 0;
+        std::size_t largestCapacity = 0;
+        while (chunks.next()) {
+            bytes += chunks.end() - chunks.begin();
+            EXPECT('\n' == *(chunks.end() - 1));
+            largestCapacity = std::max(largestCapacity, chunks.capacity());
+        }
+        std::fclose(file);
+
+        EXPECT(input.size() == bytes);
+        EXPECT(largestCapacity <= 16384u);
+        EXPECT(1024u == chunks.capacity());
+    },
+
+    // Tokenizing into a stream
+    CASE("tokenizing all of 'f(2.5)\n  x = 1'") {
+        std::string input{"f(2.5)\n  x = 1"};
+        Lexer lexer(input.data(), input.data() + input.size());
+        TokenStream tokens;
+        lexer.tokenizeAll(tokens);
+
+        EXPECT(8u == tokens.size());
+        EXPECT(tokens.at(0) == identifierToken("f"));
+        EXPECT(tokens.at(1) == operatorToken(TokenSubType::OPEN_PARENTHESIS));
+        EXPECT(tokens.typeAt(2) == TokenType::NUMBER);
+        EXPECT(tokens.numberAt(2) == 2.5);
+        EXPECT(tokens.at(3) == operatorToken(TokenSubType::CLOSED_PARENTHESIS));
+        EXPECT(tokens.typeAt(4) == TokenType::END_OF_LINE);
+        EXPECT(tokens.at(5) == identifierToken("x"));
+        EXPECT(tokens.subTypeAt(6) == TokenSubType::ASSIGN);
+        EXPECT(tokens.at(7) == numberToken(1));
+
+        EXPECT(0u == tokens.offsetAt(0));
+        EXPECT(2u == tokens.offsetAt(2));
+        EXPECT(6u == tokens.offsetAt(4));
+        EXPECT(9u == tokens.offsetAt(5));
+        EXPECT(13u == tokens.offsetAt(7));
+    },
+
+    CASE("tokenizing line by line a stream") {
+        std::istringstream input{"1 +\n\n  a"};
+        Lexer lexer(input);
+        TokenStream tokens;
+
+        lexer.tokenizeLine(tokens);
+        EXPECT(3u == tokens.size());
+        EXPECT(tokens.typeAt(2) == TokenType::END_OF_LINE);
+
+        lexer.tokenizeLine(tokens);
+        EXPECT(4u == tokens.size());
+        EXPECT(tokens.typeAt(3) == TokenType::END_OF_LINE);
+
+        tokens.discard(4);
+        lexer.tokenizeLine(tokens);
+        EXPECT(1u == tokens.size());
+        EXPECT(tokens.at(0) == identifierToken("a"));
+        EXPECT(7u == tokens.offsetAt(0));
+        EXPECT_NOT(lexer.hasNextToken());
+    },
+
+    CASE("lexing buffer '3\r1'") {
+        std::string input{"3\r1"};
+        Lexer lexer(input.data(), input.data() + input.size());
+
+        EXPECT(lexer.nextToken() == numberToken(3));
+        EXPECT_THROWS_AS(throwIfFailed(lexErrorToken(lexer)), InvalidInputException);
     }
 };
@@ -4,9 +4,18 @@
 #include "lest.hpp"
 
 #include "testLexer.hpp"
+#include "testScan.hpp"
+#include "testNumber.hpp"
 #include "testParser.hpp"
 #include "testNode.hpp"
 #include "testEvaluation.hpp"
+#include "testFlatExpression.hpp"
+#include "testBytecode.hpp"
+#include "testClosure.hpp"
+#include "testJit.hpp"
+#include "testBatch.hpp"
+#include "testVectorMath.hpp"
+#include "testSimplify.hpp"
 
 template <std::size_t N>
 void addTests(lest::test const (&toAdd)[N], std::vector<lest::test> &tests)
@@ -18,9 +27,18 @@ int main(int argc, char* argv[])
 {
     std::vector<lest::test> tests;
     addTests(testLexer, tests);
+    addTests(testScan, tests);
+    addTests(testNumber, tests);
     addTests(testParser, tests);
     addTests(testNode, tests);
     addTests(testEvaluation, tests);
+    addTests(testFlatExpression, tests);
+    addTests(testBytecode, tests);
+    addTests(testClosure, tests);
+    addTests(testJit, tests);
+    addTests(testBatch, tests);
+    addTests(testVectorMath, tests);
+    addTests(testSimplify, tests);
 
     return lest::run(tests, lest::texts(argv + 1, argv + argc), std::cout);
 }
\ No newline at end of file
@@ -2,99 +2,230 @@
 
 #include "node.h"
 #include "../sources/node.h"
+#include "exceptions.h"
+#include "sharedTrees.hpp"
 
 double evalNode(NodePtr node) {
-    variablesMap variables {{"a", 0.8}, {"b", 1.2}};
-    EvaluationContext ec(userFunctionsMap(), variables);
-    return node->eval(ec);
+    userFunctionsMap functions;
+    variablesMap variables {{intern("a"), 0.8}, {intern("b"), 1.2}};
+    EvaluationContext ec(functions, variables);
+    double value = node->eval(ec);
+    throwIfFailed(ec.status());
+    return value;
 }
 
 const lest::test testNode[] = {
+    CASE("NodeArena allocates nodes in growing blocks and keeps the last one on reset") {
+        NodeArena arena;
+        EXPECT(0u == arena.blockCount());
+
+        NodePtr first = arena.make<NumberNode>(1);
+        NodePtr second = arena.make<NumberNode>(2);
+        EXPECT(1u == arena.blockCount());
+        EXPECT(sizeof(NumberNode) == std::size_t(reinterpret_cast<char *>(second) - reinterpret_cast<char *>(first)));
+
+        for (int i = 0; i < 10000; ++i) {
+            arena.make<NumberNode>(i + 10);
+        }
+        EXPECT(1u < arena.blockCount());
+        EXPECT(10002u == arena.nodeCount());
+
+        arena.reset();
+        EXPECT(1u == arena.blockCount());
+        EXPECT(0u == arena.nodeCount());
+        NodePtr reused = arena.make<NumberNode>(3);
+        for (int i = 0; i < 1000; ++i) {
+            arena.make<NumberNode>(i + 10);
+        }
+        EXPECT(1u == arena.blockCount());
+        EXPECT(reused != first);
+    },
+
+    CASE("NodeArena shares structurally equal nodes") {
+        NodeArena arena;
+        NodePtr sinX = arena.make<FunctionCallNode>("sin", arena.make<VariableNode>("x"));
+        NodePtr square = arena.make<MultiplicationNode>(sinX, arena.make<FunctionCallNode>("sin", arena.make<VariableNode>("x")));
+        EXPECT(square->child(0) == square->child(1));
+        EXPECT(3u == arena.nodeCount());
+
+        EXPECT(square == arena.make<MultiplicationNode>(sinX, sinX));
+        EXPECT(square != arena.make<DivisionNode>(sinX, sinX));
+        EXPECT(arena.make<NumberNode>(0.0) != arena.make<NumberNode>(-0.0));
+        EXPECT(arena.make<NumberNode>(NAN) == arena.make<NumberNode>(NAN));
+        EXPECT(7u == arena.nodeCount());
+
+        // Taking back the allocation of a duplicate leaves no gap
+        NodePtr next = arena.make<NumberNode>(1);
+        arena.make<NumberNode>(1);
+        char *expected = reinterpret_cast<char *>(next) + sizeof(NumberNode);
+        EXPECT(expected == reinterpret_cast<char *>(arena.make<NumberNode>(2)));
+    },
+
+    CASE("Derivatives share their repeated fragments") {
+        NodeArena arena;
+        NodePtr x = arena.make<VariableNode>("x");
+        NodePtr sinX = arena.make<FunctionCallNode>("sin", x);
+        NodePtr node = arena.make<MultiplicationNode>(sinX, sinX);
+
+        // (sin' x * 1) * sin x + sin x * (sin' x * 1): the two derivatives of sin x are one node
+        NodePtr derivative = node->derivative(intern("x"), arena);
+        EXPECT(derivative->child(0)->child(0) == derivative->child(1)->child(1));
+    },
+
+    CASE("Shared nodes are evaluated once per walk") {
+        NodeArena arena;
+        NodePtr doubled = arena.make<VariableNode>("a");
+        for (int i = 0; i < 64; ++i) {
+            doubled = arena.make<AdditionNode>(doubled, doubled);
+        }
+        double expected = 0.8 * 18446744073709551616.0;
+        EXPECT(expected == evalNode(doubled));
+
+        // The derivative is 1 / (1 + 100 a)^2
+        NodePtr quotient = nestedQuotient(arena, 100, "a");
+        EXPECT(approx(0.8 / 81) == evalNode(quotient));
+        EXPECT(approx(1 / (81.0 * 81.0)) == evalNode(quotient->derivative(intern("a"), arena)));
+    },
+
+    CASE("A shared node keeps its error") {
+        NodeArena arena;
+        NodePtr failing = arena.make<MultiplicationNode>(arena.make<VariableNode>("zz"), arena.make<VariableNode>("a"));
+        NodePtr node = arena.make<AdditionNode>(failing, arena.make<DivisionNode>(arena.make<NumberNode>(1), failing));
+        userFunctionsMap functions;
+        variablesMap variables {{intern("a"), 0.8}};
+        EvaluationContext context(functions, variables);
+        EXPECT(std::isnan(node->eval(context)));
+        EXPECT("zz" == context.status().detail());
+    },
+
+    CASE("Shared nodes of a function body are evaluated anew on each call") {
+        // The body shares x * x, as does the caller with a * a, around nested walks
+        // binding x to different values
+        NodeArena arena;
+        NodePtr x = arena.make<VariableNode>("x");
+        NodePtr square = arena.make<MultiplicationNode>(x, x);
+        userFunctionsMap functions;
+        functions.set(intern("f"), UserFunctionPtr(new UserFunction {intern("f"), intern("x"),
+                                                                     arena.make<AdditionNode>(square, square)}));
+        NodePtr a = arena.make<VariableNode>("a");
+        NodePtr aSquare = arena.make<MultiplicationNode>(a, a);
+        NodePtr node = arena.make<AdditionNode>(
+            arena.make<AdditionNode>(aSquare, arena.make<FunctionCallNode>("f", aSquare)),
+            arena.make<FunctionCallNode>("f", arena.make<FunctionCallNode>("f", arena.make<NumberNode>(1))));
+        variablesMap variables {{intern("a"), 2}};
+        double expected = 4 + 32 + 8;
+        for (int i = 0; i < 2; ++i) {
+            EvaluationContext context(functions, variables);
+            EXPECT(expected == node->eval(context));
+        }
+    },
+
     CASE("NumberNode") {
-        NodePtr node(new NumberNode(0.5));
+        NodeArena arena;
+        NodePtr node = arena.make<NumberNode>(0.5);
         EXPECT("0.5" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT("0.5" == node->toString(ToStringType::RECURSIVE_CALL));
         EXPECT(approx(0.5) == evalNode(node));
     },
 
     CASE("AdditionNode") {
-        NodePtr n1(new NumberNode(1)), n2(new NumberNode(2));
-        NodePtr node(new AdditionNode(n1, n2));
+        NodeArena arena;
+        NodePtr n1 = arena.make<NumberNode>(1), n2 = arena.make<NumberNode>(2);
+        NodePtr node = arena.make<AdditionNode>(n1, n2);
         EXPECT("1 + 2" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT("(1 + 2)" == node->toString(ToStringType::RECURSIVE_CALL));
         EXPECT(approx(3) == evalNode(node));
     },
     CASE("SubtractionNode") {
-        NodePtr n1(new NumberNode(1)), n2(new NumberNode(2));
-        NodePtr node(new SubtractionNode(n1, n2));
+        NodeArena arena;
+        NodePtr n1 = arena.make<NumberNode>(1), n2 = arena.make<NumberNode>(2);
+        NodePtr node = arena.make<SubtractionNode>(n1, n2);
         EXPECT("1 - 2" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT("(1 - 2)" == node->toString(ToStringType::RECURSIVE_CALL));
         EXPECT(approx(-1) == evalNode(node));
     },
     CASE("MultiplicationNode") {
-        NodePtr n2(new NumberNode(2)), n3(new NumberNode(3));
-        NodePtr node(new MultiplicationNode(n2, n3));
+        NodeArena arena;
+        NodePtr n2 = arena.make<NumberNode>(2), n3 = arena.make<NumberNode>(3);
+        NodePtr node = arena.make<MultiplicationNode>(n2, n3);
         EXPECT("2 * 3" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT("(2 * 3)" == node->toString(ToStringType::RECURSIVE_CALL));
         EXPECT(approx(6) == evalNode(node));
     },
     CASE("DivisionNode") {
-        NodePtr n1(new NumberNode(1)), n2(new NumberNode(2));
-        NodePtr node(new DivisionNode(n1, n2));
+        NodeArena arena;
+        NodePtr n1 = arena.make<NumberNode>(1), n2 = arena.make<NumberNode>(2);
+        NodePtr node = arena.make<DivisionNode>(n1, n2);
         EXPECT("1 / 2" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT("(1 / 2)" == node->toString(ToStringType::RECURSIVE_CALL));
         EXPECT(approx(0.5) == evalNode(node));
     },
+    CASE("Binary operator nodes hold only their children and kind") {
+        EXPECT(sizeof(AdditionNode) <= 4 * sizeof(void *));
+        EXPECT(sizeof(DivisionNode) == sizeof(AdditionNode));
+
+        NodeArena arena;
+        NodePtr x = arena.make<VariableNode>("x");
+        EXPECT(FlatOpcode::SUBTRACT == arena.make<SubtractionNode>(x, x)->kind());
+        EXPECT(!BinaryOpNode::isBinary(x->kind()));
+    },
 
     CASE("Recursive Nodes") {
-        NodePtr n1(new NumberNode(1)), n2(new NumberNode(2)), n3(new NumberNode(3));
-        NodePtr n2times3(new MultiplicationNode(n2, n3));
-        NodePtr node(new AdditionNode(n2times3, n1));
+        NodeArena arena;
+        NodePtr n1 = arena.make<NumberNode>(1), n2 = arena.make<NumberNode>(2), n3 = arena.make<NumberNode>(3);
+        NodePtr n2times3 = arena.make<MultiplicationNode>(n2, n3);
+        NodePtr node = arena.make<AdditionNode>(n2times3, n1);
         EXPECT("(2 * 3) + 1" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT(approx(7) == evalNode(node));
     },
     CASE("Recursive Nodes 2") {
-        NodePtr n1(new NumberNode(1)), n2(new NumberNode(2)), n3(new NumberNode(3)), n4(new NumberNode(4)), n7(new NumberNode(7));
-        NodePtr n1plus3(new AdditionNode(n1, n3));
-        NodePtr n4dividedBy2(new DivisionNode(n4, n2));
-        NodePtr n7minusn4dividedBy2(new SubtractionNode(n7, n4dividedBy2));
-        NodePtr node(new DivisionNode(n1plus3, n7minusn4dividedBy2));
+        NodeArena arena;
+        NodePtr n1 = arena.make<NumberNode>(1), n2 = arena.make<NumberNode>(2), n3 = arena.make<NumberNode>(3), n4 = arena.make<NumberNode>(4), n7 = arena.make<NumberNode>(7);
+        NodePtr n1plus3 = arena.make<AdditionNode>(n1, n3);
+        NodePtr n4dividedBy2 = arena.make<DivisionNode>(n4, n2);
+        NodePtr n7minusn4dividedBy2 = arena.make<SubtractionNode>(n7, n4dividedBy2);
+        NodePtr node = arena.make<DivisionNode>(n1plus3, n7minusn4dividedBy2);
         EXPECT("(1 + 3) / (7 - (4 / 2))" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT(approx(0.8) == evalNode(node));
     },
 
     CASE("Variable node") {
-        NodePtr node(new VariableNode("a"));
+        NodeArena arena;
+        NodePtr node = arena.make<VariableNode>("a");
         EXPECT("a" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT("a" == node->toString(ToStringType::RECURSIVE_CALL));
         EXPECT(approx(0.8) == evalNode(node));
     },
     CASE("Unknown variable name") {
-        NodePtr node(new VariableNode("zz"));
+        NodeArena arena;
+        NodePtr node = arena.make<VariableNode>("zz");
         EXPECT("zz" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT("zz" == node->toString(ToStringType::RECURSIVE_CALL));
         EXPECT_THROWS_AS(evalNode(node), UnknownVariableName);
     },
 
     CASE("Function node") {
-        NodePtr n0(new NumberNode(0));
-        NodePtr node(new FunctionCallNode("sin", n0));
+        NodeArena arena;
+        NodePtr n0 = arena.make<NumberNode>(0);
+        NodePtr node = arena.make<FunctionCallNode>("sin", n0);
         EXPECT("sin 0" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT("(sin 0)" == node->toString(ToStringType::RECURSIVE_CALL));
         EXPECT(approx(0.) == evalNode(node));
     },
 
     CASE("Unknown function name") {
-        NodePtr n0(new NumberNode(0));
-        NodePtr node(new FunctionCallNode("foo", n0));
+        NodeArena arena;
+        NodePtr n0 = arena.make<NumberNode>(0);
+        NodePtr node = arena.make<FunctionCallNode>("foo", n0);
         EXPECT("foo 0" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT("(foo 0)" == node->toString(ToStringType::RECURSIVE_CALL));
         EXPECT_THROWS_AS(evalNode(node), UnknownFunctionName);
     },
     CASE("Recursive function call") {
-        NodePtr n0(new NumberNode(0));
-        NodePtr nSin(new FunctionCallNode("sin", n0));
-        NodePtr node(new FunctionCallNode("exp", nSin));
+        NodeArena arena;
+        NodePtr n0 = arena.make<NumberNode>(0);
+        NodePtr nSin = arena.make<FunctionCallNode>("sin", n0);
+        NodePtr node = arena.make<FunctionCallNode>("exp", nSin);
         EXPECT("exp (sin 0)" == node->toString(ToStringType::TOP_LEVEL));
         EXPECT("(exp (sin 0))" == node->toString(ToStringType::RECURSIVE_CALL));
         EXPECT(approx(1.) == evalNode(node));
@@ -102,55 +233,93 @@ const lest::test testNode[] = {
 
     // Derivative
     CASE("Derivative NumberNode") {
-        NodePtr node(new NumberNode(0.5));
-        EXPECT("0" == node->derivative("x")->toString(ToStringType::TOP_LEVEL));
+        NodeArena arena;
+        NodePtr node = arena.make<NumberNode>(0.5);
+        EXPECT("0" == node->derivative(intern("x"), arena)->toString(ToStringType::TOP_LEVEL));
     },
     CASE("Derivative Variable node") {
-        NodePtr node(new VariableNode("x"));
-        EXPECT("1" == node->derivative("x")->toString(ToStringType::TOP_LEVEL));
-        EXPECT("0" == node->derivative("y")->toString(ToStringType::TOP_LEVEL));
+        NodeArena arena;
+        NodePtr node = arena.make<VariableNode>("x");
+        EXPECT("1" == node->derivative(intern("x"), arena)->toString(ToStringType::TOP_LEVEL));
+        EXPECT("0" == node->derivative(intern("y"), arena)->toString(ToStringType::TOP_LEVEL));
     },
     CASE("Derivative AdditionNode") {
-        NodePtr n1(new NumberNode(1));
-        NodePtr x(new VariableNode("x"));
-        NodePtr node(new AdditionNode(n1, x));
+        NodeArena arena;
+        NodePtr n1 = arena.make<NumberNode>(1);
+        NodePtr x = arena.make<VariableNode>("x");
+        NodePtr node = arena.make<AdditionNode>(n1, x);
         EXPECT("1 + x" == node->toString(ToStringType::TOP_LEVEL));
-        EXPECT("0 + 1" == node->derivative("x")->toString(ToStringType::TOP_LEVEL));
+        EXPECT("0 + 1" == node->derivative(intern("x"), arena)->toString(ToStringType::TOP_LEVEL));
     },
     CASE("Derivative SubtractioNode") {
-        NodePtr x(new VariableNode("x"));
-        NodePtr n2(new NumberNode(2));
-        NodePtr node(new SubtractionNode(x, n2));
+        NodeArena arena;
+        NodePtr x = arena.make<VariableNode>("x");
+        NodePtr n2 = arena.make<NumberNode>(2);
+        NodePtr node = arena.make<SubtractionNode>(x, n2);
         EXPECT("x - 2" == node->toString(ToStringType::TOP_LEVEL));
-        EXPECT("1 - 0" == node->derivative("x")->toString(ToStringType::TOP_LEVEL));
+        EXPECT("1 - 0" == node->derivative(intern("x"), arena)->toString(ToStringType::TOP_LEVEL));
     },
     CASE("Derivative MultiplicationNode") {
-        NodePtr x(new VariableNode("x"));
-        NodePtr y(new VariableNode("y"));
-        NodePtr node(new MultiplicationNode(x, y));
+        NodeArena arena;
+        NodePtr x = arena.make<VariableNode>("x");
+        NodePtr y = arena.make<VariableNode>("y");
+        NodePtr node = arena.make<MultiplicationNode>(x, y);
         EXPECT("x * y" == node->toString(ToStringType::TOP_LEVEL));
-        EXPECT("(1 * y) + (x * 0)" == node->derivative("x")->toString(ToStringType::TOP_LEVEL));
+        EXPECT("(1 * y) + (x * 0)" == node->derivative(intern("x"), arena)->toString(ToStringType::TOP_LEVEL));
     },
     CASE("Derivative DivisionNode") {
-        NodePtr x(new VariableNode("x"));
-        NodePtr y(new VariableNode("y"));
-        NodePtr node(new DivisionNode(x, y));
+        NodeArena arena;
+        NodePtr x = arena.make<VariableNode>("x");
+        NodePtr y = arena.make<VariableNode>("y");
+        NodePtr node = arena.make<DivisionNode>(x, y);
         EXPECT("x / y" == node->toString(ToStringType::TOP_LEVEL));
-        EXPECT("((1 * y) - (x * 0)) / (y * y)" == node->derivative("x")->toString(ToStringType::TOP_LEVEL));
+        EXPECT("((1 * y) - (x * 0)) / (y * y)" == node->derivative(intern("x"), arena)->toString(ToStringType::TOP_LEVEL));
     },
 
     CASE("Derivative FunctionCallNode 1") {
-        NodePtr x(new VariableNode("x"));
-        NodePtr node(new FunctionCallNode("sin", x));
+        NodeArena arena;
+        NodePtr x = arena.make<VariableNode>("x");
+        NodePtr node = arena.make<FunctionCallNode>("sin", x);
         EXPECT("sin x" == node->toString(ToStringType::TOP_LEVEL));
-        EXPECT("(sin' x) * 1" == node->derivative("x")->toString(ToStringType::TOP_LEVEL));
+        EXPECT("(sin' x) * 1" == node->derivative(intern("x"), arena)->toString(ToStringType::TOP_LEVEL));
     },
     CASE("Derivative FunctionCallNode 2") {
-        NodePtr x(new VariableNode("x"));
-        NodePtr n2(new NumberNode(2));
-        NodePtr x2(new MultiplicationNode(x, n2));
-        NodePtr node(new FunctionCallNode("sin", x2));
+        NodeArena arena;
+        NodePtr x = arena.make<VariableNode>("x");
+        NodePtr n2 = arena.make<NumberNode>(2);
+        NodePtr x2 = arena.make<MultiplicationNode>(x, n2);
+        NodePtr node = arena.make<FunctionCallNode>("sin", x2);
         EXPECT("sin (x * 2)" == node->toString(ToStringType::TOP_LEVEL));
-        EXPECT("(sin' (x * 2)) * ((1 * 2) + (x * 0))" == node->derivative("x")->toString(ToStringType::TOP_LEVEL));
+        EXPECT("(sin' (x * 2)) * ((1 * 2) + (x * 0))" == node->derivative(intern("x"), arena)->toString(ToStringType::TOP_LEVEL));
+    },
+    CASE("A chain of a million additions is evaluated, printed and derived") {
+        NodeArena arena;
+        const int terms = 1000000;
+        NodePtr chain = arena.make<VariableNode>("a");
+        for (int i = 1; i < terms; ++i) {
+            chain = arena.make<AdditionNode>(chain, arena.make<VariableNode>("a"));
+        }
+
+        EXPECT(approx(terms * 0.8) == evalNode(chain));
+
+        std::string text = chain->toString(ToStringType::TOP_LEVEL);
+        EXPECT(text.size() == std::size_t(terms - 1) * 6 - 1);
+        EXPECT("+ a) + a" == text.substr(text.size() - 8));
+
+        NodePtr derivative = chain->derivative(intern("a"), arena);
+        EXPECT(approx(terms) == evalNode(derivative));
+    },
+
+    CASE("A million nested function calls are evaluated, printed and derived") {
+        NodeArena arena;
+        const int depth = 1000000;
+        NodePtr nested = arena.make<VariableNode>("a");
+        for (int i = 0; i < depth; ++i) {
+            nested = arena.make<FunctionCallNode>("sin", nested);
+        }
+
+        EXPECT(approx(0.0017320403258667659) == evalNode(nested));
+        EXPECT("sin (sin (sin" == nested->toString(ToStringType::TOP_LEVEL).substr(0, 13));
+        EXPECT(nested->derivative(intern("a"), arena) != nullptr);
     }
 };
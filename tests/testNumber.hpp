@@ -0,0 +1,69 @@
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+
+#include "lest.hpp"
+
+#include "number.h"
+
+double parseNumberLiteral(const std::string &literal)
+{
+    return parseNumberLiteral(literal.data(), literal.data() + literal.size());
+}
+
+// The conversion must give exactly the same double as strtod
+bool convertsLikeStrtod(const std::string &literal)
+{
+    double expected = std::strtod(literal.c_str(), nullptr);
+    double actual = parseNumberLiteral(literal);
+    return std::memcmp(&expected, &actual, sizeof(double)) == 0;
+}
+
+const lest::test testNumber[] = {
+    CASE("converting simple literals") {
+        EXPECT(0. == parseNumberLiteral("0"));
+        EXPECT(13. == parseNumberLiteral("13"));
+        EXPECT(3.14 == parseNumberLiteral("3.14"));
+        EXPECT(1. == parseNumberLiteral("1."));
+        EXPECT(0.1 == parseNumberLiteral("0.1"));
+        EXPECT(0.000001 == parseNumberLiteral("0.000001"));
+    },
+
+    CASE("converting literals with an exponent") {
+        EXPECT(1.5e-7 == parseNumberLiteral("1.5e-7"));
+        EXPECT(2e10 == parseNumberLiteral("2E10"));
+        EXPECT(2e10 == parseNumberLiteral("2e+10"));
+        EXPECT(0. == parseNumberLiteral("0e999999999999"));
+        EXPECT(0. == parseNumberLiteral("1e-99999999999"));
+        EXPECT(std::numeric_limits<double>::infinity() == parseNumberLiteral("1e99999999999"));
+    },
+
+    CASE("converting does not read past the end of the literal") {
+        const char *text = "12345";
+        EXPECT(123. == parseNumberLiteral(text, text + 3));
+    },
+
+    CASE("converting hard literals is correctly rounded") {
+        EXPECT(convertsLikeStrtod("3.14159265358979323846264338327950288419716939937510"));
+        EXPECT(convertsLikeStrtod("271828182845904523536028747135266249775724709369995"));
+        EXPECT(convertsLikeStrtod("9007199254740993"));
+        EXPECT(convertsLikeStrtod("2.2250738585072014e-308"));
+        EXPECT(convertsLikeStrtod("4.9406564584124654e-324"));
+        EXPECT(convertsLikeStrtod("1.7976931348623157e308"));
+        EXPECT(convertsLikeStrtod("123e30"));
+        EXPECT(convertsLikeStrtod("0.000000000000000000000000000000000000001"));
+        EXPECT(convertsLikeStrtod("7.038531e-26"));
+    },
+
+    CASE("converting random literals is correctly rounded") {
+        std::mt19937_64 random(42);
+        for (int i = 0; i < 10000; ++i) {
+            std::string literal = std::to_string(random() % 100000000000000000ull);
+            literal.insert(random() % literal.size(), ".");
+            literal += "e" + std::to_string(static_cast<int>(random() % 80) - 40);
+            EXPECT(convertsLikeStrtod(literal));
+        }
+    }
+};
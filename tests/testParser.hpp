@@ -26,6 +26,26 @@ std::string parseProgramOutput(std::string program)
     return replaceAll(output.str(), "\r\n", "\n");
 }
 
+std::string parseBufferProgramOutput(std::string program)
+{
+    std::ostringstream output;
+    Parser parser(program.data(), program.data() + program.size(), output);
+    parser.parseProgram();
+
+    // Normalize EOL to unix style
+    return replaceAll(output.str(), "\r\n", "\n");
+}
+
+// Runs the program without exceptions, returning its status and its output
+Status runProgram(std::string program, std::string &output)
+{
+    std::ostringstream out;
+    Parser parser(program.data(), program.data() + program.size(), out);
+    Status status = parser.run();
+    output = out.str();
+    return status;
+}
+
 const lest::test testParser[] = {
     // Expressions
 
@@ -53,6 +73,15 @@ const lest::test testParser[] = {
         EXPECT(approx(7) == parseExpression("1 + 3 * 2"));
     },
 
+    CASE("parsing '8 - 3 - 2' and '8 / 4 / 2'") {
+        EXPECT(approx(3) == parseExpression("8 - 3 - 2"));
+        EXPECT(approx(1) == parseExpression("8 / 4 / 2"));
+    },
+
+    CASE("parsing '2 + 3 * 4 - 6 / 2 * 3'") {
+        EXPECT(approx(5) == parseExpression("2 + 3 * 4 - 6 / 2 * 3"));
+    },
+
     CASE("parsing '(54)'") {
         EXPECT(approx(54) == parseExpression("(54)"));
     },
@@ -65,6 +94,10 @@ const lest::test testParser[] = {
         EXPECT(approx(35) == parseExpression("((2 + 3) * (3 + 4))"));
     },
 
+    CASE("parsing '2.5e2 - 1E-1'") {
+        EXPECT(approx(249.9) == parseExpression("2.5e2 - 1E-1"));
+    },
+
     CASE("parsing '1.5 + 1 / 2") {
         EXPECT(approx(2) == parseExpression("1.5 + 1 / 2"));
     },
@@ -114,6 +147,10 @@ const lest::test testParser[] = {
         EXPECT("3\n4\n" == parseProgramOutput("\n3\n\n4"));
     },
 
+    CASE("parsing program 1 EOL EOL EOL should print 1 EOL") {
+        EXPECT("1\n" == parseProgramOutput("1\n\n\n"));
+    },
+
     // Programs with variables
     CASE("parsing program a = 3 EOL a * 7 should print 21 EOL") {
         EXPECT("21\n" == parseProgramOutput("a = 3\na * 7\n"));
@@ -132,7 +169,138 @@ const lest::test testParser[] = {
     },
 
     // Program with derivatives
-    CASE("parsing program def f x = 2 * x - sin(x) EOL der f EOL should print ((0 * x) + (2 * 1)) - ((sin' x) * 1)") {
-        EXPECT("((0 * x) + (2 * 1)) - ((sin' x) * 1)\n" == parseProgramOutput("def f x = 2 * x - sin(x)\nder f\n"));
+    CASE("parsing program def f x = 2 * x - sin(x) EOL der f EOL should print 2 - (sin' x)") {
+        EXPECT("2 - (sin' x)\n" == parseProgramOutput("def f x = 2 * x - sin(x)\nder f\n"));
+    },
+    CASE("parsing program def f, f(1), def f twice, f(1) should print the value of the last definition") {
+        EXPECT("1\n3\n" == parseProgramOutput("def f x = x\nf(1)\ndef f x = 2 * x\ndef f x = 3 * x\nf(1)\n"));
+        EXPECT("2\n6\n(sin' x) * 3\n" == parseProgramOutput("def f x = 2 * x\nf(1)\ndef f x = sin(x) * 1\ndef f x = 1 * sin(x) * 3\nf(0) + 6\nder f\n"));
+    },
+
+    // def and der are keywords only where a definition or a derivative may start
+    CASE("parsing program def = 3 EOL der = def + 1 EOL def * der should print 12 EOL") {
+        EXPECT("12\n" == parseProgramOutput("def = 3\nder = def + 1\ndef * der\n"));
+    },
+    CASE("parsing program with def and der as names of functions, parameters and variables") {
+        EXPECT("6\n3\n" == parseProgramOutput("der = 2\ndef def der = der * 3\ndef(der)\nder def\n"));
+        EXPECT("4\n" == parseBufferProgramOutput("def = 2\ndef der x = x * def\nder(2)\n"));
+    },
+
+    // Programs read from a buffer
+    CASE("parsing buffer program a = 3 EOL def f x = x * a EOL f(2) should print 6 EOL") {
+        EXPECT("6\n" == parseBufferProgramOutput("a = 3\ndef f x = x * a\nf(2)"));
+    },
+    CASE("parsing buffer program CRLF 1 + 2 CRLF CRLF 4 should print 3 EOL 4 EOL") {
+        EXPECT("3\n4\n" == parseBufferProgramOutput("\r\n1 + 2\r\n\r\n4"));
+    },
+
+    // Errors without exceptions
+    CASE("running program 1 EOL 2 + EOL 3 stops at the parse error and returns it") {
+        std::string output;
+        Status status = runProgram("1\n2 +\n3", output);
+        EXPECT("1\n" == output);
+        EXPECT(ErrorCode::INVALID_INPUT == status.code());
+        EXPECT(5u == status.offset());
+    },
+    CASE("running program 1 EOL 2 % 3 returns the lexer error") {
+        std::string output;
+        Status status = runProgram("1\n2 % 3", output);
+        EXPECT("Invalid operator type: %" == status.message());
+        EXPECT(4u == status.offset());
+    },
+    CASE("running program a = 1 EOL b = zz + a returns the evaluation error at the statement") {
+        std::string output;
+        Status status = runProgram("a = 1\nb = zz + a", output);
+        EXPECT(ErrorCode::UNKNOWN_VARIABLE == status.code());
+        EXPECT("Unknown variable: zz" == status.message());
+        EXPECT(6u == status.offset());
+    },
+    CASE("running program der f returns the unknown function") {
+        std::string output;
+        EXPECT(ErrorCode::UNKNOWN_FUNCTION == runProgram("der f", output).code());
+    },
+    CASE("parsing program 1 EOL 2 % 3 throws the lexer error") {
+        EXPECT_THROWS_AS(parseProgramOutput("1\n2 % 3"), InvalidInputException);
+    },
+
+    CASE("running statements reuses the statement arena without allocating") {
+        std::string program;
+        for (int i = 0; i < 1000; ++i) {
+            program += "x = (1 + 2) * 3 - sin(4) / 5\n";
+        }
+        std::ostringstream output;
+        Parser parser(program.data(), program.data() + program.size(), output);
+        EXPECT(parser.run().ok());
+        EXPECT(1u == parser.statementArena().blockCount());
+    },
+
+    CASE("redefinitions and failed definitions do not grow the function arena") {
+        // Each body has its own constants, so that no two share nodes
+        std::string program = "def g x = x * 1000000\n";
+        for (int i = 0; i < 10000; ++i) {
+            std::string n = std::to_string(i);
+            program += "def f x = (x + " + n + ") * (x - " + n + ") + g(x) / " + n + "\n";
+            program += "def h x = x + (" + n + "\n";
+        }
+        program += "f(2) + g(1)\n";
+        std::ostringstream output;
+        Parser parser(program.data(), program.data() + program.size(), output);
+        EXPECT(10000u == parser.runBatch().size());
+        EXPECT("-9.89798e+07\n" == output.str());
+        EXPECT(parser.functionArena().nodeCount() < 3 * Parser::MIN_COMPACTED_FUNCTION_NODES);
+    },
+
+    // Very long and very deeply nested expressions
+    CASE("parsing a sum of a million terms") {
+        std::string program = "1";
+        for (int i = 1; i < 1000000; ++i) {
+            program += "+1";
+        }
+        EXPECT("1e+06\n" == parseBufferProgramOutput(program));
+    },
+    CASE("parsing a million nested parenthesis and function calls") {
+        const int depth = 1000000;
+        std::string program = std::string(depth, '(') + "2" + std::string(depth, ')') + "\n";
+        for (int i = 0; i < depth; ++i) {
+            program += "exp(";
+        }
+        program += "0" + std::string(depth, ')');
+        EXPECT("2\ninf\n" == parseBufferProgramOutput(program));
+    },
+
+    // Batch mode
+    CASE("running batch program with bad lines skips them and reports their line and column") {
+        std::string program = "a = 1\n2 % 3\r\n\n  b = zz + a\na + (2\na + 1";
+        std::ostringstream output;
+        Parser parser(program.data(), program.data() + program.size(), output);
+        std::vector<StatementError> errors = parser.runBatch();
+
+        EXPECT("2\n" == output.str());
+        EXPECT(3u == errors.size());
+        EXPECT(2u == errors[0].line);
+        EXPECT(3u == errors[0].column);
+        EXPECT("Invalid operator type: %" == errors[0].status.message());
+        EXPECT(4u == errors[1].line);
+        EXPECT(3u == errors[1].column);
+        EXPECT(ErrorCode::UNKNOWN_VARIABLE == errors[1].status.code());
+        EXPECT(5u == errors[2].line);
+        EXPECT(7u == errors[2].column);
+    },
+    CASE("running batch program without errors reports none") {
+        std::istringstream input{"a = 1\na + 1\n"};
+        std::ostringstream output;
+        Parser parser(input, output);
+        EXPECT(parser.runBatch().empty());
+        EXPECT("2\n" == output.str());
+    },
+    CASE("error reports are JSON lines") {
+        std::vector<StatementError> errors {
+            {Status(ErrorCode::UNKNOWN_FUNCTION, "g", 10), 2, 1},
+            {Status(ErrorCode::INVALID_INPUT, "bad \"\\\r", 27), 5, 3}
+        };
+        std::ostringstream report;
+        writeErrorReport(report, errors);
+        EXPECT("{\"line\":2,\"column\":1,\"offset\":10,\"code\":\"UNKNOWN_FUNCTION\",\"message\":\"Unknown function: g\"}\n"
+               "{\"line\":5,\"column\":3,\"offset\":27,\"code\":\"INVALID_INPUT\",\"message\":\"bad \\\"\\\\\\u000d\"}\n" == report.str());
     }
 };
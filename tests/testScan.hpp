@@ -0,0 +1,75 @@
+#include <string>
+#include <vector>
+
+#include "lest.hpp"
+
+#include "scan.h"
+
+std::vector<ScanImplementation> supportedScanImplementations()
+{
+    std::vector<ScanImplementation> supported;
+    ScanImplementation saved = currentScanImplementation();
+    for (ScanImplementation implementation : {ScanImplementation::SCALAR, ScanImplementation::SSE2, ScanImplementation::AVX2}) {
+        if (setScanImplementation(implementation)) {
+            supported.push_back(implementation);
+        }
+    }
+    setScanImplementation(saved);
+    return supported;
+}
+
+// Scans a run of `runLength` copies of `runChar` followed by `stopChar`, with every
+// implementation, and returns false if any of them stops in the wrong place
+bool scansRun(const char *(*scan)(const char *, const char *), char runChar, char stopChar, std::size_t runLength)
+{
+    std::string input(runLength, runChar);
+    input += stopChar;
+    input += std::string(40, runChar);
+
+    bool ok = true;
+    ScanImplementation saved = currentScanImplementation();
+    for (ScanImplementation implementation : supportedScanImplementations()) {
+        setScanImplementation(implementation);
+        const char *begin = input.data();
+        ok = ok && scan(begin, begin + input.size()) == begin + runLength;
+
+        // Stopping at the end of the buffer must not read past it
+        ok = ok && scan(begin, begin + runLength) == begin + runLength;
+    }
+    setScanImplementation(saved);
+    return ok;
+}
+
+const lest::test testScan[] = {
+    CASE("the best scan implementation is supported") {
+        EXPECT(setScanImplementation(bestScanImplementation()));
+        EXPECT(setScanImplementation(ScanImplementation::SCALAR));
+        EXPECT(setScanImplementation(bestScanImplementation()));
+    },
+
+    CASE("scanning spaces stops at the first non space, at every run length") {
+        for (std::size_t length = 0; length < 70; ++length) {
+            EXPECT(scansRun(scanSpaces, ' ', 'x', length));
+            EXPECT(scansRun(scanSpaces, '\t', '\n', length));
+            EXPECT(scansRun(scanSpaces, '\f', '\r', length));
+        }
+    },
+
+    CASE("scanning digits stops at the first non digit, at every run length") {
+        for (std::size_t length = 0; length < 70; ++length) {
+            EXPECT(scansRun(scanDigits, '7', '.', length));
+            EXPECT(scansRun(scanDigits, '0', '/', length));
+            EXPECT(scansRun(scanDigits, '9', ':', length));
+        }
+    },
+
+    CASE("scanning identifiers stops at the first non identifier part, at every run length") {
+        for (std::size_t length = 0; length < 70; ++length) {
+            EXPECT(scansRun(scanIdentifierParts, 'a', ' ', length));
+            EXPECT(scansRun(scanIdentifierParts, 'Z', '[', length));
+            EXPECT(scansRun(scanIdentifierParts, 'z', '{', length));
+            EXPECT(scansRun(scanIdentifierParts, '5', '@', length));
+            EXPECT(scansRun(scanIdentifierParts, 'q', '\xC1', length));
+        }
+    }
+};
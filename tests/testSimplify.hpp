@@ -0,0 +1,154 @@
+#include <sstream>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "lest.hpp"
+
+#include "node.h"
+#include "parser.h"
+#include "simplify.h"
+
+// The expression parsed from text, simplified
+std::string simplified(const std::string &text, Simplification simplification,
+                       const userFunctionsMap *functions = nullptr, const variablesMap *constants = nullptr)
+{
+    NodeArena arena;
+    std::istringstream input{text};
+    Parser parser(input);
+    NodePtr node = parser.getNextExpressionNode();
+    return Simplifier(simplification, functions, constants).simplify(node, arena)->toString(ToStringType::TOP_LEVEL);
+}
+
+// There is no unary minus: -0 is written 0 / (0 - 1)
+
+// Evaluates the expression before and after exact simplification for values of x among
+// which -0, infinities and NaN, with the global y undefined: the values must be the same,
+// bit for bit, and so must the errors
+bool exactSimplificationKeepsValues(const std::string &text)
+{
+    NodeArena arena;
+    std::istringstream input{text};
+    Parser parser(input);
+    NodePtr node = parser.getNextExpressionNode();
+    NodePtr simple = Simplifier(Simplification::EXACT, nullptr).simplify(node, arena);
+
+    userFunctionsMap functions;
+    variablesMap variables;
+    const double infinity = std::numeric_limits<double>::infinity();
+    for (double x : {0.0, -0.0, 1.0, -2.5, infinity, -infinity, std::numeric_limits<double>::quiet_NaN()}) {
+        EvaluationContext before(functions, variables);
+        EvaluationContext after(functions, variables);
+        double expected = before.withParameter(intern("x"), x, [&]() { return node->eval(before); });
+        double value = after.withParameter(intern("x"), x, [&]() { return simple->eval(after); });
+        if (std::memcmp(&expected, &value, sizeof(value)) != 0 || before.status().code() != after.status().code()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const lest::test testSimplify[] = {
+    CASE("Simplifying folds constant subtrees") {
+        EXPECT("x * 14" == simplified("x * (2 * 3 + 8)", Simplification::EXACT));
+        EXPECT("(x / 0.5) + 3" == simplified("x / (1 / 2) + (1 + 2)", Simplification::EXACT));
+    },
+
+    CASE("Simplifying folds the constants given, and only those") {
+        variablesMap constants {{intern("pi"), M_PI}};
+        NodeArena arena;
+        std::istringstream input{"2 * pi * 3"};
+        Parser parser(input);
+        NodePtr node = Simplifier(Simplification::EXACT, nullptr, &constants).simplify(parser.getNextExpressionNode(), arena);
+        double expected = 2 * M_PI * 3;
+        EXPECT(node->kind() == FlatOpcode::NUMBER);
+        EXPECT(expected == static_cast<NumberNode *>(node)->value());
+
+        EXPECT("(2 * pi) * 3" == simplified("2 * pi * 3", Simplification::EXACT));
+        EXPECT("(x * 3.14159) + e" == simplified("x * pi + e", Simplification::EXACT, nullptr, &constants));
+    },
+
+    CASE("Simplifying folds builtin calls on numbers, unless redefined") {
+        userFunctionsMap functions;
+        EXPECT("x" == simplified("x * cos(0)", Simplification::EXACT, &functions));
+        EXPECT("x * (cos 0)" == simplified("x * cos(0)", Simplification::EXACT));
+        EXPECT("(cos x) * (f 0)" == simplified("cos(x) * f(0)", Simplification::EXACT, &functions));
+
+        NodeArena arena;
+        UserFunctionPtr cos(new UserFunction{intern("cos"), intern("x"), arena.make<VariableNode>("x")});
+        functions.set(cos->name, cos);
+        EXPECT("x * (cos 0)" == simplified("x * cos(0)", Simplification::EXACT, &functions));
+    },
+
+    CASE("Exact simplification applies the identities that hold for every value") {
+        EXPECT("x" == simplified("1 * x * 1 / 1 - 0", Simplification::EXACT));
+        EXPECT("x" == simplified("0 / (0 - 1) + x + 0 / (0 - 1)", Simplification::EXACT));
+        EXPECT("x + 0" == simplified("x + 0", Simplification::EXACT));
+        EXPECT("x - -0" == simplified("x - 0 / (0 - 1)", Simplification::EXACT));
+        EXPECT("0 * x" == simplified("0 * x", Simplification::EXACT));
+        EXPECT("1 / x" == simplified("1 / x", Simplification::EXACT));
+    },
+
+    CASE("Exact simplification keeps every value, -0 and NaN included, and every error") {
+        for (const char *text : {"1 * x * 1 / 1 - 0", "0 / (0 - 1) + x + 0 / (0 - 1)", "x + 0", "0 * x", "x * (0 / 0)",
+                                 "y * 0 + 1 * x", "(2 * 3 - 6) * x / 1"}) {
+            EXPECT(exactSimplificationKeepsValues(text));
+        }
+    },
+
+    CASE("Algebraic simplification also applies the annihilator and the identities of 0") {
+        EXPECT("0" == simplified("0 * x", Simplification::ALGEBRAIC));
+        EXPECT("0" == simplified("(x + 1) * (0 / (0 - 1))", Simplification::ALGEBRAIC));
+        EXPECT("x" == simplified("0 + x + 0 - 0 / (0 - 1)", Simplification::ALGEBRAIC));
+        EXPECT("y" == simplified("1 * y + x * 0", Simplification::ALGEBRAIC));
+    },
+
+    CASE("Simplifying reports the sizes of the expression before and after") {
+        NodeArena arena;
+        std::istringstream input{"2 * 3 + x * 1"};
+        Parser parser(input);
+        Simplifier simplifier(Simplification::EXACT, nullptr);
+        simplifier.simplify(parser.getNextExpressionNode(), arena);
+        EXPECT(7u == simplifier.nodesBefore());
+        EXPECT(3u == simplifier.nodesAfter());
+    },
+
+    CASE("Tree size counts a shared node once per use") {
+        NodeArena arena;
+        NodePtr node = arena.make<VariableNode>("x");
+        for (int i = 0; i < 10; ++i) {
+            node = arena.make<MultiplicationNode>(node, node);
+        }
+        EXPECT(2047u == Simplifier::treeSize(node));
+    },
+
+    CASE("Simplifying a deep expression does not overflow the stack") {
+        NodeArena arena;
+        NodePtr node = arena.make<VariableNode>("x");
+        for (int i = 0; i < 1000000; ++i) {
+            node = arena.make<AdditionNode>(arena.make<MultiplicationNode>(node, arena.make<NumberNode>(1)), arena.make<NumberNode>(-0.0));
+        }
+        EXPECT("x" == Simplifier(Simplification::EXACT, nullptr).simplify(node, arena)->toString(ToStringType::TOP_LEVEL));
+    },
+
+    CASE("Derivatives are simplified") {
+        NodeArena arena;
+        std::istringstream input{"x * y + sin(x * 2)"};
+        Parser parser(input);
+        UserFunction f {intern("f"), intern("x"), parser.getNextExpressionNode()};
+        EXPECT("y + ((sin' (x * 2)) * 2)" == f.derivative(arena)->toString(ToStringType::TOP_LEVEL));
+    },
+
+    CASE("Top level expressions fold the globals and the builtins") {
+        std::ostringstream output;
+        std::istringstream input{"2 * pi * 3 + cos(0)\npi = 1\n2 * pi * 3\ndef cos x = x + 1\ncos(0)\n"};
+        Parser parser(input, output);
+        parser.parseProgram();
+        EXPECT(2u == parser.simplifier().nodesBefore());
+        EXPECT(2u == parser.simplifier().nodesAfter());
+
+        std::ostringstream expected;
+        expected << 2 * M_PI * 3 + 1 << "\n6\n1\n";
+        EXPECT(expected.str() == output.str());
+    },
+};
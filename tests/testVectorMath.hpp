@@ -0,0 +1,113 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "lest.hpp"
+
+#include "vectorMath.h"
+
+// The distance from value to expected in units in the last place of expected. Equal
+// values, including two NaNs and equal infinities, are 0 apart; a NaN or an infinity
+// against anything else is infinitely far.
+double ulpDistance(double value, double expected)
+{
+    if (value == expected || (std::isnan(value) && std::isnan(expected))) {
+        return 0;
+    }
+    if (!std::isfinite(value) || !std::isfinite(expected)) {
+        return HUGE_VAL;
+    }
+    double magnitude = std::fabs(expected);
+    return std::fabs(value - expected) / (std::nextafter(magnitude, HUGE_VAL) - magnitude);
+}
+
+// The largest distance to libm of function over the values, with each supported implementation
+double maxUlpDistance(arrayFunction VectorMath::*function, double (*libm)(double), const std::vector<double> &values)
+{
+    double maxDistance = 0;
+    for (const VectorMath *math : supportedVectorMath()) {
+        std::vector<double> computed = values;
+        (math->*function)(computed.data(), computed.size());
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            maxDistance = std::max(maxDistance, ulpDistance(computed[i], libm(values[i])));
+        }
+    }
+    return maxDistance;
+}
+
+std::vector<double> uniformValues(double low, double high, std::size_t count)
+{
+    std::mt19937_64 random(42);
+    std::uniform_real_distribution<double> distribution(low, high);
+    std::vector<double> values(count);
+    for (double &value : values) {
+        value = distribution(random);
+    }
+    return values;
+}
+
+// Every positive finite double is as likely, from subnormals to the largest
+std::vector<double> positiveValues(std::size_t count)
+{
+    std::mt19937_64 random(42);
+    std::vector<double> values(count);
+    for (double &value : values) {
+        std::uint64_t bits = random() % 0x7FF0000000000000ull;
+        std::memcpy(&value, &bits, sizeof(value));
+    }
+    return values;
+}
+
+// Values where libm has special cases or changes of regime
+const std::vector<double> specialValues {
+    0.0, -0.0, HUGE_VAL, -HUGE_VAL, NAN, 1.0, -1.0, 4.9406564584124654e-324, 2.2250738585072014e-308,
+    1e-300, 1e300, 1e-20, -1e-9, 7.45e-9, 709.78, 709.79, -708.5, -745.13, -745.14, -740.0,
+    0.7853981633974483, 1.5707963267948966, 3.141592653589793, -4.71238898038469, 1048575.0, 1048577.0, 1e7
+};
+
+const lest::test testVectorMath[] = {
+    CASE("Vectorized exp is within 1 ULP of libm") {
+        EXPECT(maxUlpDistance(&VectorMath::exp, std::exp, uniformValues(-746, 710, 100000)) <= 1);
+        EXPECT(maxUlpDistance(&VectorMath::exp, std::exp, uniformValues(-1, 1, 100000)) <= 1);
+        EXPECT(maxUlpDistance(&VectorMath::exp, std::exp, specialValues) <= 1);
+    },
+
+    CASE("Vectorized log is within 1 ULP of libm") {
+        EXPECT(maxUlpDistance(&VectorMath::log, std::log, positiveValues(100000)) <= 1);
+        EXPECT(maxUlpDistance(&VectorMath::log, std::log, uniformValues(0.5, 2, 100000)) <= 1);
+        EXPECT(maxUlpDistance(&VectorMath::log, std::log, specialValues) <= 1);
+    },
+
+    CASE("Vectorized sin and cos are within 1 ULP of libm") {
+        EXPECT(maxUlpDistance(&VectorMath::sin, std::sin, uniformValues(-10, 10, 100000)) <= 1);
+        EXPECT(maxUlpDistance(&VectorMath::sin, std::sin, uniformValues(-2e6, 2e6, 100000)) <= 1);
+        EXPECT(maxUlpDistance(&VectorMath::sin, std::sin, specialValues) <= 1);
+        EXPECT(maxUlpDistance(&VectorMath::cos, std::cos, uniformValues(-10, 10, 100000)) <= 1);
+        EXPECT(maxUlpDistance(&VectorMath::cos, std::cos, uniformValues(-2e6, 2e6, 100000)) <= 1);
+        EXPECT(maxUlpDistance(&VectorMath::cos, std::cos, specialValues) <= 1);
+    },
+
+    CASE("Vectorized tan is within 2 ULP of libm") {
+        EXPECT(maxUlpDistance(&VectorMath::tan, std::tan, uniformValues(-10, 10, 100000)) <= 2);
+        EXPECT(maxUlpDistance(&VectorMath::tan, std::tan, uniformValues(-2e6, 2e6, 100000)) <= 2);
+        EXPECT(maxUlpDistance(&VectorMath::tan, std::tan, specialValues) <= 2);
+    },
+
+    CASE("Vectorized functions keep the sign of zeros, and give the same values wherever they are in an array") {
+        for (const VectorMath *math : supportedVectorMath()) {
+            double zeros[] = {-0.0, -0.0};
+            math->sin(zeros, 1);
+            math->tan(zeros + 1, 1);
+            EXPECT(std::signbit(zeros[0]));
+            EXPECT(std::signbit(zeros[1]));
+
+            std::vector<double> values = uniformValues(-5, 5, 21);
+            std::vector<double> shifted(values.begin() + 3, values.end());
+            math->sin(values.data(), values.size());
+            math->sin(shifted.data(), shifted.size());
+            EXPECT(std::equal(shifted.begin(), shifted.end(), values.begin() + 3));
+        }
+    },
+};
@@ -0,0 +1,78 @@
+#ifndef TIER_FIXTURE_HPP
+#define TIER_FIXTURE_HPP
+
+#include <algorithm>
+#include <sstream>
+#include <cmath>
+
+#include "parser.h"
+
+// The same value bit for bit, NaN matching NaN, or one within a relative tolerance
+inline bool sameValues(double expected, double value, double tolerance = 0)
+{
+    return expected == value || (std::isnan(expected) && std::isnan(value))
+        || std::fabs(expected - value) <= tolerance * std::max(1.0, std::fabs(expected));
+}
+
+inline bool sameErrors(const EvaluationContext &expected, const EvaluationContext &context)
+{
+    return expected.status().code() == context.status().code()
+        && expected.status().detail() == context.status().detail();
+}
+
+// What the tests of the evaluation tiers compare with the tree walker: the function
+// "def h x = body", or its derivative, with f x = x * x + 1, g y = f(y) / x and the
+// global y defined. The nodes live as long as the fixture.
+struct TierFixture
+{
+    TierFixture(const std::string &body, bool derive = false)
+        : input(body), parser(input), variables {{intern("y"), 1.3}},
+          h {intern("h"), intern("x"), parser.getNextExpressionNode()}
+    {
+        NodePtr fBody = arena.make<AdditionNode>(
+            arena.make<MultiplicationNode>(arena.make<VariableNode>("x"), arena.make<VariableNode>("x")),
+            arena.make<NumberNode>(1));
+        NodePtr gBody = arena.make<DivisionNode>(
+            arena.make<FunctionCallNode>("f", arena.make<VariableNode>("y")), arena.make<VariableNode>("x"));
+        UserFunctionPtr f(new UserFunction{intern("f"), intern("x"), fBody});
+        UserFunctionPtr g(new UserFunction{intern("g"), intern("y"), gBody});
+        functions.set(f->name, f);
+        functions.set(g->name, g);
+        if (derive) {
+            h.bodyNode = h.bodyNode->derivative(h.argumentName, arena);
+        }
+    }
+
+    // Evaluates h at x with the tree walker and with evaluate(x, context), x bound in the
+    // context: both must give the same value, bit for bit, and the same error
+    template <typename Evaluate>
+    bool matchesTreeAt(double x, Evaluate evaluate)
+    {
+        EvaluationContext treeContext(functions, variables);
+        EvaluationContext context(functions, variables);
+        double treeValue = treeContext.withParameter(h.argumentName, x, [&]() { return h.bodyNode->eval(treeContext); });
+        double value = context.withParameter(h.argumentName, x, [&]() { return evaluate(x, context); });
+        return sameValues(treeValue, value) && sameErrors(treeContext, context);
+    }
+
+    // The same for x from -3 to 3
+    template <typename Evaluate>
+    bool matchesTree(Evaluate evaluate)
+    {
+        for (double x = -3; x <= 3; x += 0.25) {
+            if (!matchesTreeAt(x, evaluate)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::istringstream input;
+    Parser parser;
+    NodeArena arena;
+    userFunctionsMap functions;
+    variablesMap variables;
+    UserFunction h;
+};
+
+#endif